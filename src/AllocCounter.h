@@ -0,0 +1,14 @@
+/*
+ * AllocCounter.h
+ *
+ * Counts heap allocations made through operator new, so that tests and the
+ * exit log can show the forwarding path does not touch the heap once it has
+ * warmed up. The counting replacements of the global operator new/delete
+ * live in AllocCounter.cpp and end up in every program linked with muxcore.
+ */
+#pragma once
+
+#include <cstdint>
+
+/// operator new calls so far, on all threads.
+uint64_t heapAllocations();
@@ -0,0 +1,243 @@
+/*
+ * Arq.cpp
+ */
+#include "Arq.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t cMs = 1000000;
+
+// Until the first round trip is measured. Generous, because at low baud a
+// full window can take seconds to drain.
+constexpr uint64_t cInitialRtoNs = 1000 * cMs;
+constexpr uint64_t cMinRtoNs = 20 * cMs;
+constexpr uint64_t cMaxRtoNs = 10000 * cMs;
+
+} // namespace
+
+Arq::Arq(size_t window)
+    : m_window(std::clamp<size_t>(window, 1, cMaxWindow))
+    , m_tx(new TxSlot[cMaxWindow])
+    , m_rx(new RxSlot[cMaxWindow])
+    , m_rtoNs(cInitialRtoNs)
+{
+    m_stats.rtoNs = m_rtoNs;
+}
+
+Arq::~Arq() = default;
+
+uint8_t Arq::queue(uint8_t channel, const uint8_t* data, size_t len, bool more)
+{
+    TxSlot& slot = txSlot(m_txNext);
+    slot.state = TxState::Queued;
+    slot.channel = channel;
+    slot.len = uint16_t(len);
+    slot.more = more;
+    slot.resent = false;
+    slot.batches++;
+    std::memcpy(slot.data, data, len);
+    m_stats.framesSent++;
+    return m_txNext++;
+}
+
+uint8_t Arq::channel(uint8_t seq) const
+{
+    return txSlot(seq).channel;
+}
+
+bool Arq::more(uint8_t seq) const
+{
+    return txSlot(seq).more;
+}
+
+const uint8_t* Arq::data(uint8_t seq) const
+{
+    return txSlot(seq).data;
+}
+
+size_t Arq::size(uint8_t seq) const
+{
+    return txSlot(seq).len;
+}
+
+size_t Arq::takeResends(uint64_t nowNs, uint8_t* seqs, size_t max)
+{
+    size_t count = 0;
+    bool timedOut = false;
+    size_t inFlight = this->inFlight();
+    for (size_t i = 0; i < inFlight && count < max; ++i) {
+        uint8_t seq = uint8_t(m_txBase + i);
+        TxSlot& slot = txSlot(seq);
+        if (slot.state == TxState::Outstanding && nowNs >= slot.sentAt + m_rtoNs) {
+            m_stats.timeouts++;
+            timedOut = true;
+        } else if (slot.state != TxState::Lost) {
+            continue;
+        }
+        slot.state = TxState::Queued;
+        slot.resent = true;
+        slot.batches++;
+        m_stats.retransmits++;
+        seqs[count++] = seq;
+    }
+    if (timedOut) {
+        // Back off until a frame gets through first time again.
+        m_rtoNs = std::min(2 * m_rtoNs, cMaxRtoNs);
+        m_stats.rtoNs = m_rtoNs;
+    }
+    return count;
+}
+
+void Arq::sent(uint8_t seq, uint64_t nowNs, uint8_t path)
+{
+    TxSlot& slot = txSlot(seq);
+    // Until now the batch pointed at the slot's data, so it could not be
+    // reused even if acknowledged.
+    if (slot.batches > 0) {
+        slot.batches--;
+    }
+    // An ack may have overtaken the write.
+    if (slot.state == TxState::Queued) {
+        slot.state = TxState::Outstanding;
+        slot.path = uint8_t(std::min<size_t>(path, cMaxPaths - 1));
+        slot.sentAt = nowNs;
+        slot.order = ++m_sendOrder;
+    }
+}
+
+void Arq::onAck(uint8_t ack, const uint8_t* sack, size_t sackLen, uint64_t nowNs)
+{
+    size_t inFlight = this->inFlight();
+    size_t newlyAcked = uint8_t(ack - m_txBase);
+    if (newlyAcked > inFlight) {
+        return; // older than what has already been acknowledged
+    }
+    PathOrders newestOrder{};
+    for (size_t i = 0; i < newlyAcked; ++i) {
+        TxSlot& slot = txSlot(uint8_t(m_txBase + i));
+        acked(slot, nowNs, newestOrder);
+        slot.state = TxState::Free;
+    }
+    m_txBase = ack;
+    inFlight -= newlyAcked;
+
+    for (size_t bit = 0; bit < sackLen * 8; ++bit) {
+        if (!(sack[bit / 8] & (1u << (bit % 8)))) {
+            continue;
+        }
+        size_t offset = bit + 1;
+        if (offset >= inFlight) {
+            break;
+        }
+        TxSlot& slot = txSlot(uint8_t(m_txBase + offset));
+        if (slot.state != TxState::Acked) {
+            acked(slot, nowNs, newestOrder);
+            slot.state = TxState::Acked;
+        }
+    }
+
+    // Anything written before a frame that got through the same way has
+    // been lost.
+    for (size_t i = 0; i < inFlight; ++i) {
+        TxSlot& slot = txSlot(uint8_t(m_txBase + i));
+        if (slot.state == TxState::Outstanding && slot.order < newestOrder[slot.path]) {
+            slot.state = TxState::Lost;
+            m_stats.fastRetransmits++;
+        }
+    }
+}
+
+void Arq::acked(TxSlot& slot, uint64_t nowNs, PathOrders& newestOrder)
+{
+    if (slot.state != TxState::Outstanding && slot.state != TxState::Lost) {
+        return;
+    }
+    if (!slot.resent) {
+        sampleRtt(nowNs - slot.sentAt);
+    }
+    newestOrder[slot.path] = std::max(newestOrder[slot.path], slot.order);
+}
+
+void Arq::sampleRtt(uint64_t sampleNs)
+{
+    if (m_srttNs == 0) {
+        m_srttNs = sampleNs;
+        m_rttVarNs = sampleNs / 2;
+    } else {
+        uint64_t error = m_srttNs > sampleNs ? m_srttNs - sampleNs : sampleNs - m_srttNs;
+        m_rttVarNs = (3 * m_rttVarNs + error) / 4;
+        m_srttNs = (7 * m_srttNs + sampleNs) / 8;
+    }
+    m_rtoNs = std::clamp(m_srttNs + 4 * m_rttVarNs, cMinRtoNs, cMaxRtoNs);
+    m_stats.rttNs = m_srttNs;
+    m_stats.rtoNs = m_rtoNs;
+}
+
+uint64_t Arq::nextTimeout() const
+{
+    uint64_t deadline = UINT64_MAX;
+    size_t inFlight = this->inFlight();
+    for (size_t i = 0; i < inFlight; ++i) {
+        const TxSlot& slot = txSlot(uint8_t(m_txBase + i));
+        if (slot.state == TxState::Lost) {
+            return 0;
+        }
+        if (slot.state == TxState::Outstanding) {
+            deadline = std::min(deadline, slot.sentAt + m_rtoNs);
+        }
+    }
+    return deadline;
+}
+
+void Arq::onData(uint8_t seq, uint8_t channel, const uint8_t* data, size_t len, bool more, const Deliver& deliver)
+{
+    m_ackPending = true;
+    size_t offset = uint8_t(seq - m_rxNext);
+    if (offset >= cMaxWindow) {
+        m_stats.duplicates++; // already delivered; the ack was lost
+        return;
+    }
+    if (offset > 0) {
+        RxSlot& slot = rxSlot(seq);
+        if (slot.held) {
+            m_stats.duplicates++;
+            return;
+        }
+        slot.held = true;
+        slot.channel = channel;
+        slot.len = uint16_t(len);
+        slot.more = more;
+        std::memcpy(slot.data, data, len);
+        m_rxHeld++;
+        m_stats.outOfOrder++;
+        return;
+    }
+
+    deliver(channel, data, len, more);
+    m_rxNext++;
+    m_stats.framesReceived++;
+    for (RxSlot* slot = &rxSlot(m_rxNext); slot->held; slot = &rxSlot(m_rxNext)) {
+        slot->held = false;
+        m_rxHeld--;
+        deliver(slot->channel, slot->data, slot->len, slot->more);
+        m_rxNext++;
+        m_stats.framesReceived++;
+    }
+}
+
+size_t Arq::encodeSack(uint8_t* out)
+{
+    m_ackPending = false;
+    size_t len = 0;
+    std::memset(out, 0, cMaxSackSize);
+    for (size_t bit = 0; m_rxHeld > 0 && bit < cMaxWindow - 1; ++bit) {
+        if (rxSlot(uint8_t(m_rxNext + 1 + bit)).held) {
+            out[bit / 8] |= uint8_t(1u << (bit % 8));
+            len = bit / 8 + 1;
+        }
+    }
+    return len;
+}
@@ -0,0 +1,184 @@
+/*
+ * Arq.h
+ *
+ * Selective-repeat ARQ for the reliable link mode. The sender keeps a copy
+ * of every frame until the peer acknowledges it, with up to window() frames
+ * in flight; the receiver hands frames on in sequence order, holding the
+ * ones that arrive after a gap until the gap is filled.
+ *
+ * Acknowledgements are cumulative (the next sequence number expected) plus
+ * a bitmap of the frames received beyond it, so only lost frames are sent
+ * again. A frame is resent when its timer expires, or at once when a frame
+ * sent after it has been acknowledged: a serial line does not reorder, so
+ * the earlier one was lost. The timeout follows the measured round trip
+ * (Jacobson/Karels, with Karn's rule of not sampling resent frames).
+ *
+ * Bonded links share one Arq, so frames are numbered across all of them and
+ * the receiver puts them back in order. Each link is a path of its own for
+ * loss detection: only a later frame on the same path shows a frame lost.
+ *
+ * Storage for the whole sequence space is allocated up front, so the
+ * receiver accepts whatever window the peer uses. Arq does no I/O and
+ * reads no clock; the Link passes the time in.
+ */
+#pragma once
+
+#include "Frame.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+class Arq
+{
+public:
+    /// 8-bit sequence numbers allow a window of at most half their range.
+    static constexpr size_t cMaxWindow = 128;
+    static constexpr size_t cDefaultWindow = 32;
+    /// Largest acknowledgement bitmap.
+    static constexpr size_t cMaxSackSize = cMaxWindow / 8;
+    /// Most links that may share an Arq.
+    static constexpr size_t cMaxPaths = 8;
+
+    struct Stats
+    {
+        uint64_t framesSent = 0;      // first transmissions
+        uint64_t retransmits = 0;     // all later ones
+        uint64_t timeouts = 0;        // retransmits because a timer expired
+        uint64_t fastRetransmits = 0; // retransmits because a later frame got through
+        uint64_t framesReceived = 0;  // delivered in order
+        uint64_t outOfOrder = 0;      // held back until a gap was filled
+        uint64_t duplicates = 0;      // received again and dropped
+        uint64_t rttNs = 0;           // smoothed round trip
+        uint64_t rtoNs = 0;           // current retransmit timeout
+    };
+
+    /// more: the frame had cMoreFlag set.
+    using Deliver = std::function<void(uint8_t channel, const uint8_t* data, size_t len, bool more)>;
+
+    /// window is clamped to [1, cMaxWindow].
+    explicit Arq(size_t window = cDefaultWindow);
+    ~Arq();
+
+    Arq(const Arq&) = delete;
+    Arq& operator=(const Arq&) = delete;
+
+    size_t window() const { return m_window; }
+
+    // Sender.
+
+    /// Frames sent but not yet acknowledged, resends included.
+    size_t inFlight() const { return uint8_t(m_txNext - m_txBase); }
+    /// Also while the next frame's slot is still in a batch being written,
+    /// though acknowledged: a bonded link's write may take that long.
+    bool windowFull() const { return inFlight() >= m_window || txSlot(m_txNext).batches > 0; }
+
+    /// Copy a new frame into the window and return its sequence number,
+    /// to be passed to sent() once written. Must not be called while
+    /// windowFull().
+    uint8_t queue(uint8_t channel, const uint8_t* data, size_t len, bool more = false);
+
+    /// The stored copy of frame seq.
+    uint8_t channel(uint8_t seq) const;
+    bool more(uint8_t seq) const;
+    const uint8_t* data(uint8_t seq) const;
+    size_t size(uint8_t seq) const;
+
+    /// Store up to max sequence numbers that are due for resending at nowNs
+    /// in seqs, oldest first, and return how many. They count as resent;
+    /// each is to be passed to sent() once written.
+    size_t takeResends(uint64_t nowNs, uint8_t* seqs, size_t max);
+
+    /// Frame seq has been written to the port of the given path (below
+    /// cMaxPaths); its timer starts now, unless it was acknowledged first.
+    void sent(uint8_t seq, uint64_t nowNs, uint8_t path = 0);
+
+    /// Handle the Ack field of any frame from the peer, and the bitmap of
+    /// an ack frame (sackLen 0 for a data frame).
+    void onAck(uint8_t ack, const uint8_t* sack, size_t sackLen, uint64_t nowNs);
+
+    /// When the earliest timer expires, or UINT64_MAX if none is running.
+    uint64_t nextTimeout() const;
+
+    // Receiver.
+
+    /// Handle a data frame from the peer; frames that are now in order are
+    /// passed to deliver, this one in place.
+    void onData(uint8_t seq, uint8_t channel, const uint8_t* data, size_t len, bool more, const Deliver& deliver);
+
+    /// The Ack field to send: the next sequence number expected.
+    uint8_t ackNumber() const { return m_rxNext; }
+
+    /// Data arrived since the last acknowledgement went out.
+    bool ackPending() const { return m_ackPending; }
+
+    /// Frames after a gap are being held, so the peer needs the bitmap.
+    bool haveGap() const { return m_rxHeld > 0; }
+
+    /// Write the bitmap for an ack frame into out (room for cMaxSackSize)
+    /// and return its length. Clears ackPending().
+    size_t encodeSack(uint8_t* out);
+
+    /// An acknowledgement went out in a data frame's header.
+    void ackSent() { m_ackPending = false; }
+
+    const Stats& stats() const { return m_stats; }
+
+private:
+    enum class TxState : uint8_t
+    {
+        Free,
+        Queued,      // in a batch that has not been written yet
+        Outstanding, // written, timer running
+        Lost,        // to be resent as soon as possible
+        Acked,       // selectively acknowledged, still inside the window
+    };
+
+    struct TxSlot
+    {
+        TxState state = TxState::Free;
+        uint8_t channel = 0;
+        uint16_t len = 0;
+        bool more = false;
+        bool resent = false;
+        uint8_t path = 0;
+        uint8_t batches = 0; // batches it is in that are not written yet
+        uint64_t sentAt = 0;
+        uint64_t order = 0; // when it was last written, in transmissions
+        uint8_t data[cMaxDataSize];
+    };
+
+    struct RxSlot
+    {
+        bool held = false;
+        uint8_t channel = 0;
+        uint16_t len = 0;
+        bool more = false;
+        uint8_t data[cMaxDataSize];
+    };
+
+    TxSlot& txSlot(uint8_t seq) const { return m_tx[seq % cMaxWindow]; }
+    RxSlot& rxSlot(uint8_t seq) const { return m_rx[seq % cMaxWindow]; }
+    using PathOrders = std::array<uint64_t, cMaxPaths>;
+    void acked(TxSlot& slot, uint64_t nowNs, PathOrders& newestOrder);
+    void sampleRtt(uint64_t sampleNs);
+
+    size_t m_window;
+    std::unique_ptr<TxSlot[]> m_tx;
+    std::unique_ptr<RxSlot[]> m_rx;
+
+    uint8_t m_txBase = 0; // oldest frame not acknowledged
+    uint8_t m_txNext = 0; // sequence number of the next new frame
+    uint64_t m_sendOrder = 0;
+    uint64_t m_srttNs = 0;
+    uint64_t m_rttVarNs = 0;
+    uint64_t m_rtoNs;
+
+    uint8_t m_rxNext = 0;
+    size_t m_rxHeld = 0;
+    bool m_ackPending = false;
+
+    Stats m_stats;
+};
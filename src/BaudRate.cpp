@@ -0,0 +1,57 @@
+/*
+ * BaudRate.cpp
+ */
+#include "BaudRate.h"
+
+#include "Util.h"
+
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+unsigned setBaudRate(int fd, unsigned baud)
+{
+    // A rate of 0 would hang up the line rather than set it.
+    if (baud == 0) {
+        throw std::invalid_argument("baud rate must not be 0");
+    }
+    struct termios2 tio;
+    if (::ioctl(fd, TCGETS2, &tio) < 0) {
+        throwErrno("TCGETS2");
+    }
+    // Both directions at the same rate: input bits left zero mean "as output".
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    if (::ioctl(fd, TCSETS2, &tio) < 0) {
+        throwErrno("TCSETS2 " + std::to_string(baud) + " baud");
+    }
+    return baudRate(fd);
+}
+
+unsigned baudRate(int fd)
+{
+    struct termios2 tio;
+    if (::ioctl(fd, TCGETS2, &tio) < 0) {
+        return 0;
+    }
+    return tio.c_ospeed;
+}
+
+#else
+
+unsigned setBaudRate(int, unsigned baud)
+{
+    throw std::invalid_argument("unsupported baud rate " + std::to_string(baud));
+}
+
+unsigned baudRate(int)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * BaudRate.h
+ *
+ * Line rates outside the termios Bxxxx table. Linux takes any rate through
+ * termios2 with BOTHER, and the driver picks the closest divisor its UART
+ * has. Kept apart from SerialPort.cpp because the kernel's termios2 header
+ * cannot be included alongside <termios.h>.
+ */
+#pragma once
+
+/// Set fd's input and output rate to baud. Returns the rate the driver
+/// settled on, which may differ slightly. Throws std::system_error, or
+/// std::invalid_argument for 0, or where only the standard rates exist.
+unsigned setBaudRate(int fd, unsigned baud);
+
+/// The output rate fd is set to, or 0 if it cannot be told.
+unsigned baudRate(int fd);
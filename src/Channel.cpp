@@ -0,0 +1,157 @@
+/*
+ * Channel.cpp
+ */
+#include "Channel.h"
+
+#include "Crc.h"
+#include "Log.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+void publishSymlink(const char* target, const std::string& path)
+{
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0) {
+        if (!S_ISLNK(st.st_mode)) {
+            throw std::runtime_error(path + " exists and is not a symlink");
+        }
+        // Left over from a previous run.
+        ::unlink(path.c_str());
+    }
+    if (::symlink(target, path.c_str()) < 0) {
+        throwErrno("symlink " + path);
+    }
+}
+
+} // namespace
+
+std::unique_ptr<Channel> Channel::createPty(const ChannelSpec& spec)
+{
+    int master = ::posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master < 0) {
+        throwErrno("posix_openpt");
+    }
+    if (::grantpt(master) < 0 || ::unlockpt(master) < 0) {
+        int err = errno;
+        ::close(master);
+        errno = err;
+        throwErrno("grantpt/unlockpt");
+    }
+    const char* slaveName = ::ptsname(master);
+    int slave = slaveName ? ::open(slaveName, O_RDWR | O_NOCTTY | O_CLOEXEC) : -1;
+    if (slave < 0) {
+        int err = errno;
+        ::close(master);
+        errno = err;
+        throwErrno("open pty slave");
+    }
+
+    // Raw mode: the multiplexer moves bytes, it must not echo or translate them.
+    termios tio;
+    if (::tcgetattr(slave, &tio) == 0) {
+        ::cfmakeraw(&tio);
+        ::tcsetattr(slave, TCSANOW, &tio);
+    }
+
+    try {
+        publishSymlink(slaveName, spec.path);
+    } catch (...) {
+        ::close(slave);
+        ::close(master);
+        throw;
+    }
+    logInfo("channel %u: %s -> %s", unsigned(spec.id), spec.path.c_str(), slaveName);
+    std::unique_ptr<Channel> channel(new Channel(spec.id, master, slave, spec.path, spec.ringSize));
+    channel->configure(spec);
+    return channel;
+}
+
+Channel::Channel(uint8_t id, int fd, size_t ringSize)
+    : Channel(id, fd, -1, std::string(), ringSize)
+{
+}
+
+Channel::Channel(uint8_t id, int fd, int slaveFd, std::string path, size_t ringSize)
+    : m_id(id)
+    , m_fd(fd)
+    , m_slaveFd(slaveFd)
+    , m_path(std::move(path))
+    , m_in(std::clamp(ringSize, cMinRingSize, cMaxRingSize))
+{
+    setNonBlocking(m_fd);
+}
+
+Channel::~Channel()
+{
+    if (!m_path.empty()) {
+        ::unlink(m_path.c_str());
+    }
+    if (m_slaveFd >= 0) {
+        ::close(m_slaveFd);
+    }
+    ::close(m_fd);
+}
+
+void Channel::configure(const ChannelSpec& spec)
+{
+    setPriority(spec.priority);
+    setWeight(spec.weight);
+    setMaxMessage(spec.maxMessage);
+    setMessageIdle(spec.messageIdleMs);
+    setDelimiter(spec.delimiter);
+    setCoalesce(spec.coalesceMs, spec.coalesceBytes);
+    if (spec.compress) {
+        enableCompression(spec.dictionary.empty() ? std::vector<uint8_t>() : readFile(spec.dictionary));
+    }
+}
+
+void Channel::enableCompression(const std::vector<uint8_t>& dictionary)
+{
+    m_encoder = std::make_unique<LzEncoder>();
+    m_decoder = std::make_unique<LzDecoder>();
+    m_dictionaryCrc = crc32c(dictionary.data(), dictionary.size());
+    if (!dictionary.empty()) {
+        m_encoder->prime(dictionary.data(), dictionary.size());
+        m_decoder->prime(dictionary.data(), dictionary.size());
+    }
+}
+
+void Channel::endMessageAt(uint64_t end)
+{
+    if (end == m_openFrom) {
+        return;
+    }
+    if (m_endsCount == cMaxMessageEnds) {
+        m_ends[(m_endsHead + m_endsCount - 1) % cMaxMessageEnds] = end;
+    } else {
+        m_ends[(m_endsHead + m_endsCount) % cMaxMessageEnds] = end;
+        m_endsCount++;
+    }
+    m_openFrom = end;
+}
+
+size_t Channel::messageRemaining(size_t offset) const
+{
+    if (m_endsCount == 0) {
+        return SIZE_MAX;
+    }
+    uint64_t at = m_stats.bytesFromPort - m_in.readable() + offset;
+    return size_t(m_ends[m_endsHead] - at);
+}
+
+void Channel::messageSent()
+{
+    m_endsHead = (m_endsHead + 1) % cMaxMessageEnds;
+    m_endsCount--;
+}
@@ -0,0 +1,219 @@
+/*
+ * Channel.h
+ *
+ * One virtual serial port: the master side of a pty whose slave is exposed
+ * to users through a symlink at the channel's device path.
+ */
+#pragma once
+
+#include "Frame.h"
+#include "FrameQueue.h"
+#include "Lz.h"
+#include "SpscRing.h"
+#include "TxScheduler.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Size of the ring holding a channel's input until it goes out on the
+/// link. The minimum leaves room for the read being handled plus one more
+/// the engine may complete after the channel is paused.
+constexpr size_t cDefaultRingSize = 16 * 1024;
+constexpr size_t cMinRingSize = 4 * cMaxDataSize;
+constexpr size_t cMaxRingSize = 16 * 1024 * 1024;
+
+/// Largest message a channel in message mode delivers in one write; the
+/// remote side holds a message back until it is complete.
+constexpr size_t cMaxMessageSize = 64 * 1024;
+/// Message ends the sender can remember before merging messages.
+constexpr size_t cMaxMessageEnds = 64;
+/// How long a virtual port in message mode has to be quiet for its input to
+/// end a message, by default and at most.
+constexpr unsigned cDefaultMessageIdleMs = 2;
+constexpr unsigned cMaxMessageIdleMs = 1000;
+
+/// Input that arrives in dribs, such as keystrokes, waits up to this long
+/// for more before it is framed, unless this much has come together. The
+/// default of the command line; a Channel made directly does not wait.
+constexpr unsigned cDefaultCoalesceMs = 2;
+constexpr unsigned cMaxCoalesceMs = 100;
+constexpr size_t cDefaultCoalesceBytes = cMaxDataSize;
+constexpr size_t cMaxCoalesceBytes = 16 * 1024;
+
+/// A -c channel:devicePath[:option=value...] specification from the command line.
+struct ChannelSpec
+{
+    uint8_t id = 0;
+    std::string path;
+    size_t ringSize = cDefaultRingSize;
+    unsigned priority = cDefaultPriority;
+    unsigned weight = cDefaultWeight;
+    size_t maxMessage = 0; // 0: byte stream
+    unsigned messageIdleMs = cDefaultMessageIdleMs;
+    int delimiter = -1; // byte that ends a message instead of idle time
+    unsigned coalesceMs = cDefaultCoalesceMs; // 0: frame input as it comes
+    size_t coalesceBytes = cDefaultCoalesceBytes;
+    bool compress = false;
+    std::string dictionary; // file priming the compression history
+};
+
+class Channel
+{
+public:
+    struct Stats
+    {
+        uint64_t bytesFromPort = 0; // read from the virtual port, sent on the link
+        uint64_t bytesToPort = 0;   // received on the link, written to the virtual port
+    };
+
+    /// Create a pty and publish its slave at spec.path. Throws on failure.
+    static std::unique_ptr<Channel> createPty(const ChannelSpec& spec);
+
+    /// Adopt an already-open fd (socket, pipe, pty master). The fd is made
+    /// non-blocking and closed by the destructor.
+    Channel(uint8_t id, int fd, size_t ringSize = cDefaultRingSize);
+    ~Channel();
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    /// Apply everything in spec but its id, path and ring size, which the
+    /// constructor takes. Reads the dictionary file, if any; throws on
+    /// failure.
+    void configure(const ChannelSpec& spec);
+
+    uint8_t id() const { return m_id; }
+    int fd() const { return m_fd; }
+    const std::string& path() const { return m_path; }
+
+    /// Link priority of this channel's input, 0 (highest) to cPriorityLevels - 1.
+    unsigned priority() const { return m_priority; }
+    void setPriority(unsigned priority)
+    {
+        m_priority = priority < cPriorityLevels ? priority : cPriorityLevels - 1;
+    }
+
+    /// Share of the link under TxPolicy::Drr, 1 to cMaxWeight.
+    unsigned weight() const { return m_weight; }
+    void setWeight(unsigned weight) { m_weight = std::clamp(weight, 1u, cMaxWeight); }
+
+    /// Message mode: the port carries messages of up to maxMessage() bytes
+    /// instead of a byte stream, and each arrives in one write on the far
+    /// side. 0 for a stream.
+    size_t maxMessage() const { return m_maxMessage; }
+    void setMaxMessage(size_t bytes) { m_maxMessage = std::min(bytes, cMaxMessageSize); }
+
+    /// Quiet time after which input ends a message.
+    uint64_t messageIdleNs() const { return m_messageIdleNs; }
+    void setMessageIdle(unsigned ms) { m_messageIdleNs = uint64_t(std::min(ms, cMaxMessageIdleMs)) * 1000000; }
+
+    /// Let input wait up to ms for more, until bytes are queued; 0 ms sends
+    /// every read as soon as the link takes it.
+    uint64_t coalesceNs() const { return m_coalesceNs; }
+    size_t coalesceBytes() const { return m_coalesceBytes; }
+    void setCoalesce(unsigned ms, size_t bytes)
+    {
+        m_coalesceNs = uint64_t(std::min(ms, cMaxCoalesceMs)) * 1000000;
+        m_coalesceBytes = std::clamp<size_t>(bytes, 1, cMaxCoalesceBytes);
+    }
+
+    /// Message mode: input ends a message after each of this byte, such as
+    /// '\n' for lines, rather than when it goes quiet; -1 for the latter.
+    int delimiter() const { return m_delimiter; }
+    void setDelimiter(int byte) { m_delimiter = byte >= 0 && byte <= 0xff ? byte : -1; }
+
+    /// Compress frame payloads in both directions (see Lz.h); the peer's
+    /// channel must do the same, with the same dictionary. nullptr while off.
+    void enableCompression(const std::vector<uint8_t>& dictionary = {});
+    LzEncoder* encoder() { return m_encoder.get(); }
+    LzDecoder* decoder() { return m_decoder.get(); }
+    /// CRC-32C of the dictionary, for checking it against the peer's; that
+    /// of no bytes (0) without one.
+    uint32_t dictionaryCrc() const { return m_dictionaryCrc; }
+
+    /// Data received on the link for this port, waiting to be written to it.
+    FrameQueue& output() { return m_out; }
+
+    /// Copy len bytes into buffers from pool; returns how many fitted. With
+    /// hold set they wait for the rest of their message.
+    size_t queueOutput(FramePool& pool, const uint8_t* data, size_t len, bool hold = false)
+    {
+        size_t queued = m_out.append(pool, data, len, hold);
+        m_stats.bytesToPort += queued;
+        return queued;
+    }
+
+    /// Data read from the virtual port, waiting to be framed onto the link.
+    /// Frames point into the ring until the link write completes.
+    SpscRing& input() { return m_in; }
+
+    /// Copy len bytes into the input ring; returns how many fitted.
+    size_t queueInput(const uint8_t* data, size_t len)
+    {
+        size_t queued = m_in.write(data, len);
+        m_stats.bytesFromPort += queued;
+        return queued;
+    }
+
+    /// Message mode: the input queued so far completes a message. If too
+    /// many ends are waiting already, the message joins the one before.
+    void endMessage() { endMessageAt(m_stats.bytesFromPort); }
+    /// The same for the input up to end, as a bytesFromPort count.
+    void endMessageAt(uint64_t end);
+
+    /// Input not yet followed by endMessage().
+    bool messageOpen() const { return m_openFrom < m_stats.bytesFromPort; }
+
+    /// Bytes from offset into the input ring to the next message end, or
+    /// SIZE_MAX if the message there is still open.
+    size_t messageRemaining(size_t offset) const;
+
+    /// The first message end has gone out on the link.
+    void messageSent();
+
+    /// Input or a message end still to go out on the link.
+    bool txPending() const { return !m_in.empty() || m_endsCount > 0; }
+
+    /// When input last arrived (CLOCK_MONOTONIC ns); kept by the Multiplexer
+    /// to end messages on idle.
+    uint64_t lastInputNs() const { return m_lastInputNs; }
+    void setLastInputNs(uint64_t nowNs) { m_lastInputNs = nowNs; }
+
+    /// When the input now waiting for more arrived; kept by the Multiplexer.
+    uint64_t coalesceFromNs() const { return m_coalesceFromNs; }
+    void setCoalesceFromNs(uint64_t nowNs) { m_coalesceFromNs = nowNs; }
+
+    const Stats& stats() const { return m_stats; }
+
+private:
+    Channel(uint8_t id, int fd, int slaveFd, std::string path, size_t ringSize);
+
+    uint8_t m_id;
+    int m_fd;
+    int m_slaveFd = -1; // held open so the master never sees a hangup
+    std::string m_path;  // symlink we created, removed on destruction
+    unsigned m_priority = cDefaultPriority;
+    unsigned m_weight = cDefaultWeight;
+    size_t m_maxMessage = 0;
+    uint64_t m_messageIdleNs = uint64_t(cDefaultMessageIdleMs) * 1000000;
+    int m_delimiter = -1;
+    // Message ends, as input byte counts (bytesFromPort), oldest first.
+    std::array<uint64_t, cMaxMessageEnds> m_ends{};
+    size_t m_endsHead = 0;
+    size_t m_endsCount = 0;
+    uint64_t m_openFrom = 0; // where the open message starts
+    uint64_t m_lastInputNs = 0;
+    uint64_t m_coalesceNs = 0;
+    size_t m_coalesceBytes = cDefaultCoalesceBytes;
+    uint64_t m_coalesceFromNs = 0;
+    std::unique_ptr<LzEncoder> m_encoder;
+    std::unique_ptr<LzDecoder> m_decoder;
+    uint32_t m_dictionaryCrc = 0;
+    SpscRing m_in;
+    FrameQueue m_out;
+    Stats m_stats;
+};
@@ -0,0 +1,135 @@
+/*
+ * Cobs.cpp
+ */
+#include "Cobs.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t cOnes = 0x0101010101010101ull;
+constexpr uint64_t cHighs = 0x8080808080808080ull;
+
+// Non-zero iff some byte of v is zero. The lowest flagged byte is always a
+// real zero; flags above it can be false (a 0x01 just above a zero).
+inline uint64_t zeroBytes(uint64_t v)
+{
+    return (v - cOnes) & ~v & cHighs;
+}
+
+} // namespace
+
+size_t findZeroByte(const uint8_t* p, size_t n)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t v;
+        std::memcpy(&v, p + i, sizeof(v));
+        if (uint64_t z = zeroBytes(v)) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return i + size_t(__builtin_ctzll(z)) / 8;
+#else
+            (void)z;
+            break;
+#endif
+        }
+    }
+    for (; i < n; ++i) {
+        if (p[i] == 0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+size_t cobsEncode(const uint8_t* in, size_t n, uint8_t* out)
+{
+    uint8_t* code = out;
+    uint8_t* dst = out + 1;
+    for (;;) {
+        size_t limit = std::min(n, size_t(254));
+        size_t run = findZeroByte(in, limit);
+        std::memcpy(dst, in, run);
+        dst += run;
+        in += run;
+        n -= run;
+        if (run < limit) {
+            // Stopped at a zero: it ends this group and is not copied.
+            *code = uint8_t(run + 1);
+            code = dst++;
+            in++;
+            n--;
+        } else if (run == 254) {
+            // A full group carries no implied zero.
+            *code = 0xff;
+            if (n == 0) {
+                break;
+            }
+            code = dst++;
+        } else {
+            *code = uint8_t(run + 1);
+            break;
+        }
+    }
+    return size_t(dst - out);
+}
+
+CobsDecoder::CobsDecoder(size_t capacity)
+    : m_frame(new uint8_t[capacity])
+    , m_capacity(capacity)
+{
+}
+
+size_t CobsDecoder::decode(const uint8_t* data, size_t len, bool& frameEnd)
+{
+    frameEnd = false;
+    if (m_started) {
+        // The previous call ended a frame; start the next one.
+        m_size = 0;
+        m_groupLeft = 0;
+        m_zeroPending = false;
+        m_broken = false;
+        m_started = false;
+    }
+
+    size_t pos = 0;
+    while (pos < len) {
+        if (m_groupLeft == 0) {
+            uint8_t code = data[pos++];
+            if (code == 0) {
+                frameEnd = true;
+                m_started = true;
+                return pos;
+            }
+            if (m_zeroPending) {
+                if (m_size < m_capacity) {
+                    m_frame[m_size++] = 0;
+                } else {
+                    m_broken = true;
+                }
+            }
+            m_groupLeft = code - 1u;
+            m_zeroPending = code != 0xff;
+            continue;
+        }
+        size_t n = std::min(len - pos, m_groupLeft);
+        size_t zero = findZeroByte(data + pos, n);
+        if (zero < n) {
+            // A delimiter inside a group: bytes were lost.
+            m_broken = true;
+            frameEnd = true;
+            m_started = true;
+            return pos + zero + 1;
+        }
+        if (m_size + n <= m_capacity) {
+            std::memcpy(m_frame.get() + m_size, data + pos, n);
+            m_size += n;
+        } else {
+            m_broken = true;
+        }
+        m_groupLeft -= n;
+        pos += n;
+    }
+    return pos;
+}
@@ -0,0 +1,59 @@
+/*
+ * Cobs.h
+ *
+ * Consistent Overhead Byte Stuffing: re-encodes a frame so that it contains
+ * no zero bytes, which leaves 0x00 free to mark frame boundaries. A
+ * receiver that loses sync just waits for the next zero.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// Largest encoding of n bytes, not counting the delimiter.
+constexpr size_t cobsMaxEncodedSize(size_t n)
+{
+    return n + n / 254 + 1;
+}
+
+/// Index of the first zero byte in p[0..n), or n if there is none. Scans a
+/// machine word at a time.
+size_t findZeroByte(const uint8_t* p, size_t n);
+
+/// Encode n bytes into out, which must have room for cobsMaxEncodedSize(n).
+/// No delimiter is appended. Returns the encoded length.
+size_t cobsEncode(const uint8_t* in, size_t n, uint8_t* out);
+
+/// Decodes a stream of delimited COBS frames fed in chunks of any size,
+/// resuming mid-frame where the previous chunk ended.
+class CobsDecoder
+{
+public:
+    /// Frames that decode to more than capacity bytes are discarded.
+    explicit CobsDecoder(size_t capacity);
+
+    CobsDecoder(const CobsDecoder&) = delete;
+    CobsDecoder& operator=(const CobsDecoder&) = delete;
+
+    /// Decode from data up to and including the next delimiter. Returns the
+    /// number of bytes consumed; frameEnd is set if that was a delimiter, in
+    /// which case frame()/size()/valid() describe the frame until the next
+    /// call.
+    size_t decode(const uint8_t* data, size_t len, bool& frameEnd);
+
+    const uint8_t* frame() const { return m_frame.get(); }
+    size_t size() const { return m_size; }
+
+    /// False if the frame was cut short by a delimiter or overflowed.
+    bool valid() const { return !m_broken; }
+
+private:
+    std::unique_ptr<uint8_t[]> m_frame;
+    size_t m_capacity;
+    size_t m_size = 0;
+    size_t m_groupLeft = 0;    // data bytes left in the current group
+    bool m_zeroPending = false; // the group just ended implies a zero if more follows
+    bool m_broken = false;
+    bool m_started = false;
+};
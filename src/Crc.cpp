@@ -0,0 +1,138 @@
+/*
+ * Crc.cpp
+ */
+#include "Crc.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace {
+
+// Slice-by-8 tables for a reflected CRC: t[k][b] is the CRC of byte b
+// followed by k zero bytes.
+template <typename T>
+struct SliceTables
+{
+    explicit SliceTables(T poly)
+    {
+        for (unsigned i = 0; i < 256; ++i) {
+            T crc = T(i);
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? T((crc >> 1) ^ poly) : T(crc >> 1);
+            }
+            t[0][i] = crc;
+        }
+        for (unsigned i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                t[k][i] = T((t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff]);
+            }
+        }
+    }
+
+    T update(T crc, const uint8_t* p, size_t n) const
+    {
+        for (; n >= 8; n -= 8, p += 8) {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            v = __builtin_bswap64(v);
+#endif
+            v ^= crc;
+            crc = T(t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+                    t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^
+                    t[1][(v >> 48) & 0xff] ^ t[0][v >> 56]);
+        }
+        for (; n > 0; --n) {
+            crc = T((crc >> 8) ^ t[0][(crc ^ *p++) & 0xff]);
+        }
+        return crc;
+    }
+
+    T t[8][256];
+};
+
+const SliceTables<uint16_t> gCrc16(0xa001);
+const SliceTables<uint32_t> gCrc32c(0x82f63b78);
+
+uint32_t crc32cSliced(uint32_t crc, const uint8_t* p, size_t n)
+{
+    return gCrc32c.update(crc, p, n);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32cSse42(uint32_t crc, const uint8_t* p, size_t n)
+{
+    uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+    }
+    for (; n > 0; --n) {
+        c = _mm_crc32_u8(uint32_t(c), *p++);
+    }
+    return uint32_t(c);
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+uint32_t crc32cArm(uint32_t crc, const uint8_t* p, size_t n)
+{
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+    }
+    for (; n > 0; --n) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+struct Crc32cImpl
+{
+    uint32_t (*fn)(uint32_t, const uint8_t*, size_t);
+    const char* name;
+};
+
+Crc32cImpl pickCrc32c()
+{
+#if defined(__x86_64__)
+    // This runs from a static constructor, possibly before libgcc's own.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        return {crc32cSse42, "sse4.2"};
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    return {crc32cArm, "armv8-crc"};
+#endif
+    return {crc32cSliced, "slice-by-8"};
+}
+
+const Crc32cImpl gCrc32cImpl = pickCrc32c();
+
+} // namespace
+
+uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc)
+{
+    return gCrc16.update(crc, data, len);
+}
+
+uint32_t crc32c(const uint8_t* data, size_t len, uint32_t crc)
+{
+    return ~gCrc32cImpl.fn(~crc, data, len);
+}
+
+uint32_t crc32cPortable(const uint8_t* data, size_t len, uint32_t crc)
+{
+    return ~crc32cSliced(~crc, data, len);
+}
+
+const char* crc32cImplementation()
+{
+    return gCrc32cImpl.name;
+}
@@ -0,0 +1,25 @@
+/*
+ * Crc.h
+ *
+ * Checksums for the optional frame trailer. Both are reflected CRCs
+ * computed eight bytes per step with slice-by-8 tables; CRC-32C also uses
+ * the SSE4.2 or ARMv8 CRC instructions when the CPU has them.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// CRC-16/MODBUS (poly 0x8005 reflected, init 0xffff, no final xor). Pass
+/// the previous result to continue over more data.
+uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xffff);
+
+/// CRC-32C (Castagnoli). Pass the previous result to continue over more
+/// data. Uses the CPU's CRC instructions when available.
+uint32_t crc32c(const uint8_t* data, size_t len, uint32_t crc = 0);
+
+/// The slice-by-8 CRC-32C, whatever the CPU supports.
+uint32_t crc32cPortable(const uint8_t* data, size_t len, uint32_t crc = 0);
+
+/// Name of the CRC-32C implementation crc32c() uses.
+const char* crc32cImplementation();
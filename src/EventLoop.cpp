@@ -0,0 +1,299 @@
+/*
+ * EventLoop.cpp
+ */
+#include "EventLoop.h"
+
+#include "Log.h"
+#include "Util.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint64_t cWakeToken = ~uint64_t(0);
+constexpr size_t cMaxEpollEvents = 256;
+
+uint32_t toEpoll(uint32_t events)
+{
+    uint32_t out = 0;
+    if (events & EventLoop::cReadable) {
+        out |= EPOLLIN;
+    }
+    if (events & EventLoop::cWritable) {
+        out |= EPOLLOUT;
+    }
+    return out;
+}
+
+short toPoll(uint32_t events)
+{
+    short out = 0;
+    if (events & EventLoop::cReadable) {
+        out |= POLLIN;
+    }
+    if (events & EventLoop::cWritable) {
+        out |= POLLOUT;
+    }
+    return out;
+}
+
+uint32_t fromNative(uint32_t in, uint32_t readFlag, uint32_t writeFlag, uint32_t hupFlags)
+{
+    uint32_t out = 0;
+    if (in & readFlag) {
+        out |= EventLoop::cReadable;
+    }
+    if (in & writeFlag) {
+        out |= EventLoop::cWritable;
+    }
+    if (in & hupFlags) {
+        out |= EventLoop::cHangup;
+    }
+    return out;
+}
+
+} // namespace
+
+EventLoop::EventLoop(Backend preferred)
+    : m_backend(preferred)
+{
+    m_wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd < 0) {
+        throwErrno("eventfd");
+    }
+
+    if (m_backend == Backend::Epoll) {
+        m_epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (m_epollFd < 0) {
+            logWarning("epoll_create1 failed (%s), falling back to poll()", strerror(errno));
+            m_backend = Backend::Poll;
+        }
+    }
+
+    if (m_backend == Backend::Epoll) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = cWakeToken;
+        if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev) < 0) {
+            int err = errno;
+            ::close(m_epollFd);
+            ::close(m_wakeFd);
+            errno = err;
+            throwErrno("epoll_ctl(wakeup)");
+        }
+        m_epollEvents.resize(cMaxEpollEvents);
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    if (m_epollFd >= 0) {
+        ::close(m_epollFd);
+    }
+    ::close(m_wakeFd);
+}
+
+const char* EventLoop::backendName(Backend backend)
+{
+    return backend == Backend::Epoll ? "epoll" : "poll";
+}
+
+void EventLoop::add(int fd, uint32_t events, Handler handler)
+{
+    if (fd < 0) {
+        throw std::invalid_argument("EventLoop::add: bad fd");
+    }
+    if (size_t(fd) >= m_entries.size()) {
+        m_entries.resize(size_t(fd) + 1);
+    }
+    Entry& entry = m_entries[fd];
+    if (entry.active) {
+        throw std::logic_error("EventLoop::add: fd already registered");
+    }
+    entry.handler = std::move(handler);
+    entry.events = events;
+    entry.generation++;
+    entry.active = true;
+
+    if (m_backend == Backend::Epoll) {
+        epoll_event ev{};
+        ev.events = toEpoll(events);
+        ev.data.u64 = (uint64_t(entry.generation) << 32) | uint32_t(fd);
+        if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            entry.active = false;
+            throwErrno("epoll_ctl(ADD)");
+        }
+    } else {
+        m_pollDirty = true;
+    }
+}
+
+void EventLoop::modify(int fd, uint32_t events)
+{
+    if (!contains(fd)) {
+        return;
+    }
+    Entry& entry = m_entries[fd];
+    if (entry.events == events) {
+        return;
+    }
+    entry.events = events;
+
+    if (m_backend == Backend::Epoll) {
+        epoll_event ev{};
+        ev.events = toEpoll(events);
+        ev.data.u64 = (uint64_t(entry.generation) << 32) | uint32_t(fd);
+        if (::epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+            throwErrno("epoll_ctl(MOD)");
+        }
+    } else {
+        m_pollDirty = true;
+    }
+}
+
+void EventLoop::remove(int fd)
+{
+    if (!contains(fd)) {
+        return;
+    }
+    Entry& entry = m_entries[fd];
+    entry.active = false;
+    entry.events = 0;
+    if (m_dispatching) {
+        // The handler may be the one currently executing.
+        m_graveyard.push_back(std::move(entry.handler));
+    }
+    entry.handler = nullptr;
+
+    if (m_backend == Backend::Epoll) {
+        // Failure here only means the fd was already closed, which also
+        // removes it from the epoll set.
+        ::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    } else {
+        m_pollDirty = true;
+    }
+}
+
+bool EventLoop::contains(int fd) const
+{
+    return fd >= 0 && size_t(fd) < m_entries.size() && m_entries[fd].active;
+}
+
+uint32_t EventLoop::events(int fd) const
+{
+    return contains(fd) ? m_entries[fd].events : 0;
+}
+
+void EventLoop::run()
+{
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        runOnce(-1);
+    }
+    m_stop.store(false, std::memory_order_relaxed);
+}
+
+int EventLoop::runOnce(int timeoutMs)
+{
+    m_ready.clear();
+    if (m_backend == Backend::Epoll) {
+        collectEpoll(timeoutMs);
+    } else {
+        collectPoll(timeoutMs);
+    }
+
+    // Handlers may add/remove fds, so every ready entry is re-validated
+    // against its registration generation before it is called.
+    int dispatched = 0;
+    m_dispatching = true;
+    for (const Ready& ready : m_ready) {
+        Entry& entry = m_entries[ready.fd];
+        if (!entry.active || entry.generation != ready.generation) {
+            continue;
+        }
+        entry.handler(ready.events);
+        ++dispatched;
+    }
+    m_dispatching = false;
+    m_graveyard.clear();
+    return dispatched;
+}
+
+void EventLoop::stop()
+{
+    m_stop.store(true, std::memory_order_relaxed);
+    uint64_t one = 1;
+    // Only async-signal-safe calls here.
+    ssize_t rc = ::write(m_wakeFd, &one, sizeof(one));
+    (void)rc;
+}
+
+void EventLoop::collectEpoll(int timeoutMs)
+{
+    int n = ::epoll_wait(m_epollFd, m_epollEvents.data(), int(m_epollEvents.size()), timeoutMs);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        throwErrno("epoll_wait");
+    }
+    for (int i = 0; i < n; ++i) {
+        const epoll_event& ev = m_epollEvents[i];
+        if (ev.data.u64 == cWakeToken) {
+            drainWakeup();
+            continue;
+        }
+        m_ready.push_back({int(uint32_t(ev.data.u64)), uint32_t(ev.data.u64 >> 32),
+                           fromNative(ev.events, EPOLLIN, EPOLLOUT, EPOLLERR | EPOLLHUP)});
+    }
+}
+
+void EventLoop::collectPoll(int timeoutMs)
+{
+    if (m_pollDirty) {
+        rebuildPollSet();
+    }
+    int n = ::poll(m_pollFds.data(), m_pollFds.size(), timeoutMs);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+        throwErrno("poll");
+    }
+    if (n == 0) {
+        return;
+    }
+    if (m_pollFds[0].revents & POLLIN) {
+        drainWakeup();
+    }
+    for (size_t i = 1; i < m_pollFds.size(); ++i) {
+        const pollfd& pfd = m_pollFds[i];
+        if (pfd.revents == 0) {
+            continue;
+        }
+        m_ready.push_back({pfd.fd, m_entries[pfd.fd].generation,
+                           fromNative(uint32_t(pfd.revents), POLLIN, POLLOUT, POLLERR | POLLHUP | POLLNVAL)});
+    }
+}
+
+void EventLoop::rebuildPollSet()
+{
+    m_pollFds.clear();
+    m_pollFds.push_back({m_wakeFd, POLLIN, 0});
+    for (size_t fd = 0; fd < m_entries.size(); ++fd) {
+        if (m_entries[fd].active) {
+            m_pollFds.push_back({int(fd), toPoll(m_entries[fd].events), 0});
+        }
+    }
+    m_pollDirty = false;
+}
+
+void EventLoop::drainWakeup()
+{
+    uint64_t value;
+    while (::read(m_wakeFd, &value, sizeof(value)) > 0) {
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * EventLoop.h
+ *
+ * Single-threaded readiness reactor built on epoll, with a poll() fallback
+ * for kernels (or sandboxes) where epoll is unavailable.
+ *
+ * Every fd registered here must be non-blocking: handlers are called when
+ * the fd is ready and are expected to read/write until EAGAIN or until they
+ * have done a fair share of work, then return to the loop.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <poll.h>
+#include <sys/epoll.h>
+
+class EventLoop
+{
+public:
+    enum class Backend
+    {
+        Epoll,
+        Poll,
+    };
+
+    // Event mask bits passed to add()/modify() and to handlers.
+    static constexpr uint32_t cReadable = 0x1;
+    static constexpr uint32_t cWritable = 0x2;
+    static constexpr uint32_t cHangup = 0x4; // reported only, never requested
+
+    using Handler = std::function<void(uint32_t events)>;
+
+    explicit EventLoop(Backend preferred = Backend::Epoll);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    Backend backend() const { return m_backend; }
+    static const char* backendName(Backend backend);
+
+    /// Register fd with an initial interest mask. An fd may be registered once.
+    void add(int fd, uint32_t events, Handler handler);
+    /// Change the interest mask of a registered fd (no-op if unchanged).
+    void modify(int fd, uint32_t events);
+    /// Unregister fd. Safe to call from inside any handler, including fd's own.
+    void remove(int fd);
+
+    bool contains(int fd) const;
+    uint32_t events(int fd) const;
+
+    /// Dispatch until stop() is called.
+    void run();
+    /// Wait at most timeoutMs (-1 = forever) and dispatch one batch of events.
+    /// Returns the number of handlers called.
+    int runOnce(int timeoutMs);
+
+    /// Ask run() to return. Safe to call from other threads and signal handlers.
+    void stop();
+    bool stopRequested() const { return m_stop.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry
+    {
+        Handler handler;
+        uint32_t events = 0;
+        uint32_t generation = 0;
+        bool active = false;
+    };
+
+    struct Ready
+    {
+        int fd;
+        uint32_t generation;
+        uint32_t events;
+    };
+
+    void collectEpoll(int timeoutMs);
+    void collectPoll(int timeoutMs);
+    void rebuildPollSet();
+    void drainWakeup();
+
+    Backend m_backend;
+    int m_epollFd = -1;
+    int m_wakeFd = -1;
+    std::atomic<bool> m_stop{false};
+
+    std::vector<Entry> m_entries; // indexed by fd
+    std::vector<Ready> m_ready;
+    std::vector<Handler> m_graveyard; // handlers removed while dispatching
+    bool m_dispatching = false;
+
+    std::vector<epoll_event> m_epollEvents;
+    std::vector<pollfd> m_pollFds;
+    bool m_pollDirty = true;
+};
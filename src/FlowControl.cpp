@@ -0,0 +1,40 @@
+/*
+ * FlowControl.cpp
+ */
+#include "FlowControl.h"
+
+#include <algorithm>
+
+FlowControl::FlowControl(size_t window)
+    : m_window(std::clamp(window, cMinWindow, cMaxWindow))
+{
+}
+
+size_t FlowControl::credit(uint8_t id) const
+{
+    // Signed: a limit behind what was sent (the peer restarted) is no credit.
+    int32_t credit = int32_t(m_tx[id].limit - m_tx[id].sent);
+    return credit > 0 ? size_t(credit) : 0;
+}
+
+void FlowControl::stall(uint8_t id, uint64_t nowNs)
+{
+    if (m_tx[id].probeAt == 0) {
+        m_tx[id].probeAt = nowNs + cProbeIntervalNs;
+    }
+}
+
+bool FlowControl::probeDue(uint8_t id, uint64_t nowNs)
+{
+    if (m_tx[id].probeAt == 0 || nowNs < m_tx[id].probeAt) {
+        return false;
+    }
+    m_tx[id].probeAt = nowNs + cProbeIntervalNs;
+    return true;
+}
+
+bool FlowControl::updateDue(uint8_t id, size_t buffered) const
+{
+    int32_t moved = int32_t(limit(id, buffered) - m_rx[id].advertised);
+    return moved >= int32_t(m_window / 4);
+}
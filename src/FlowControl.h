@@ -0,0 +1,99 @@
+/*
+ * FlowControl.h
+ *
+ * Credit-based flow control per channel between the two serial-mux
+ * processes, so that a virtual port nobody reads on the far side stops its
+ * own channel instead of the whole link.
+ *
+ * Each side counts the payload bytes it has sent and received on every
+ * channel, modulo 2^32. The receiver advertises a limit: the bytes it has
+ * received, less those still waiting for its virtual port, plus its window.
+ * The sender sends no further than the last limit it heard. Limits are
+ * absolute, so a lost or repeated advertisement does no harm; a sender that
+ * has run out of credit probes every cProbeIntervalNs with its own count
+ * until credit arrives. On a link without retransmission the probe also
+ * tells the receiver how much data was lost (the link keeps frames in
+ * order, so anything sent before the probe that has not arrived never
+ * will), which would otherwise never be credited back.
+ *
+ * FlowControl does no I/O and reads no clock; the Multiplexer sends the
+ * control frames and passes the time in.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class FlowControl
+{
+public:
+    static constexpr size_t cMinWindow = 1024;
+    static constexpr size_t cMaxWindow = 64 * 1024;
+    static constexpr size_t cDefaultWindow = 16 * 1024;
+    static constexpr uint64_t cProbeIntervalNs = 100000000;
+
+    /// window is clamped to [cMinWindow, cMaxWindow].
+    explicit FlowControl(size_t window = cDefaultWindow);
+
+    size_t window() const { return m_window; }
+
+    // Sender.
+
+    /// Bytes channel id may send now.
+    size_t credit(uint8_t id) const;
+    void sent(uint8_t id, size_t bytes) { m_tx[id].sent += uint32_t(bytes); }
+    uint32_t sentCount(uint8_t id) const { return m_tx[id].sent; }
+
+    /// The peer's latest limit for channel id. The link keeps control frames
+    /// in order, so the latest is also the newest.
+    void setLimit(uint8_t id, uint32_t limit) { m_tx[id].limit = limit; }
+
+    /// Channel id has input but no credit; the first probe is due one
+    /// interval from nowNs. Nothing happens if it was already stalled.
+    void stall(uint8_t id, uint64_t nowNs);
+    void unstall(uint8_t id) { m_tx[id].probeAt = 0; }
+    bool stalled(uint8_t id) const { return m_tx[id].probeAt != 0; }
+
+    /// If a probe for stalled channel id is due at nowNs, schedule the next
+    /// one and return true.
+    bool probeDue(uint8_t id, uint64_t nowNs);
+    uint64_t probeAt(uint8_t id) const { return m_tx[id].probeAt; }
+
+    // Receiver.
+
+    void received(uint8_t id, size_t bytes) { m_rx[id].received += uint32_t(bytes); }
+
+    /// A probe said the peer has sent sentCount bytes; on a lossy link
+    /// whatever has not arrived is gone.
+    void resync(uint8_t id, uint32_t sentCount) { m_rx[id].received = sentCount; }
+
+    /// The limit to advertise while buffered bytes still wait for the
+    /// virtual port.
+    uint32_t limit(uint8_t id, size_t buffered) const
+    {
+        return m_rx[id].received - uint32_t(buffered) + uint32_t(m_window);
+    }
+
+    /// The limit has moved a quarter window past the last one advertised.
+    bool updateDue(uint8_t id, size_t buffered) const;
+    void advertised(uint8_t id, uint32_t limit) { m_rx[id].advertised = limit; }
+
+private:
+    struct TxState
+    {
+        uint32_t sent = 0;
+        uint32_t limit = 0;
+        uint64_t probeAt = 0; // 0 while not stalled
+    };
+
+    struct RxState
+    {
+        uint32_t received = 0;
+        uint32_t advertised = 0;
+    };
+
+    size_t m_window;
+    std::array<TxState, 256> m_tx{};
+    std::array<RxState, 256> m_rx{};
+};
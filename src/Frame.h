@@ -0,0 +1,185 @@
+/*
+ * Frame.h
+ *
+ * Wire format of the multiplexed stream on the physical port:
+ *   Channel Id : 1 byte (0..255)
+ *   NumBytes   : 2 bytes, big-endian (0..cMaxDataSize), plus flags:
+ *                0x8000 control frame (below)
+ *                0x4000 more: the message continues in the next frame of
+ *                this channel (never set on an empty frame)
+ *   Data...    : NumBytes bytes
+ *
+ *   Trailer    : optional CRC over header and data, big-endian
+ *
+ * With HeaderFormat::Compact, Channel Id and NumBytes are sent in 1 to 3
+ * bytes instead:
+ *   0cccllll                      channel 0..7, 0..15 bytes, no flags
+ *   1CMXllll, channel[, hhhhhhhh] C: control, M: more, llll the low four
+ *                                 bits of the length and, with X set, a
+ *                                 byte hhhhhhhh (non-zero) with the rest
+ * The checksum still covers the 3-byte header the compact one stands for.
+ *
+ * With Framing::Cobs each frame is COBS-encoded and followed by a 0x00
+ * delimiter, so a receiver that loses a byte resynchronizes at the next
+ * frame instead of misreading every length after it.
+ *
+ * In reliable mode every frame starts with an ARQ header:
+ *   Type       : 1 byte, cArqData or cArqAck
+ *   Seq        : 1 byte, sequence number of a data frame (0 in an ack)
+ *   Ack        : 1 byte, next sequence number expected from the peer
+ * An ack frame has channel 0 and carries a bitmap of the frames after Ack
+ * that have already arrived (bit 0 of byte 0 is Ack + 1).
+ *
+ * A control frame has the top bit of NumBytes set and carries a message
+ * between the two serial-mux processes about the channel in its header:
+ *   Kind       : 1 byte, ControlKind
+ *   Value      : 4 bytes, big-endian
+ * Control frames are not sequenced in reliable mode (type cArqControl), so
+ * like everything on an unreliable link they may be lost. Heartbeats are
+ * about the link they travel on rather than a channel, and go on channel 0.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+constexpr size_t cMaxDataSize = 1024;
+constexpr size_t cHeaderSize = 3;
+constexpr size_t cMaxFrameSize = cHeaderSize + cMaxDataSize;
+
+constexpr size_t cArqHeaderSize = 3;
+constexpr size_t cMaxHeaderSize = cArqHeaderSize + cHeaderSize;
+constexpr uint8_t cArqData = 0xa5;
+constexpr uint8_t cArqAck = 0x5a;
+constexpr uint8_t cArqControl = 0xc3;
+
+constexpr uint16_t cControlFlag = 0x8000;
+constexpr uint16_t cMoreFlag = 0x4000;
+constexpr uint16_t cLengthMask = 0x3fff;
+constexpr size_t cControlSize = 5;
+
+enum ControlKind : uint8_t
+{
+    cControlCredit = 1,    // Value: how far the sender may go on the channel
+    cControlProbe = 2,     // Value: how far the sender has gone; asks for credit
+    cControlHeartbeat = 3, // Value: 1 if the sender hears the peer on this link
+};
+
+/// How channel and length are encoded in the header; both ends must agree.
+enum class HeaderFormat
+{
+    Standard,
+    Compact,
+};
+
+/// How frames are delimited on the physical port; both ends must agree.
+enum class Framing
+{
+    Length,
+    Cobs,
+};
+
+/// Checksum trailer on every frame; both ends must agree.
+enum class Checksum
+{
+    None,
+    Crc16, // CRC-16/MODBUS
+    Crc32, // CRC-32C
+};
+
+constexpr size_t cMaxTrailerSize = 4;
+
+constexpr size_t trailerSize(Checksum checksum)
+{
+    return checksum == Checksum::Crc16 ? 2 : checksum == Checksum::Crc32 ? 4 : 0;
+}
+
+inline void encodeHeader(uint8_t* out, uint8_t channel, uint16_t numBytes)
+{
+    out[0] = channel;
+    out[1] = uint8_t(numBytes >> 8);
+    out[2] = uint8_t(numBytes);
+}
+
+inline uint16_t decodeNumBytes(const uint8_t* header)
+{
+    return uint16_t((header[1] << 8) | header[2]);
+}
+
+inline bool isControl(const uint8_t* header)
+{
+    return (decodeNumBytes(header) & cControlFlag) != 0;
+}
+
+/// Payload length of a data or control frame.
+inline size_t payloadSize(const uint8_t* header)
+{
+    return decodeNumBytes(header) & cLengthMask;
+}
+
+/// A data frame whose message goes on in a later frame.
+inline bool hasMore(const uint8_t* header)
+{
+    return (decodeNumBytes(header) & cMoreFlag) != 0;
+}
+
+constexpr size_t cMaxCompactHeaderSize = 3;
+
+/// Size of the compact header that starts with first.
+inline size_t compactHeaderSize(uint8_t first)
+{
+    return (first & 0x80) == 0 ? 1 : (first & 0x10) ? 3 : 2;
+}
+
+/// Encode a standard header as a compact one; returns its size.
+inline size_t encodeCompactHeader(uint8_t* out, const uint8_t* header)
+{
+    uint16_t numBytes = decodeNumBytes(header);
+    size_t len = numBytes & cLengthMask;
+    if ((numBytes & ~cLengthMask) == 0 && header[0] < 8 && len < 16) {
+        out[0] = uint8_t(header[0] << 4 | len);
+        return 1;
+    }
+    out[0] = uint8_t(0x80 | (numBytes & cControlFlag ? 0x40 : 0) | (numBytes & cMoreFlag ? 0x20 : 0) |
+                     (len >> 4 ? 0x10 : 0) | (len & 0x0f));
+    out[1] = header[0];
+    if (len >> 4) {
+        out[2] = uint8_t(len >> 4);
+        return 3;
+    }
+    return 2;
+}
+
+/// Decode a compact header of compactHeaderSize(in[0]) bytes into a
+/// standard one. Returns false for an encoding the sender never produces.
+inline bool decodeCompactHeader(const uint8_t* in, uint8_t* header)
+{
+    if ((in[0] & 0x80) == 0) {
+        encodeHeader(header, uint8_t(in[0] >> 4), uint16_t(in[0] & 0x0f));
+        return true;
+    }
+    size_t len = in[0] & 0x0f;
+    if (in[0] & 0x10) {
+        if (in[2] == 0) {
+            return false;
+        }
+        len |= size_t(in[2]) << 4;
+    }
+    uint16_t flags = uint16_t((in[0] & 0x40 ? cControlFlag : 0) | (in[0] & 0x20 ? cMoreFlag : 0));
+    encodeHeader(header, in[1], uint16_t(len | flags));
+    return true;
+}
+
+inline void encodeControl(uint8_t* out, ControlKind kind, uint32_t value)
+{
+    out[0] = kind;
+    out[1] = uint8_t(value >> 24);
+    out[2] = uint8_t(value >> 16);
+    out[3] = uint8_t(value >> 8);
+    out[4] = uint8_t(value);
+}
+
+inline uint32_t decodeControlValue(const uint8_t* payload)
+{
+    return uint32_t(payload[1]) << 24 | uint32_t(payload[2]) << 16 | uint32_t(payload[3]) << 8 | payload[4];
+}
@@ -0,0 +1,41 @@
+/*
+ * FramePool.cpp
+ */
+#include "FramePool.h"
+
+FramePool::FramePool(size_t count)
+    : m_buffers(new FrameBuffer[count])
+    , m_capacity(count)
+    , m_available(count)
+{
+    for (size_t i = count; i-- > 0;) {
+        m_buffers[i].next = m_free;
+        m_free = &m_buffers[i];
+    }
+    m_stats.lowestAvailable = count;
+}
+
+FrameBuffer* FramePool::acquire()
+{
+    FrameBuffer* buffer = m_free;
+    if (!buffer) {
+        m_stats.exhausted++;
+        return nullptr;
+    }
+    m_free = buffer->next;
+    buffer->next = nullptr;
+    buffer->begin = 0;
+    buffer->end = 0;
+    m_stats.acquired++;
+    if (--m_available < m_stats.lowestAvailable) {
+        m_stats.lowestAvailable = m_available;
+    }
+    return buffer;
+}
+
+void FramePool::release(FrameBuffer* buffer)
+{
+    buffer->next = m_free;
+    m_free = buffer;
+    m_available++;
+}
@@ -0,0 +1,55 @@
+/*
+ * FramePool.h
+ *
+ * Frame-sized buffers carved out of one arena allocated up front, so that
+ * forwarding never touches the heap once the multiplexer is running. The
+ * pool never grows: the Multiplexer stops reading the link while it runs
+ * low instead.
+ */
+#pragma once
+
+#include "Frame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+struct FrameBuffer
+{
+    FrameBuffer* next = nullptr;
+    uint16_t begin = 0; // unwritten bytes are data[begin, end)
+    uint16_t end = 0;
+    uint8_t data[cMaxFrameSize];
+};
+
+class FramePool
+{
+public:
+    struct Stats
+    {
+        uint64_t acquired = 0;
+        uint64_t exhausted = 0;     // acquire() calls that found the pool empty
+        size_t lowestAvailable = 0; // fewest free buffers seen
+    };
+
+    explicit FramePool(size_t count);
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    /// A cleared buffer, or nullptr if all are in use.
+    FrameBuffer* acquire();
+    void release(FrameBuffer* buffer);
+
+    size_t capacity() const { return m_capacity; }
+    size_t available() const { return m_available; }
+
+    const Stats& stats() const { return m_stats; }
+
+private:
+    std::unique_ptr<FrameBuffer[]> m_buffers;
+    size_t m_capacity;
+    size_t m_available;
+    FrameBuffer* m_free = nullptr;
+    Stats m_stats;
+};
@@ -0,0 +1,91 @@
+/*
+ * FrameQueue.cpp
+ */
+#include "FrameQueue.h"
+
+#include <algorithm>
+#include <cstring>
+
+size_t FrameQueue::append(FramePool& pool, const uint8_t* data, size_t len, bool hold)
+{
+    size_t done = 0;
+    while (done < len) {
+        if (!m_tail || m_tail->end == cMaxFrameSize) {
+            FrameBuffer* buffer = pool.acquire();
+            if (!buffer) {
+                break;
+            }
+            if (m_tail) {
+                m_tail->next = buffer;
+            } else {
+                m_head = buffer;
+            }
+            m_tail = buffer;
+        }
+        size_t n = std::min(len - done, cMaxFrameSize - m_tail->end);
+        std::memcpy(m_tail->data + m_tail->end, data + done, n);
+        m_tail->end = uint16_t(m_tail->end + n);
+        done += n;
+    }
+    m_bytes += done;
+    if (!hold) {
+        m_ready = m_bytes;
+    }
+    return done;
+}
+
+int FrameQueue::beginWrite(iovec* iov, int maxIov)
+{
+    if (m_writing || m_ready == 0) {
+        return 0;
+    }
+    int count = 0;
+    size_t left = m_ready;
+    for (FrameBuffer* b = m_head; b && left > 0 && count < maxIov; b = b->next) {
+        size_t n = std::min(left, size_t(b->end - b->begin));
+        iov[count].iov_base = b->data + b->begin;
+        iov[count].iov_len = n;
+        m_lastInFlight = uint16_t(n);
+        left -= n;
+        count++;
+    }
+    m_inFlight = count;
+    m_writing = true;
+    return count;
+}
+
+void FrameQueue::endWrite(FramePool& pool)
+{
+    for (int i = 0; i < m_inFlight; ++i) {
+        FrameBuffer* b = m_head;
+        size_t written = i + 1 < m_inFlight ? size_t(b->end - b->begin) : m_lastInFlight;
+        b->begin = uint16_t(b->begin + written);
+        m_bytes -= written;
+        m_ready -= written;
+        if (b->begin < b->end) {
+            // The tail got more data during the write, or the rest is held.
+            break;
+        }
+        m_head = b->next;
+        if (!m_head) {
+            m_tail = nullptr;
+        }
+        pool.release(b);
+    }
+    m_inFlight = 0;
+    m_writing = false;
+}
+
+void FrameQueue::clear(FramePool& pool)
+{
+    while (m_head) {
+        FrameBuffer* b = m_head;
+        m_head = b->next;
+        pool.release(b);
+    }
+    m_tail = nullptr;
+    m_bytes = 0;
+    m_ready = 0;
+    m_inFlight = 0;
+    m_writing = false;
+}
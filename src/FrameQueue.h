@@ -0,0 +1,60 @@
+/*
+ * FrameQueue.h
+ *
+ * Bytes waiting to be written to an fd, held in a chain of FramePool
+ * buffers. Small payloads are packed into the last buffer, and a write
+ * gathers several buffers into one writev(). Bytes handed to a write stay
+ * put until endWrite(); later appends only go after them.
+ *
+ * Bytes can also be appended held back, for a message whose end has not
+ * arrived yet: they are not written until commit(), so the whole message
+ * goes out in one write.
+ */
+#pragma once
+
+#include "FramePool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+
+class FrameQueue
+{
+public:
+    FrameQueue() = default;
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    /// Copy len bytes in, taking buffers from pool as needed. Returns how many
+    /// fitted, which is less than len only if the pool ran dry. Unless hold
+    /// is set, everything queued so far may be written.
+    size_t append(FramePool& pool, const uint8_t* data, size_t len, bool hold = false);
+
+    /// Let the bytes held back be written.
+    void commit() { m_ready = m_bytes; }
+    size_t held() const { return m_bytes - m_ready; }
+
+    size_t size() const { return m_bytes; }
+    bool empty() const { return m_bytes == 0; }
+    bool writing() const { return m_writing; }
+
+    /// Describe up to maxIov buffers for one write. Returns the iovec count,
+    /// 0 if a write is already in flight or nothing is queued.
+    int beginWrite(iovec* iov, int maxIov);
+
+    /// The in-flight write completed (or failed); drop its bytes and return
+    /// the emptied buffers to pool.
+    void endWrite(FramePool& pool);
+
+    /// Return every buffer to pool.
+    void clear(FramePool& pool);
+
+private:
+    FrameBuffer* m_head = nullptr;
+    FrameBuffer* m_tail = nullptr;
+    size_t m_bytes = 0;
+    size_t m_ready = 0;          // from m_head, may be written
+    int m_inFlight = 0;          // buffers in the write, from m_head
+    uint16_t m_lastInFlight = 0; // bytes of the last one in the write
+    bool m_writing = false;
+};
@@ -0,0 +1,63 @@
+/*
+ * FrameSizer.cpp
+ */
+#include "FrameSizer.h"
+
+#include <algorithm>
+
+FrameSizer::FrameSizer(uint64_t byteTimeNs)
+    : m_baudRate(byteTimeNs ? 1000000000 / byteTimeNs : 0)
+{
+}
+
+void FrameSizer::sample(uint64_t nowNs, uint64_t written, size_t queued)
+{
+    // Only a line that was busy all along shows its rate: what left the
+    // queue is then what it carried. A queue that ran dry meanwhile makes the
+    // rate look low, which errs towards smaller frames.
+    if (queued == 0) {
+        m_sampleNs = 0;
+        return;
+    }
+    if (m_sampleNs == 0) {
+        m_sampleNs = nowNs;
+        m_sampleWritten = written;
+        m_sampleQueued = queued;
+        return;
+    }
+    uint64_t elapsed = nowNs - m_sampleNs;
+    if (elapsed < cMinSampleNs) {
+        return;
+    }
+    uint64_t left = written - m_sampleWritten + m_sampleQueued;
+    if (left < queued) {
+        // Not a byte count after all (a socket's queue counts its overhead).
+        m_sampleNs = 0;
+        return;
+    }
+    uint64_t drained = left - queued;
+    uint64_t rate = drained * 1000000000 / elapsed;
+    m_rate = m_rate ? (3 * m_rate + rate) / 4 : rate;
+    m_sampleNs = nowNs;
+    m_sampleWritten = written;
+    m_sampleQueued = queued;
+}
+
+size_t FrameSizer::frameSize(uint64_t nowNs) const
+{
+    uint64_t rate = bytesPerSec();
+    if (m_urgentNs == 0 || nowNs - m_urgentNs >= cUrgentQuietNs || rate == 0) {
+        return cMaxDataSize;
+    }
+    return std::clamp(size_t(rate * cTargetDelayNs / 1000000000), cMinFrameData, cMaxDataSize);
+}
+
+void FrameSizer::picked(size_t size)
+{
+    if (size < cMaxDataSize) {
+        m_stats.smallFrames++;
+        m_stats.smallest = std::min(m_stats.smallest, size);
+    } else {
+        m_stats.fullFrames++;
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * FrameSizer.h
+ *
+ * Picks the payload size of frames from channels below the top priority.
+ * Such a frame may already be on the line when a top-priority frame turns
+ * up, which then waits for it to finish. Full-size frames keep the header
+ * overhead low but make that wait long on a slow line, so while
+ * top-priority channels are active lower-priority frames are cut to what the
+ * line carries in cTargetDelayNs. The line rate is measured from how fast
+ * the kernel's output queue drains, starting from the baud rate if one is
+ * known. Once top-priority traffic has been quiet for cUrgentQuietNs, frames
+ * go back to full size.
+ *
+ * FrameSizer does no I/O and reads no clock; the Multiplexer passes in the
+ * queue depth and the time.
+ */
+#pragma once
+
+#include "Frame.h"
+
+#include <cstddef>
+#include <cstdint>
+
+class FrameSizer
+{
+public:
+    static constexpr size_t cMinFrameData = 64;
+    static constexpr uint64_t cTargetDelayNs = 10000000;
+    static constexpr uint64_t cUrgentQuietNs = 1000000000;
+    // Shortest span a rate sample is taken over.
+    static constexpr uint64_t cMinSampleNs = 20000000;
+
+    struct Stats
+    {
+        uint64_t fullFrames = 0;  // lower-priority frames sent at full size
+        uint64_t smallFrames = 0; // ...and cut short
+        size_t smallest = cMaxDataSize; // smallest size picked
+    };
+
+    /// byteTimeNs is the configured line speed, 0 if unknown.
+    explicit FrameSizer(uint64_t byteTimeNs = 0);
+
+    /// The kernel has been handed written bytes in total so far and still
+    /// holds queued of them at nowNs.
+    void sample(uint64_t nowNs, uint64_t written, size_t queued);
+
+    /// Measured line rate, or the configured one; 0 if neither is known.
+    uint64_t bytesPerSec() const { return m_rate ? m_rate : m_baudRate; }
+    uint64_t byteTimeNs() const { return bytesPerSec() ? 1000000000 / bytesPerSec() : 0; }
+
+    /// A top-priority channel sent at nowNs.
+    void urgent(uint64_t nowNs) { m_urgentNs = nowNs; }
+
+    /// Payload size for a lower-priority frame sent at nowNs.
+    size_t frameSize(uint64_t nowNs) const;
+
+    /// A lower-priority frame went out with a payload of up to size.
+    void picked(size_t size);
+
+    const Stats& stats() const { return m_stats; }
+
+private:
+    uint64_t m_baudRate;
+    uint64_t m_rate = 0; // measured, bytes per second
+    uint64_t m_sampleNs = 0; // start of the sample being taken, 0 if none
+    uint64_t m_sampleWritten = 0;
+    size_t m_sampleQueued = 0;
+    uint64_t m_urgentNs = 0;
+    Stats m_stats;
+};
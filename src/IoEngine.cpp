@@ -0,0 +1,74 @@
+/*
+ * IoEngine.cpp
+ */
+#include "IoEngine.h"
+
+#include "Log.h"
+#include "ReactorEngine.h"
+#include "UringEngine.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+
+std::unique_ptr<IoEngine> IoEngine::create(Kind preferred)
+{
+    if (preferred == Kind::Uring) {
+        try {
+            return std::make_unique<UringEngine>();
+        } catch (const std::exception& e) {
+            logInfo("io_uring unavailable (%s), falling back to epoll", e.what());
+            preferred = Kind::Epoll;
+        }
+    }
+    return std::make_unique<ReactorEngine>(preferred == Kind::Poll ? EventLoop::Backend::Poll
+                                                                   : EventLoop::Backend::Epoll);
+}
+
+const char* IoEngine::kindName(Kind kind)
+{
+    switch (kind) {
+    case Kind::Uring: return "uring";
+    case Kind::Epoll: return "epoll";
+    case Kind::Poll: return "poll";
+    }
+    return "?";
+}
+
+bool IoEngine::parseKind(const std::string& name, Kind& kind)
+{
+    for (Kind k : {Kind::Uring, Kind::Epoll, Kind::Poll}) {
+        if (name == kindName(k)) {
+            kind = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+int IoEngine::runFlushHooks(int timeoutMs)
+{
+    m_wakeBy = UINT64_MAX;
+    for (size_t i = 0; i < m_flushHooks.size(); ++i) {
+        m_flushHooks[i].second();
+    }
+    if (m_wakeBy == UINT64_MAX) {
+        return timeoutMs;
+    }
+    uint64_t now = monotonicNs();
+    // Round up: waking just before the deadline would only spin.
+    uint64_t waitMs = m_wakeBy > now ? (m_wakeBy - now + 999999) / 1000000 : 0;
+    if (timeoutMs >= 0 && uint64_t(timeoutMs) < waitMs) {
+        return timeoutMs;
+    }
+    return int(std::min<uint64_t>(waitMs, INT32_MAX));
+}
+
+void IoEngine::run()
+{
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        runOnce(-1);
+    }
+    m_stop.store(false, std::memory_order_relaxed);
+}
@@ -0,0 +1,125 @@
+/*
+ * IoEngine.h
+ *
+ * Completion-style I/O interface used by the multiplexer, so the same
+ * forwarding code can run on a readiness reactor (epoll/poll) or on
+ * io_uring. All handlers run on the thread that calls run()/runOnce().
+ *
+ * One loop iteration is:
+ *   1. flush hooks run (the place to batch output into write() calls),
+ *   2. pending submissions go to the kernel and the engine waits, until
+ *      the earliest wakeBy() deadline at most,
+ *   3. read/write completion handlers run.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+class IoEngine
+{
+public:
+    enum class Kind
+    {
+        Uring,
+        Epoll,
+        Poll,
+    };
+
+    /// n > 0: bytes received; n == 0: end of file; n < 0: -errno.
+    /// After n <= 0 the fd is no longer read.
+    using ReadHandler = std::function<void(const uint8_t* data, ssize_t n)>;
+    /// n >= 0: all requested bytes were written; n < 0: -errno.
+    using WriteHandler = std::function<void(ssize_t n)>;
+
+    /// Create the preferred engine, falling back uring -> epoll -> poll when
+    /// the kernel (or a seccomp policy) does not support it.
+    static std::unique_ptr<IoEngine> create(Kind preferred);
+    static const char* kindName(Kind kind);
+    /// Parse "uring", "epoll" or "poll". Returns false if unknown.
+    static bool parseKind(const std::string& name, Kind& kind);
+
+    virtual ~IoEngine() = default;
+
+    virtual Kind kind() const = 0;
+
+    /// Start reading fd (which must be non-blocking) into an engine-owned
+    /// buffer of bufferSize bytes.
+    virtual void watchRead(int fd, size_t bufferSize, ReadHandler onData) = 0;
+
+    /// Stop or resume reading fd. A read the kernel has already started may
+    /// still complete after pausing.
+    virtual void pauseRead(int fd, bool paused) = 0;
+
+    /// Write all of iov[0..count) to fd. Only one write per fd may be
+    /// outstanding, and the memory the iovecs point at must stay untouched
+    /// until onDone runs. onDone never runs from inside write().
+    virtual void write(int fd, const iovec* iov, int count, WriteHandler onDone) = 0;
+
+    /// Preallocate what writes of up to maxIov iovecs to fd need, so that
+    /// write() does not allocate.
+    virtual void reserveWrite(int fd, int maxIov) = 0;
+
+    /// Forget fd. No handler runs for it afterwards; the caller may close it.
+    virtual void unwatch(int fd) = 0;
+
+    /// Run hook once per loop iteration before waiting for I/O. Returns an
+    /// id for removeFlushHook().
+    int addFlushHook(std::function<void()> hook)
+    {
+        m_flushHooks.push_back({++m_lastHookId, std::move(hook)});
+        return m_lastHookId;
+    }
+
+    void removeFlushHook(int id)
+    {
+        for (auto it = m_flushHooks.begin(); it != m_flushHooks.end(); ++it) {
+            if (it->first == id) {
+                m_flushHooks.erase(it);
+                return;
+            }
+        }
+    }
+
+    /// Make the wait that follows the current flush hooks end by deadlineNs
+    /// (CLOCK_MONOTONIC) at the latest. Forgotten after that wait, so a hook
+    /// that needs a timer calls this on every iteration.
+    void wakeBy(uint64_t deadlineNs)
+    {
+        if (deadlineNs < m_wakeBy) {
+            m_wakeBy = deadlineNs;
+        }
+    }
+
+    /// Dispatch until stop() is called.
+    void run();
+    /// Do one loop iteration, waiting at most timeoutMs (-1 = forever).
+    /// Returns the number of completions dispatched.
+    virtual int runOnce(int timeoutMs) = 0;
+
+    /// Ask run() to return. Safe to call from other threads and signal handlers.
+    virtual void stop() = 0;
+
+    /// I/O and wait syscalls issued so far (for benchmarks).
+    uint64_t syscalls() const { return m_syscalls; }
+
+protected:
+    /// Run the flush hooks and return how long to wait: timeoutMs, or less
+    /// if a hook asked for an earlier wakeBy().
+    int runFlushHooks(int timeoutMs);
+
+    std::atomic<bool> m_stop{false};
+    uint64_t m_syscalls = 0;
+
+private:
+    std::vector<std::pair<int, std::function<void()>>> m_flushHooks;
+    int m_lastHookId = 0;
+    uint64_t m_wakeBy = UINT64_MAX;
+};
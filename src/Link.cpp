@@ -0,0 +1,500 @@
+/*
+ * Link.cpp
+ */
+#include "Link.h"
+
+#include "Crc.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+// Room for one COBS batch: the Multiplexer's per-write payload budget plus
+// per-frame overhead, with a full-size frame to spare.
+constexpr size_t cCobsTxSize = 24 * 1024;
+constexpr size_t cMaxCobsFrame = cobsMaxEncodedSize(cMaxHeaderSize + cMaxDataSize + cMaxTrailerSize) + 1;
+
+// NumBytes of a data frame; more of a message cannot follow an empty frame.
+bool dataSizeValid(uint16_t numBytes)
+{
+    return (numBytes & ~cMoreFlag) <= cMaxDataSize && numBytes != cMoreFlag;
+}
+
+} // namespace
+
+Link::Link(int fd, const LinkConfig& config)
+    : m_fd(fd)
+    , m_config(config)
+    , m_headerSize(cHeaderSize + (config.reliable ? cArqHeaderSize : 0))
+    , m_trailerSize(trailerSize(config.checksum))
+{
+    if (m_config.reliable && m_config.checksum == Checksum::None) {
+        ::close(m_fd);
+        throw std::invalid_argument("reliable mode needs a checksum");
+    }
+    setNonBlocking(m_fd);
+    if (m_config.framing == Framing::Cobs) {
+        m_cobsTx.reset(new uint8_t[cCobsTxSize]);
+        m_cobsScratch.reset(new uint8_t[cMaxHeaderSize + cMaxDataSize + cMaxTrailerSize]);
+        m_cobsRx = std::make_unique<CobsDecoder>(m_headerSize + cMaxDataSize + m_trailerSize);
+        // Lead with a delimiter so the peer drops whatever noise preceded us.
+        m_cobsTx[0] = 0;
+        m_cobsTxLen = 1;
+    }
+    if (m_config.reliable) {
+        m_arq = std::make_shared<Arq>(m_config.window);
+        m_deliver = [this](uint8_t channel, const uint8_t* data, size_t len, bool more) {
+            if (m_onFrame) {
+                m_onFrame(channel, data, len, true, more);
+            }
+        };
+    }
+}
+
+Link::~Link()
+{
+    ::close(m_fd);
+}
+
+void Link::makeTrailer(const uint8_t* header, const uint8_t* payload, size_t len, uint8_t* out) const
+{
+    switch (m_config.checksum) {
+    case Checksum::None:
+        break;
+    case Checksum::Crc16: {
+        uint16_t crc = crc16(payload, len, crc16(header, m_headerSize));
+        out[0] = uint8_t(crc >> 8);
+        out[1] = uint8_t(crc);
+        break;
+    }
+    case Checksum::Crc32: {
+        uint32_t crc = crc32c(payload, len, crc32c(header, m_headerSize));
+        out[0] = uint8_t(crc >> 24);
+        out[1] = uint8_t(crc >> 16);
+        out[2] = uint8_t(crc >> 8);
+        out[3] = uint8_t(crc);
+        break;
+    }
+    }
+}
+
+size_t Link::outputQueued() const
+{
+    int queued = 0;
+    if (::ioctl(m_fd, TIOCOUTQ, &queued) < 0 || queued < 0) {
+        return 0;
+    }
+    return size_t(queued);
+}
+
+bool Link::batchRoom() const
+{
+    return m_frames < cMaxBatchFrames && !(m_cobsTx && m_cobsTxLen + cMaxCobsFrame > cCobsTxSize) && writeRoom();
+}
+
+bool Link::writeRoom() const
+{
+    // Each write is one datagram; the first frame always goes.
+    size_t bytes = m_cobsTx ? m_cobsTxLen : m_batchBytes;
+    return m_config.maxWrite == 0 || m_frames == 0 || bytes + cMaxCobsFrame <= m_config.maxWrite;
+}
+
+bool Link::batchFull() const
+{
+    return !batchRoom() || (m_arq && m_arq->windowFull());
+}
+
+bool Link::addFrame(uint8_t channel, const uint8_t* data, size_t len, bool more)
+{
+    if (m_writing || m_frames == cMaxBatchFrames || !writeRoom()) {
+        return false;
+    }
+    if (m_arq) {
+        if (m_arq->windowFull() || !batchRoom()) {
+            return false;
+        }
+        uint8_t seq = m_arq->queue(channel, data, len, more);
+        addArqFrame(cArqData, seq, channel, m_arq->data(seq), len, more ? cMoreFlag : 0);
+        return true;
+    }
+    uint8_t header[cHeaderSize];
+    encodeHeader(header, channel, uint16_t(len | (more ? cMoreFlag : 0)));
+    return appendFrame(header, data, len);
+}
+
+bool Link::addControl(uint8_t channel, ControlKind kind, uint32_t value)
+{
+    if (m_writing || !batchRoom()) {
+        return false;
+    }
+    uint8_t* payload = &m_controls[m_frames * cControlSize];
+    encodeControl(payload, kind, value);
+    if (m_arq) {
+        addArqFrame(cArqControl, 0, channel, payload, cControlSize, cControlFlag);
+        return true;
+    }
+    uint8_t header[cHeaderSize];
+    encodeHeader(header, channel, uint16_t(cControlFlag | cControlSize));
+    return appendFrame(header, payload, cControlSize);
+}
+
+void Link::addResends()
+{
+    if (!m_arq || m_writing) {
+        return;
+    }
+    size_t room = cMaxBatchFrames - m_frames;
+    if (m_cobsTx) {
+        room = std::min(room, (cCobsTxSize - m_cobsTxLen) / cMaxCobsFrame);
+    }
+    if (m_config.maxWrite > 0) {
+        size_t bytes = m_cobsTx ? m_cobsTxLen : m_batchBytes;
+        room = std::min(room, bytes < m_config.maxWrite ? (m_config.maxWrite - bytes) / cMaxCobsFrame : 0);
+        room = std::max<size_t>(room, m_frames == 0);
+    }
+    uint8_t seqs[Arq::cMaxWindow];
+    size_t count = m_arq->takeResends(monotonicNs(), seqs, std::min(room, Arq::cMaxWindow));
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t seq = seqs[i];
+        addArqFrame(cArqData, seq, m_arq->channel(seq), m_arq->data(seq), m_arq->size(seq),
+                    m_arq->more(seq) ? cMoreFlag : 0);
+    }
+}
+
+void Link::addArqFrame(uint8_t type, uint8_t seq, uint8_t channel, const uint8_t* data, size_t len, uint16_t flags)
+{
+    uint8_t header[cMaxHeaderSize] = {type, seq, m_arq->ackNumber()};
+    encodeHeader(header + cArqHeaderSize, channel, uint16_t(len | flags));
+    if (appendFrame(header, data, len) && type == cArqData) {
+        m_batchSeqs[m_batchDataFrames++] = seq;
+    }
+}
+
+size_t Link::encodeWireHeader(const uint8_t* header, uint8_t* out) const
+{
+    if (m_config.header == HeaderFormat::Standard) {
+        std::memcpy(out, header, m_headerSize);
+        return m_headerSize;
+    }
+    size_t prefix = m_headerSize - cHeaderSize;
+    std::memcpy(out, header, prefix);
+    return prefix + encodeCompactHeader(out + prefix, header + prefix);
+}
+
+size_t Link::wireHeaderSize(const uint8_t* wire, size_t have) const
+{
+    size_t prefix = m_headerSize - cHeaderSize;
+    if (m_config.header == HeaderFormat::Standard) {
+        return m_headerSize;
+    }
+    return have <= prefix ? prefix + 1 : prefix + compactHeaderSize(wire[prefix]);
+}
+
+bool Link::decodeWireHeader(const uint8_t* wire, uint8_t* header) const
+{
+    if (m_config.header == HeaderFormat::Standard) {
+        std::memcpy(header, wire, m_headerSize);
+    } else {
+        size_t prefix = m_headerSize - cHeaderSize;
+        std::memcpy(header, wire, prefix);
+        if (!decodeCompactHeader(wire + prefix, header + prefix)) {
+            return false;
+        }
+    }
+    return headerValid(header);
+}
+
+bool Link::appendFrame(const uint8_t* header, const uint8_t* data, size_t len)
+{
+    if (m_config.framing == Framing::Cobs) {
+        size_t frameSize = m_headerSize + len + m_trailerSize;
+        if (m_cobsTxLen + cobsMaxEncodedSize(frameSize) + 1 > cCobsTxSize) {
+            return false;
+        }
+        uint8_t* frame = m_cobsScratch.get();
+        size_t headerSize = encodeWireHeader(header, frame);
+        std::copy(data, data + len, frame + headerSize);
+        makeTrailer(header, data, len, frame + headerSize + len);
+        frameSize = headerSize + len + m_trailerSize;
+        size_t n = cobsEncode(frame, frameSize, m_cobsTx.get() + m_cobsTxLen);
+        m_cobsTx[m_cobsTxLen + n] = 0;
+        m_cobsTxLen += n + 1;
+        m_frames++;
+        m_batchBytes += n + 1;
+        m_stats.framesOut++;
+        m_stats.bytesOut += n + 1;
+        return true;
+    }
+    uint8_t* stored = &m_headers[m_frames * cMaxHeaderSize];
+    size_t headerSize = encodeWireHeader(header, stored);
+    m_iov[m_iovCount++] = {stored, headerSize};
+    if (len > 0) {
+        m_iov[m_iovCount++] = {const_cast<uint8_t*>(data), len};
+    }
+    if (m_trailerSize > 0) {
+        uint8_t* trailer = &m_trailers[m_frames * cMaxTrailerSize];
+        makeTrailer(header, data, len, trailer);
+        m_iov[m_iovCount++] = {trailer, m_trailerSize};
+    }
+    size_t wireBytes = headerSize + len + m_trailerSize;
+    m_frames++;
+    m_batchBytes += wireBytes;
+    m_stats.framesOut++;
+    m_stats.bytesOut += wireBytes;
+    return true;
+}
+
+bool Link::beginWrite(const iovec*& iov, int& count)
+{
+    if (m_writing) {
+        return false;
+    }
+    if (m_arq && m_arq->ackPending()) {
+        // Data frames carry the cumulative ack; the bitmap needs an ack frame.
+        if ((m_batchDataFrames == 0 || m_arq->haveGap()) && batchRoom()) {
+            size_t len = m_arq->encodeSack(m_sack.data());
+            addArqFrame(cArqAck, 0, 0, m_sack.data(), len);
+        } else if (m_batchDataFrames > 0) {
+            m_arq->ackSent();
+        }
+    }
+    if (m_frames == 0) {
+        return false;
+    }
+    m_writing = true;
+    m_stats.batches++;
+    if (m_config.framing == Framing::Cobs) {
+        m_iov[0] = {m_cobsTx.get(), m_cobsTxLen};
+        m_iovCount = 1;
+    }
+    iov = m_iov.data();
+    count = int(m_iovCount);
+    return true;
+}
+
+void Link::endWrite()
+{
+    if (m_arq && m_batchDataFrames > 0) {
+        uint64_t now = monotonicNs();
+        for (size_t i = 0; i < m_batchDataFrames; ++i) {
+            m_arq->sent(m_batchSeqs[i], now, m_path);
+        }
+    }
+    m_writing = false;
+    m_frames = 0;
+    m_iovCount = 0;
+    m_batchBytes = 0;
+    m_batchDataFrames = 0;
+    m_cobsTxLen = 0;
+}
+
+void Link::shareArq(Link& first, uint8_t path)
+{
+    if (!m_arq || !first.m_arq) {
+        throw std::invalid_argument("bonded links need reliable mode");
+    }
+    if (path == 0 || path >= Arq::cMaxPaths) {
+        throw std::invalid_argument("at most " + std::to_string(Arq::cMaxPaths) + " bonded links");
+    }
+    m_arq = first.m_arq;
+    m_path = path;
+}
+
+bool Link::headerValid(const uint8_t* header) const
+{
+    if (!m_arq) {
+        uint16_t numBytes = decodeNumBytes(header);
+        return dataSizeValid(numBytes) || numBytes == (cControlFlag | cControlSize);
+    }
+    uint16_t numBytes = decodeNumBytes(header + cArqHeaderSize);
+    return (header[0] == cArqData && dataSizeValid(numBytes)) ||
+           (header[0] == cArqAck && numBytes <= Arq::cMaxSackSize) ||
+           (header[0] == cArqControl && numBytes == (cControlFlag | cControlSize));
+}
+
+void Link::receive(const uint8_t* data, size_t len)
+{
+    m_stats.bytesIn += len;
+    if (m_config.framing == Framing::Cobs) {
+        receiveCobs(data, len);
+    } else {
+        receiveLength(data, len);
+    }
+}
+
+void Link::receiveLength(const uint8_t* data, size_t len)
+{
+    const uint8_t* end = data + len;
+    while (data < end) {
+        switch (m_rxState) {
+        case RxState::Header: {
+            m_rxWire[m_rxHeaderLen++] = *data++;
+            if (m_rxHeaderLen < wireHeaderSize(m_rxWire, m_rxHeaderLen)) {
+                break;
+            }
+            if (!decodeWireHeader(m_rxWire, m_rxHeader)) {
+                // Out of sync: slide forward one byte and try again, which
+                // makes the rest of this header the start of the next. That
+                // may be a whole shorter header and more, so it goes through
+                // the decoder again.
+                m_stats.badHeaders++;
+                uint8_t rest[cMaxHeaderSize];
+                size_t n = m_rxHeaderLen - 1;
+                std::memcpy(rest, m_rxWire + 1, n);
+                m_rxHeaderLen = 0;
+                receiveLength(rest, n);
+                break;
+            }
+            m_rxRemaining = payloadSize(m_rxHeader + m_headerSize - cHeaderSize);
+            m_rxControl = isControl(m_rxHeader + m_headerSize - cHeaderSize);
+            headerDone();
+            break;
+        }
+        case RxState::Payload: {
+            size_t avail = size_t(end - data);
+            if (m_trailerSize == 0 && !m_rxControl) {
+                size_t n = std::min(avail, m_rxRemaining);
+                m_rxRemaining -= n;
+                if (m_rxRemaining == 0) {
+                    m_rxState = RxState::Header;
+                    m_stats.framesIn++;
+                }
+                if (m_onFrame) {
+                    m_onFrame(m_rxHeader[0], data, n, m_rxRemaining == 0, hasMore(m_rxHeader));
+                }
+                data += n;
+            } else if (m_rxBuffered == 0 && avail >= m_rxRemaining + m_trailerSize) {
+                // The whole frame is in this read: check it where it lies.
+                checkedFrameDone(data, data + m_rxRemaining);
+                data += m_rxRemaining + m_trailerSize;
+            } else {
+                size_t n = std::min(avail, m_rxRemaining);
+                std::memcpy(m_rxPayload.data() + m_rxBuffered, data, n);
+                m_rxBuffered += n;
+                m_rxRemaining -= n;
+                data += n;
+                if (m_rxRemaining == 0 && m_trailerSize == 0) {
+                    // A control frame, which is only handed over whole.
+                    checkedFrameDone(m_rxPayload.data(), m_rxTrailer);
+                } else if (m_rxRemaining == 0) {
+                    m_rxState = RxState::Trailer;
+                }
+            }
+            break;
+        }
+        case RxState::Trailer: {
+            size_t n = std::min(size_t(end - data), m_trailerSize - m_rxTrailerLen);
+            std::memcpy(m_rxTrailer + m_rxTrailerLen, data, n);
+            m_rxTrailerLen += n;
+            data += n;
+            if (m_rxTrailerLen == m_trailerSize) {
+                checkedFrameDone(m_rxPayload.data(), m_rxTrailer);
+            }
+            break;
+        }
+        }
+    }
+}
+
+void Link::headerDone()
+{
+    m_rxHeaderLen = 0;
+    m_rxBuffered = 0;
+    m_rxTrailerLen = 0;
+    if (m_rxRemaining > 0) {
+        m_rxState = RxState::Payload;
+        return;
+    }
+    if (m_trailerSize > 0) {
+        m_rxState = RxState::Trailer;
+        return;
+    }
+    m_rxState = RxState::Header;
+    frameDone(m_rxHeader, nullptr, 0);
+}
+
+void Link::checkedFrameDone(const uint8_t* payload, const uint8_t* trailer)
+{
+    m_rxState = RxState::Header;
+    size_t len = payloadSize(m_rxHeader + m_headerSize - cHeaderSize);
+    uint8_t expected[cMaxTrailerSize];
+    makeTrailer(m_rxHeader, payload, len, expected);
+    if (std::memcmp(expected, trailer, m_trailerSize) != 0) {
+        m_stats.crcErrors++;
+        return;
+    }
+    frameDone(m_rxHeader, payload, len);
+}
+
+void Link::frameDone(const uint8_t* header, const uint8_t* payload, size_t len)
+{
+    m_stats.framesIn++;
+    const uint8_t* frame = header + m_headerSize - cHeaderSize;
+    if (m_arq) {
+        uint64_t now = monotonicNs();
+        if (header[0] == cArqAck) {
+            m_arq->onAck(header[2], payload, len, now);
+            return;
+        }
+        m_arq->onAck(header[2], nullptr, 0, now);
+        if (header[0] == cArqData) {
+            m_arq->onData(header[1], frame[0], payload, len, hasMore(frame), m_deliver);
+            return;
+        }
+    }
+    if (isControl(frame)) {
+        if (m_onControl) {
+            m_onControl(frame[0], payload);
+        }
+        return;
+    }
+    if (m_onFrame) {
+        m_onFrame(frame[0], payload, len, true, hasMore(frame));
+    }
+}
+
+void Link::receiveCobs(const uint8_t* data, size_t len)
+{
+    while (len > 0) {
+        bool frameEnd;
+        size_t used = m_cobsRx->decode(data, len, frameEnd);
+        data += used;
+        len -= used;
+        if (frameEnd) {
+            cobsFrameDone();
+        }
+    }
+}
+
+void Link::cobsFrameDone()
+{
+    const uint8_t* frame = m_cobsRx->frame();
+    size_t size = m_cobsRx->size();
+    if (m_cobsRx->valid() && size == 0) {
+        // Back-to-back delimiters.
+        return;
+    }
+    size_t headerSize = m_cobsRx->valid() && size > 0 ? wireHeaderSize(frame, size) : 0;
+    uint8_t header[cMaxHeaderSize];
+    if (!m_cobsRx->valid() || size < headerSize + m_trailerSize || !decodeWireHeader(frame, header)
+        || payloadSize(header + m_headerSize - cHeaderSize) != size - headerSize - m_trailerSize) {
+        m_stats.badFrames++;
+        return;
+    }
+    size_t len = size - headerSize - m_trailerSize;
+    if (m_trailerSize > 0) {
+        uint8_t expected[cMaxTrailerSize];
+        makeTrailer(header, frame + headerSize, len, expected);
+        if (std::memcmp(expected, frame + headerSize + len, m_trailerSize) != 0) {
+            m_stats.crcErrors++;
+            return;
+        }
+    }
+    frameDone(header, frame + headerSize, len);
+}
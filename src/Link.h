@@ -0,0 +1,216 @@
+/*
+ * Link.h
+ *
+ * The physical side of the multiplexer: encodes channel frames onto a byte
+ * stream fd (normally the serial port) and decodes frames coming back. The
+ * I/O itself is done by the Multiplexer through its IoEngine.
+ *
+ * Outgoing frames are not copied: the Link only encodes their headers and
+ * gathers headers and payloads into an iovec batch that goes out in one
+ * writev() (or io_uring WRITEV) per loop iteration. Incoming bytes go
+ * through a state machine that resumes wherever the previous read ended and
+ * hands payload to the handler straight out of the engine's read buffer.
+ * With a checksum, payload is only handed over once its trailer has been
+ * checked, so a frame whose trailer arrives in a later read is buffered.
+ *
+ * In reliable mode the Link runs an Arq under the channel frames: new
+ * frames are copied into its window, resends and acknowledgements join the
+ * batches, and received frames are handed over in sequence order. Bonded
+ * links share one Arq (see shareArq()).
+ *
+ * Control frames (see Frame.h) travel in the same batches and are handed to
+ * a handler of their own, whole and after any checksum has been checked.
+ */
+#pragma once
+
+#include "Arq.h"
+#include "Cobs.h"
+#include "Frame.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <sys/uio.h>
+
+/// Wire format options; both ends of the link must use the same.
+struct LinkConfig
+{
+    Framing framing = Framing::Length;
+    Checksum checksum = Checksum::None;
+    bool reliable = false; // needs a checksum
+    size_t window = Arq::cDefaultWindow;
+    unsigned baud = 0; // line rate for pacing estimates; 0 if unknown
+    HeaderFormat header = HeaderFormat::Standard;
+    size_t maxWrite = 0; // most bytes per write, for datagram transports; 0 if any
+};
+
+class Link
+{
+public:
+    /// Receives payload as it arrives: a frame split across reads comes in
+    /// several pieces, the last with frameEnd set. An empty frame is one
+    /// call with len 0. more is the frame's cMoreFlag: its message goes on
+    /// in a later frame.
+    using FrameHandler = std::function<void(uint8_t channel, const uint8_t* data, size_t len, bool frameEnd, bool more)>;
+    /// Receives a control frame's payload, cControlSize bytes.
+    using ControlHandler = std::function<void(uint8_t channel, const uint8_t* payload)>;
+
+    struct Stats
+    {
+        uint64_t framesOut = 0;
+        uint64_t bytesOut = 0; // wire bytes, headers included
+        uint64_t batches = 0;  // writes the outgoing frames were gathered into
+        uint64_t framesIn = 0;
+        uint64_t bytesIn = 0;
+        uint64_t badHeaders = 0; // Framing::Length: impossible lengths skipped
+        uint64_t badFrames = 0;  // Framing::Cobs: frames dropped as malformed
+        uint64_t crcErrors = 0;  // frames dropped for a checksum mismatch
+    };
+
+    /// Take ownership of fd, which is switched to non-blocking mode. Throws
+    /// std::invalid_argument for reliable mode without a checksum.
+    explicit Link(int fd, const LinkConfig& config = LinkConfig());
+    ~Link();
+
+    Link(const Link&) = delete;
+    Link& operator=(const Link&) = delete;
+
+    int fd() const { return m_fd; }
+    const LinkConfig& config() const { return m_config; }
+
+    void setFrameHandler(FrameHandler handler) { m_onFrame = std::move(handler); }
+    void setControlHandler(ControlHandler handler) { m_onControl = std::move(handler); }
+
+    /// Most frames gathered into one write.
+    static constexpr size_t cMaxBatchFrames = 256;
+    /// Header, payload and trailer: well under IOV_MAX for a full batch.
+    static constexpr size_t cMaxBatchIov = 3 * cMaxBatchFrames;
+
+    /// Add a frame to the next batch; len must not exceed cMaxDataSize. With
+    /// Framing::Length only the header is copied, so data has to stay valid
+    /// until the batch has been written. more sets cMoreFlag. Returns false
+    /// if the batch is full or in flight.
+    bool addFrame(uint8_t channel, const uint8_t* data, size_t len, bool more = false);
+
+    /// Add a control frame about channel to the next batch. Returns false
+    /// if the batch is full or in flight.
+    bool addControl(uint8_t channel, ControlKind kind, uint32_t value);
+
+    /// True once addFrame() might fail for lack of room in the batch or, in
+    /// reliable mode, in the window.
+    bool batchFull() const;
+    size_t batchFrames() const { return m_frames; }
+    size_t batchBytes() const { return m_batchBytes; }
+    bool writing() const { return m_writing; }
+
+    /// Reliable mode: put frames that are due for resending into the batch.
+    /// Call before adding new frames.
+    void addResends();
+
+    /// Hand the batch out for writing. In reliable mode an acknowledgement
+    /// is added if one is due. Returns false if a batch is already in
+    /// flight or there is nothing to write.
+    bool beginWrite(const iovec*& iov, int& count);
+
+    /// The batch was written (or the write failed); start a new one.
+    void endWrite();
+
+    /// Reliable mode: when addResends() next has work (CLOCK_MONOTONIC ns),
+    /// or UINT64_MAX.
+    uint64_t nextTimeout() const { return m_arq ? m_arq->nextTimeout() : UINT64_MAX; }
+
+    /// Bytes written to fd() that the kernel has not sent yet (TIOCOUTQ),
+    /// or 0 if the fd cannot tell.
+    size_t outputQueued() const;
+
+    /// Time one byte takes on the line, or 0 if the baud rate is unknown.
+    uint64_t byteTimeNs() const { return m_config.baud ? 10 * 1000000000ull / m_config.baud : 0; }
+
+    /// The reliable mode state, or nullptr.
+    const Arq* arq() const { return m_arq.get(); }
+
+    /// Bond this link to first: both use first's Arq from now on, so the
+    /// frames sent on either are numbered in one sequence and the peer puts
+    /// them back in order whichever way they came. path (1 to
+    /// Arq::cMaxPaths - 1) tells this link's frames apart for loss
+    /// detection. Both links must be reliable; throws std::invalid_argument
+    /// otherwise. Call before any I/O.
+    void shareArq(Link& first, uint8_t path);
+
+    /// Decode bytes read from fd(), of any length, and pass payload to the
+    /// handler. Nothing is kept pointing into data after the call.
+    void receive(const uint8_t* data, size_t len);
+
+    const Stats& stats() const { return m_stats; }
+
+private:
+    enum class RxState : uint8_t
+    {
+        Header,
+        Payload,
+        Trailer,
+    };
+
+    bool batchRoom() const;
+    bool writeRoom() const;
+    bool appendFrame(const uint8_t* header, const uint8_t* data, size_t len);
+    size_t encodeWireHeader(const uint8_t* header, uint8_t* out) const;
+    size_t wireHeaderSize(const uint8_t* wire, size_t have) const;
+    bool decodeWireHeader(const uint8_t* wire, uint8_t* header) const;
+    void receiveLength(const uint8_t* data, size_t len);
+    void addArqFrame(uint8_t type, uint8_t seq, uint8_t channel, const uint8_t* data, size_t len, uint16_t flags = 0);
+    bool headerValid(const uint8_t* header) const;
+    void headerDone();
+    void checkedFrameDone(const uint8_t* payload, const uint8_t* trailer);
+    void frameDone(const uint8_t* header, const uint8_t* payload, size_t len);
+    void receiveCobs(const uint8_t* data, size_t len);
+    void cobsFrameDone();
+
+    /// Encode the trailer for header + payload into out.
+    void makeTrailer(const uint8_t* header, const uint8_t* payload, size_t len, uint8_t* out) const;
+
+    int m_fd;
+    LinkConfig m_config;
+    size_t m_headerSize; // ARQ and channel header as decoded, which the checksum covers
+    size_t m_trailerSize;
+
+    std::array<uint8_t, cMaxBatchFrames * cMaxHeaderSize> m_headers{};
+    std::array<uint8_t, cMaxBatchFrames * cMaxTrailerSize> m_trailers{};
+    std::array<uint8_t, cMaxBatchFrames * cControlSize> m_controls{};
+    std::array<iovec, cMaxBatchIov> m_iov{};
+    size_t m_frames = 0;
+    size_t m_iovCount = 0;
+    size_t m_batchBytes = 0;
+    bool m_writing = false;
+
+    // Framing::Cobs: frames are encoded into one buffer instead.
+    std::unique_ptr<uint8_t[]> m_cobsTx;
+    size_t m_cobsTxLen = 0;
+    std::unique_ptr<uint8_t[]> m_cobsScratch; // frame before encoding
+    std::unique_ptr<CobsDecoder> m_cobsRx;
+
+    // Reliable mode.
+    std::shared_ptr<Arq> m_arq;
+    uint8_t m_path = 0;
+    Arq::Deliver m_deliver;
+    std::array<uint8_t, cMaxBatchFrames> m_batchSeqs{}; // data frames in the batch
+    size_t m_batchDataFrames = 0;
+    std::array<uint8_t, Arq::cMaxSackSize> m_sack{};
+
+    RxState m_rxState = RxState::Header;
+    uint8_t m_rxWire[cMaxHeaderSize] = {}; // header as received
+    size_t m_rxHeaderLen = 0;
+    uint8_t m_rxHeader[cMaxHeaderSize] = {}; // ...and decoded
+    size_t m_rxRemaining = 0; // payload bytes still to come
+    bool m_rxControl = false;
+    // With a checksum: payload and trailer of a frame split across reads.
+    std::array<uint8_t, cMaxDataSize> m_rxPayload{};
+    size_t m_rxBuffered = 0;
+    uint8_t m_rxTrailer[cMaxTrailerSize] = {};
+    size_t m_rxTrailerLen = 0;
+
+    FrameHandler m_onFrame;
+    ControlHandler m_onControl;
+    Stats m_stats;
+};
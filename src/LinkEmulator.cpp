@@ -0,0 +1,322 @@
+/*
+ * LinkEmulator.cpp
+ */
+#include "LinkEmulator.h"
+
+#include "Util.h"
+
+#include <algorithm>
+#include <poll.h>
+#include <random>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+// Bytes are handed over in pieces of about this much line time, so a slow
+// line delivers a long write bit by bit rather than all at its end.
+constexpr uint64_t cPieceNs = 1000000;
+constexpr size_t cReadSize = 16 * 1024;
+
+/// Draws the gaps between errors: geometric, so a low rate costs nothing
+/// per byte.
+class ErrorGaps
+{
+public:
+    ErrorGaps(double rate, std::mt19937_64& rng)
+        : m_never(rate <= 0)
+        , m_always(rate >= 1)
+        , m_gaps(m_never || m_always ? 0.5 : rate)
+        , m_rng(rng)
+    {
+    }
+
+    uint64_t next()
+    {
+        if (m_never) {
+            return UINT64_MAX;
+        }
+        return m_always ? 0 : m_gaps(m_rng);
+    }
+
+private:
+    bool m_never;
+    bool m_always;
+    std::geometric_distribution<uint64_t> m_gaps;
+    std::mt19937_64& m_rng;
+};
+
+} // namespace
+
+/// One way across the line. Held bytes are kept in order in a ring, cut
+/// into pieces that each become due at their own time.
+struct LinkEmulator::Direction
+{
+    Direction(int from, int to, Stats& stats, uint8_t* bytes, Piece* pieces)
+        : from(from)
+        , to(to)
+        , stats(stats)
+        , bytes(bytes)
+        , pieces(pieces)
+    {
+    }
+
+    bool empty() const { return pieceCount == 0; }
+    Piece& front() { return pieces[pieceHead]; }
+
+    void push(const uint8_t* data, size_t len, uint64_t dueNs)
+    {
+        size_t at = (byteHead + heldBytes) % cMaxHeld;
+        size_t first = std::min(len, cMaxHeld - at);
+        std::copy(data, data + first, bytes + at);
+        std::copy(data + first, data + len, bytes);
+        heldBytes += len;
+        pieces[(pieceHead + pieceCount) % cMaxPieces] = {dueNs, len};
+        pieceCount++;
+    }
+
+    /// Write what is left of the front piece; returns what write() did.
+    ssize_t writeFront()
+    {
+        size_t len = front().len - offset;
+        size_t first = std::min(len, cMaxHeld - byteHead);
+        iovec iov[2] = {{bytes + byteHead, first}, {bytes, len - first}};
+        ssize_t n = ::writev(to, iov, len > first ? 2 : 1);
+        if (n > 0) {
+            byteHead = (byteHead + size_t(n)) % cMaxHeld;
+            heldBytes -= size_t(n);
+            offset += size_t(n);
+            if (offset == front().len) {
+                offset = 0;
+                pieceHead = (pieceHead + 1) % cMaxPieces;
+                pieceCount--;
+            }
+        }
+        return n;
+    }
+
+    void clear()
+    {
+        byteHead = heldBytes = 0;
+        pieceHead = pieceCount = 0;
+        offset = 0;
+    }
+
+    int from;
+    int to;
+    Stats& stats;
+    uint8_t* bytes;
+    Piece* pieces;
+    size_t byteHead = 0;
+    size_t heldBytes = 0;
+    size_t pieceHead = 0;
+    size_t pieceCount = 0;
+    size_t offset = 0;       // of the front piece already written
+    uint64_t lineFreeNs = 0; // when the last byte read is off the line
+    uint64_t lastDueNs = 0;
+    uint64_t bytesToDrop = 0; // bytes that get through before the next drop
+    uint64_t bitsToFlip = 0;  // bits that get through before the next flip
+    bool blocked = false;     // to is full
+    bool eof = false;         // from is done
+    bool shutDown = false;
+    bool broken = false;      // to has gone; bytes go nowhere
+};
+
+LinkEmulator::LinkEmulator(int a, int b, const Config& config)
+    : m_fds{a, b}
+    , m_stopFd(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    , m_config(config)
+    , m_held{std::make_unique<uint8_t[]>(cMaxHeld), std::make_unique<uint8_t[]>(cMaxHeld)}
+    , m_pieces{std::make_unique<Piece[]>(cMaxPieces), std::make_unique<Piece[]>(cMaxPieces)}
+    , m_readBuf(std::make_unique<uint8_t[]>(cReadSize))
+{
+    if (m_stopFd < 0) {
+        ::close(a);
+        ::close(b);
+        throwErrno("eventfd");
+    }
+    setNonBlocking(a);
+    setNonBlocking(b);
+    m_thread = std::thread([this] { run(); });
+}
+
+LinkEmulator::~LinkEmulator()
+{
+    stop();
+    ::close(m_fds[0]);
+    ::close(m_fds[1]);
+    ::close(m_stopFd);
+}
+
+void LinkEmulator::makeSocketPair(int fds[2])
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        throwErrno("socketpair");
+    }
+    // The kernel doubles this and has a floor of its own; close enough.
+    int size = int(cTxBuffer);
+    ::setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+void LinkEmulator::stop()
+{
+    if (m_thread.joinable()) {
+        uint64_t one = 1;
+        (void)!::write(m_stopFd, &one, sizeof(one));
+        m_thread.join();
+    }
+}
+
+void LinkEmulator::run()
+{
+    std::mt19937_64 rng(m_config.seed);
+    ErrorGaps drops(m_config.dropRate, rng);
+    ErrorGaps flips(m_config.bitErrorRate, rng);
+    std::uniform_int_distribution<uint64_t> jitter(0, m_config.jitterNs);
+    const uint64_t byteNs = m_config.baud ? 10 * 1000000000ull / m_config.baud : 0;
+    const size_t pieceBytes = byteNs ? std::max<size_t>(1, cPieceNs / byteNs) : cReadSize;
+
+    Direction dirs[2] = {{m_fds[0], m_fds[1], m_stats[0], m_held[0].get(), m_pieces[0].get()},
+                         {m_fds[1], m_fds[0], m_stats[1], m_held[1].get(), m_pieces[1].get()}};
+    for (Direction& dir : dirs) {
+        dir.bytesToDrop = drops.next();
+        dir.bitsToFlip = flips.next();
+    }
+    uint8_t* buf = m_readBuf.get();
+
+    // How much may be read from dir now: what fits in the sender's buffer
+    // behind the bytes still on the line, and in what is held.
+    auto readable = [&](const Direction& dir, uint64_t now) -> size_t {
+        if (dir.eof || dir.heldBytes >= cMaxHeld || dir.pieceCount == cMaxPieces) {
+            return 0;
+        }
+        size_t room = std::min({cReadSize, cMaxHeld - dir.heldBytes, (cMaxPieces - dir.pieceCount) * pieceBytes});
+        if (byteNs && dir.lineFreeNs > now) {
+            size_t backlog = size_t((dir.lineFreeNs - now) / byteNs);
+            room = backlog >= cTxBuffer ? 0 : std::min(room, cTxBuffer - backlog);
+        }
+        return room;
+    };
+
+    for (;;) {
+        uint64_t now = monotonicNs();
+        uint64_t wake = UINT64_MAX;
+        pollfd pfds[5] = {{m_stopFd, POLLIN, 0}};
+        for (int d = 0; d < 2; ++d) {
+            Direction& dir = dirs[d];
+            while (!dir.blocked && !dir.empty() && dir.front().dueNs <= now) {
+                size_t left = dir.front().len - dir.offset;
+                ssize_t n = dir.writeFront();
+                if (n < 0 && wouldBlock(errno)) {
+                    dir.blocked = true;
+                    break;
+                }
+                if (n < 0) {
+                    dir.broken = true;
+                    dir.clear();
+                    break;
+                }
+                dir.stats.bytesOut += size_t(n);
+                if (size_t(n) < left) {
+                    dir.blocked = true;
+                    break;
+                }
+            }
+            if (dir.eof && dir.empty() && !dir.shutDown) {
+                ::shutdown(dir.to, SHUT_WR);
+                dir.shutDown = true;
+            }
+            if (!dir.blocked && !dir.empty()) {
+                wake = std::min(wake, dir.front().dueNs);
+            }
+            pfds[1 + 2 * d] = {dir.from, 0, 0};
+            pfds[2 + 2 * d] = {dir.blocked ? dir.to : -1, POLLOUT, 0};
+            if (readable(dir, now) > 0) {
+                pfds[1 + 2 * d].events = POLLIN;
+            } else if (!dir.eof && byteNs && dir.lineFreeNs > now + cTxBuffer * byteNs) {
+                wake = std::min(wake, dir.lineFreeNs - cTxBuffer * byteNs);
+            }
+            if (pfds[1 + 2 * d].events == 0) {
+                pfds[1 + 2 * d].fd = -1;
+            }
+        }
+
+        timespec timeout{};
+        if (wake != UINT64_MAX) {
+            uint64_t wait = wake > now ? wake - now : 0;
+            timeout.tv_sec = time_t(wait / 1000000000);
+            timeout.tv_nsec = long(wait % 1000000000);
+        }
+        if (::ppoll(pfds, 5, wake == UINT64_MAX ? nullptr : &timeout, nullptr) < 0 && errno != EINTR) {
+            return;
+        }
+        if (pfds[0].revents) {
+            return;
+        }
+
+        now = monotonicNs();
+        for (int d = 0; d < 2; ++d) {
+            Direction& dir = dirs[d];
+            if (pfds[2 + 2 * d].revents) {
+                dir.blocked = false;
+            }
+            if (!pfds[1 + 2 * d].revents) {
+                continue;
+            }
+            ssize_t n = ::read(dir.from, buf, readable(dir, now));
+            if (n < 0 && wouldBlock(errno)) {
+                continue;
+            }
+            if (n <= 0) {
+                dir.eof = true;
+                continue;
+            }
+            dir.stats.bytesIn += size_t(n);
+            if (dir.broken) {
+                continue;
+            }
+
+            // Each piece takes its line time whether its bytes arrive or
+            // not, and goes after whatever is still going out.
+            for (size_t pos = 0; pos < size_t(n); pos += pieceBytes) {
+                uint8_t* piece = buf + pos;
+                size_t size = std::min(pieceBytes, size_t(n) - pos);
+                uint64_t start = std::max(now, dir.lineFreeNs);
+                dir.lineFreeNs = start + size * byteNs;
+
+                // Lose and corrupt bytes in place.
+                size_t len = 0;
+                for (size_t i = 0; i < size; ++i) {
+                    if (dir.bytesToDrop == 0) {
+                        dir.stats.bytesDropped++;
+                        dir.bytesToDrop = drops.next();
+                        continue;
+                    }
+                    if (dir.bytesToDrop != UINT64_MAX) {
+                        dir.bytesToDrop--;
+                    }
+                    piece[len++] = piece[i];
+                }
+                uint64_t bits = uint64_t(len) * 8;
+                uint64_t bit = dir.bitsToFlip;
+                while (bit < bits) {
+                    piece[bit / 8] ^= uint8_t(1u << (bit % 8));
+                    dir.stats.bitsFlipped++;
+                    uint64_t gap = flips.next();
+                    bit = gap >= UINT64_MAX - bit ? UINT64_MAX : bit + 1 + gap;
+                }
+                dir.bitsToFlip = bit == UINT64_MAX ? bit : bit - bits;
+                if (len == 0) {
+                    continue;
+                }
+
+                uint64_t due = dir.lineFreeNs + m_config.delayNs + (m_config.jitterNs ? jitter(rng) : 0);
+                due = std::max(due, dir.lastDueNs);
+                dir.lastDueNs = due;
+                dir.push(piece, len, due);
+            }
+        }
+    }
+}
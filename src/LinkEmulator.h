@@ -0,0 +1,100 @@
+/*
+ * LinkEmulator.h
+ *
+ * A serial line in software, for testing without hardware. The emulator
+ * relays bytes between two fds in a thread of its own and treats each
+ * direction as the wire of a UART pair: bytes go out at the emulated baud
+ * rate (8N1, ten bits each) behind a transmit buffer of cTxBuffer bytes,
+ * arrive after a fixed delay plus random jitter, and may be lost or have
+ * bits flipped on the way. Jitter never reorders bytes; a later byte is
+ * held until the earlier ones are through, as on a real line.
+ *
+ * Two Links in one process talk through an emulator placed between the far
+ * ends of two socketpairs; serial-mux -E puts one between its Link and the
+ * transport, so two instances can be run over tcp:// or unix: with the
+ * impairments of a slow, noisy line. Errors come from a seeded generator,
+ * so a run can be repeated. Everything the relay needs is allocated by the
+ * constructor, so it does not show up in heapAllocations() while running.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+class LinkEmulator
+{
+public:
+    struct Config
+    {
+        unsigned baud = 0;        // line rate; 0 passes bytes on as fast as they come
+        uint64_t delayNs = 0;     // one-way propagation delay
+        uint64_t jitterNs = 0;    // up to this much more, picked at random per piece
+        double dropRate = 0;      // probability that a byte is lost
+        double bitErrorRate = 0;  // probability that a bit is flipped
+        uint64_t seed = 1;
+    };
+
+    /// Per direction.
+    struct Stats
+    {
+        uint64_t bytesIn = 0;      // read from the sending side
+        uint64_t bytesOut = 0;     // delivered to the other
+        uint64_t bytesDropped = 0;
+        uint64_t bitsFlipped = 0;
+    };
+
+    /// Bytes the line's sender may have waiting before the emulator stops
+    /// reading it, like a UART driver's buffer. Only with a baud rate.
+    static constexpr size_t cTxBuffer = 4096;
+    /// Most bytes held per direction for delay and jitter...
+    static constexpr size_t cMaxHeld = 1024 * 1024;
+    /// ...and most pieces they may be in (see LinkEmulator.cpp).
+    static constexpr size_t cMaxPieces = 64 * 1024;
+
+    /// Relay between fds a and b, which are switched to non-blocking mode
+    /// and owned from now on. Each fd's end-of-file reaches the other side,
+    /// once what was sent before it has arrived, as a shutdown(SHUT_WR).
+    LinkEmulator(int a, int b, const Config& config);
+    ~LinkEmulator();
+
+    LinkEmulator(const LinkEmulator&) = delete;
+    LinkEmulator& operator=(const LinkEmulator&) = delete;
+
+    /// A socketpair for a Link to reach an emulator through: the Link gets
+    /// fds[0], whose send buffer is kept to about cTxBuffer so writes block
+    /// as soon as they would on a tty, and fds[1] goes to the emulator.
+    /// Throws std::system_error.
+    static void makeSocketPair(int fds[2]);
+
+    /// Stop relaying; bytes still on the line are lost. Called by the
+    /// destructor.
+    void stop();
+
+    /// What went from a to b (toB) or from b to a. Only valid after stop().
+    const Stats& stats(bool toB) const { return m_stats[toB ? 0 : 1]; }
+
+    const Config& config() const { return m_config; }
+
+private:
+    struct Piece
+    {
+        uint64_t dueNs;
+        size_t len;
+    };
+    struct Direction;
+
+    void run();
+
+    int m_fds[2];
+    int m_stopFd;
+    Config m_config;
+    Stats m_stats[2];
+    // Per direction: held bytes, a ring of cMaxHeld, and when they are due,
+    // a ring of cMaxPieces.
+    std::unique_ptr<uint8_t[]> m_held[2];
+    std::unique_ptr<Piece[]> m_pieces[2];
+    std::unique_ptr<uint8_t[]> m_readBuf;
+    std::thread m_thread;
+};
@@ -0,0 +1,47 @@
+/*
+ * Log.cpp
+ */
+#include "Log.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+
+LogLevel gLevel = LogLevel::Warning;
+
+void vlog(LogLevel level, const char* tag, const char* fmt, va_list args)
+{
+    if (level > gLevel) {
+        return;
+    }
+    std::fprintf(stderr, "serial-mux: %s", tag);
+    std::vfprintf(stderr, fmt, args);
+    std::fputc('\n', stderr);
+}
+
+} // namespace
+
+void setLogLevel(LogLevel level)
+{
+    gLevel = level;
+}
+
+LogLevel logLevel()
+{
+    return gLevel;
+}
+
+#define DEFINE_LOG_FUNCTION(name, level, tag) \
+    void name(const char* fmt, ...)           \
+    {                                         \
+        va_list args;                         \
+        va_start(args, fmt);                  \
+        vlog(level, tag, fmt, args);          \
+        va_end(args);                         \
+    }
+
+DEFINE_LOG_FUNCTION(logError, LogLevel::Error, "error: ")
+DEFINE_LOG_FUNCTION(logWarning, LogLevel::Warning, "warning: ")
+DEFINE_LOG_FUNCTION(logInfo, LogLevel::Info, "")
+DEFINE_LOG_FUNCTION(logDebug, LogLevel::Debug, "debug: ")
@@ -0,0 +1,22 @@
+/*
+ * Log.h
+ *
+ * Minimal printf-style logging to stderr with a global verbosity level.
+ */
+#pragma once
+
+enum class LogLevel
+{
+    Error,
+    Warning,
+    Info,
+    Debug,
+};
+
+void setLogLevel(LogLevel level);
+LogLevel logLevel();
+
+void logError(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void logWarning(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void logInfo(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void logDebug(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -0,0 +1,301 @@
+/*
+ * Lz.cpp
+ */
+#include "Lz.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// History plus the input being worked on; slides back to cLzWindow when full.
+constexpr size_t cHistorySize = 2 * cLzWindow + cLzMaxInput;
+constexpr size_t cMaxOffset = 0xffff;
+
+constexpr unsigned cHashBits = 14;
+
+// Training: a dictionary is made of cTrainSegment byte pieces of the sample,
+// scored by how often the cTrainK byte strings in them recur.
+constexpr size_t cTrainK = 8;
+constexpr size_t cTrainSegment = 128;
+constexpr unsigned cTrainHashBits = 20;
+
+uint32_t hash4(const uint8_t* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - cHashBits);
+}
+
+uint32_t hashK(const uint8_t* p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return uint32_t((v * 0x9e3779b97f4a7c15ull) >> (64 - cTrainHashBits));
+}
+
+/// Bytes needed after the token for a length whose nibble saturates at 15.
+size_t extraLengthBytes(size_t n)
+{
+    return n < 15 ? 0 : (n - 15) / 255 + 1;
+}
+
+uint8_t* putExtraLength(uint8_t* out, size_t n)
+{
+    if (n < 15) {
+        return out;
+    }
+    n -= 15;
+    for (; n >= 255; n -= 255) {
+        *out++ = 255;
+    }
+    *out++ = uint8_t(n);
+    return out;
+}
+
+uint8_t* putLiterals(uint8_t* out, const uint8_t* literals, size_t count, size_t matchNibble)
+{
+    *out++ = uint8_t(std::min<size_t>(count, 15) << 4 | matchNibble);
+    out = putExtraLength(out, count);
+    std::memcpy(out, literals, count);
+    return out + count;
+}
+
+/// Add a saturated nibble's extra length bytes to n; false if they run out.
+bool getExtraLength(const uint8_t*& in, const uint8_t* end, size_t& n)
+{
+    if (n < 15) {
+        return true;
+    }
+    uint8_t byte;
+    do {
+        if (in == end) {
+            return false;
+        }
+        byte = *in++;
+        n += byte;
+    } while (byte == 255);
+    return true;
+}
+
+} // namespace
+
+LzEncoder::LzEncoder()
+    : m_history(new uint8_t[cHistorySize])
+    , m_table(new uint32_t[size_t(1) << cHashBits]())
+{
+}
+
+void LzEncoder::makeRoom(size_t len)
+{
+    if (m_size + len <= cHistorySize) {
+        return;
+    }
+    size_t shift = m_size - cLzWindow;
+    std::memmove(m_history.get(), m_history.get() + shift, cLzWindow);
+    m_size = cLzWindow;
+    for (size_t i = 0; i < (size_t(1) << cHashBits); ++i) {
+        m_table[i] = m_table[i] > shift ? uint32_t(m_table[i] - shift) : 0;
+    }
+}
+
+void LzEncoder::prime(const uint8_t* dictionary, size_t len)
+{
+    if (len > cLzWindow) {
+        dictionary += len - cLzWindow;
+        len = cLzWindow;
+    }
+    std::memcpy(m_history.get(), dictionary, len);
+    m_size = len;
+    std::fill(m_table.get(), m_table.get() + (size_t(1) << cHashBits), 0);
+    for (size_t p = 0; p + cLzMinMatch <= len; ++p) {
+        m_table[hash4(m_history.get() + p)] = uint32_t(p + 1);
+    }
+}
+
+size_t LzEncoder::compress(const uint8_t* in, size_t len, uint8_t* out, size_t cap, size_t& outLen)
+{
+    len = std::min(len, cLzMaxInput);
+    makeRoom(len);
+    uint8_t* base = m_history.get();
+    size_t start = m_size;
+    size_t end = start + len;
+    std::memcpy(base + start, in, len);
+
+    uint8_t* o = out;
+    uint8_t* outEnd = out + cap;
+    size_t anchor = start; // first byte not yet emitted
+    size_t p = start;
+    while (p + cLzMinMatch <= end) {
+        uint32_t& slot = m_table[hash4(base + p)];
+        size_t candidate = slot;
+        slot = uint32_t(p + 1);
+        if (candidate == 0 || candidate - 1 >= p || p - (candidate - 1) > cMaxOffset ||
+            std::memcmp(base + candidate - 1, base + p, cLzMinMatch) != 0) {
+            p++;
+            continue;
+        }
+        size_t from = candidate - 1;
+        size_t match = cLzMinMatch;
+        while (p + match < end && base[from + match] == base[p + match]) {
+            match++;
+        }
+        size_t literals = p - anchor;
+        size_t extra = match - cLzMinMatch;
+        size_t need = 1 + extraLengthBytes(literals) + literals + 2 + extraLengthBytes(extra);
+        if (size_t(outEnd - o) < need) {
+            break;
+        }
+        o = putLiterals(o, base + anchor, literals, std::min<size_t>(extra, 15));
+        size_t offset = p - from;
+        *o++ = uint8_t(offset);
+        *o++ = uint8_t(offset >> 8);
+        o = putExtraLength(o, extra);
+        p += match;
+        anchor = p;
+        // Lets the next repeat of what the match ended with be found.
+        if (p - 2 + cLzMinMatch <= end) {
+            m_table[hash4(base + p - 2)] = uint32_t(p - 2 + 1);
+        }
+    }
+
+    // Whatever is left goes as literals, as far as they fit.
+    size_t literals = end - anchor;
+    size_t room = size_t(outEnd - o);
+    if (room > 0 && literals > 0) {
+        literals = std::min(literals, room - 1);
+        while (literals > 0 && 1 + extraLengthBytes(literals) + literals > room) {
+            literals--;
+        }
+        if (literals > 0) {
+            o = putLiterals(o, base + anchor, literals, 0);
+        }
+    } else {
+        literals = 0;
+    }
+    size_t used = anchor + literals - start;
+    m_size = start + used;
+    outLen = size_t(o - out);
+    return used;
+}
+
+LzDecoder::LzDecoder()
+    : m_history(new uint8_t[cHistorySize])
+{
+}
+
+void LzDecoder::prime(const uint8_t* dictionary, size_t len)
+{
+    if (len > cLzWindow) {
+        dictionary += len - cLzWindow;
+        len = cLzWindow;
+    }
+    std::memcpy(m_history.get(), dictionary, len);
+    m_size = len;
+}
+
+bool LzDecoder::decompress(const uint8_t* in, size_t len, const uint8_t*& out, size_t& outLen)
+{
+    if (m_size + cLzMaxInput > cHistorySize) {
+        std::memmove(m_history.get(), m_history.get() + m_size - cLzWindow, cLzWindow);
+        m_size = cLzWindow;
+    }
+    uint8_t* base = m_history.get();
+    size_t start = m_size;
+    size_t limit = start + cLzMaxInput;
+    size_t p = start;
+    const uint8_t* end = in + len;
+    while (in < end) {
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if (!getExtraLength(in, end, literals) || literals > size_t(end - in) || literals > limit - p) {
+            return false;
+        }
+        std::memcpy(base + p, in, literals);
+        in += literals;
+        p += literals;
+        if (in == end) {
+            break;
+        }
+        if (end - in < 2) {
+            return false;
+        }
+        size_t offset = size_t(in[0]) | size_t(in[1]) << 8;
+        in += 2;
+        size_t match = token & 0x0f;
+        if (!getExtraLength(in, end, match)) {
+            return false;
+        }
+        match += cLzMinMatch;
+        if (offset == 0 || offset > p || match > limit - p) {
+            return false;
+        }
+        // May overlap what it produces, so byte by byte.
+        const uint8_t* from = base + p - offset;
+        for (size_t i = 0; i < match; ++i) {
+            base[p + i] = from[i];
+        }
+        p += match;
+    }
+    m_size = p;
+    out = base + start;
+    outLen = p - start;
+    return true;
+}
+
+std::vector<uint8_t> trainLzDictionary(const uint8_t* sample, size_t len, size_t size)
+{
+    size = std::min(size, cLzWindow);
+    if (len <= size) {
+        return std::vector<uint8_t>(sample, sample + len);
+    }
+    if (size < cTrainSegment) {
+        return std::vector<uint8_t>(sample + len - size, sample + len);
+    }
+
+    std::vector<uint32_t> counts(size_t(1) << cTrainHashBits);
+    for (size_t i = 0; i + cTrainK <= len; ++i) {
+        counts[hashK(sample + i)]++;
+    }
+    // A string seen once gains nothing from being in the dictionary.
+    auto value = [&](size_t at) -> uint64_t {
+        uint32_t count = counts[hashK(sample + at)];
+        return count > 1 ? count : 0;
+    };
+
+    // The sample is cut into one stretch per piece, so the dictionary covers
+    // all of it rather than whatever its busiest part was about; each stretch
+    // gives its best scoring piece.
+    size_t pieces = size / cTrainSegment;
+    size_t stretch = len / pieces;
+    size_t starts = cTrainSegment - cTrainK + 1; // strings starting in a piece
+    std::vector<uint8_t> dictionary;
+    dictionary.reserve(size);
+    for (size_t piece = 0; piece < pieces; ++piece) {
+        size_t begin = piece * stretch;
+        size_t end = piece + 1 == pieces ? len : begin + stretch;
+        uint64_t score = 0;
+        for (size_t i = 0; i < starts; ++i) {
+            score += value(begin + i);
+        }
+        uint64_t best = score;
+        size_t bestAt = begin;
+        for (size_t at = begin + 1; at + cTrainSegment <= end; ++at) {
+            score += value(at + starts - 1);
+            score -= value(at - 1);
+            if (score > best) {
+                best = score;
+                bestAt = at;
+            }
+        }
+        if (best == 0) {
+            continue;
+        }
+        dictionary.insert(dictionary.end(), sample + bestAt, sample + bestAt + cTrainSegment);
+        // What is in the dictionary already scores nothing for later pieces.
+        for (size_t i = 0; i < starts; ++i) {
+            counts[hashK(sample + bestAt + i)] = 0;
+        }
+    }
+    return dictionary;
+}
@@ -0,0 +1,83 @@
+/*
+ * Lz.h
+ *
+ * Streaming LZ77 compression of one channel's data, a frame at a time.
+ * Matches may reach back into earlier frames of the same channel, up to
+ * cLzWindow bytes, so repetitive traffic such as log lines shrinks far more
+ * than it would frame by frame. In exchange both ends must see every frame,
+ * in order: the link has to be reliable.
+ *
+ * A frame's payload is a series of sequences in the style of LZ4:
+ *   Token      : 1 byte, literal count (high nibble) and match length less
+ *                cLzMinMatch (low nibble); 15 means more follows
+ *   [Length]   : bytes of 255 and a final one below 255 added to a nibble
+ *   Literals   : the literal bytes
+ *   Offset     : 2 bytes, little-endian, how far back the match starts
+ *   [Length]   : the rest of the match length
+ * The last sequence of a frame may end after its literals.
+ *
+ * Short messages on their own give the history little to work with, so both
+ * ends may start from the same dictionary instead of an empty history: a
+ * sample of typical traffic, made by trainLzDictionary().
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+constexpr size_t cLzWindow = 64 * 1024;
+constexpr size_t cLzMinMatch = 4;
+/// Most input one frame may stand for.
+constexpr size_t cLzMaxInput = 8 * 1024;
+
+class LzEncoder
+{
+public:
+    LzEncoder();
+
+    LzEncoder(const LzEncoder&) = delete;
+    LzEncoder& operator=(const LzEncoder&) = delete;
+
+    /// Compress as much of in[0..len) as fits into cap bytes of out, at most
+    /// cLzMaxInput. Returns how many input bytes went in; outLen is set to
+    /// the compressed size. Only the bytes that went in join the history.
+    size_t compress(const uint8_t* in, size_t len, uint8_t* out, size_t cap, size_t& outLen);
+
+    /// Start the history with the last cLzWindow bytes of a dictionary.
+    /// Call before the first frame, with the decoder's dictionary.
+    void prime(const uint8_t* dictionary, size_t len);
+
+private:
+    void makeRoom(size_t len);
+
+    std::unique_ptr<uint8_t[]> m_history;
+    size_t m_size = 0;
+    std::unique_ptr<uint32_t[]> m_table; // hash of 4 bytes -> position + 1
+};
+
+class LzDecoder
+{
+public:
+    LzDecoder();
+
+    LzDecoder(const LzDecoder&) = delete;
+    LzDecoder& operator=(const LzDecoder&) = delete;
+
+    /// Decompress one frame. Returns false if it is malformed, which leaves
+    /// the history as it was. On success the data stays at out for outLen
+    /// bytes until the next call.
+    bool decompress(const uint8_t* in, size_t len, const uint8_t*& out, size_t& outLen);
+
+    /// See LzEncoder::prime().
+    void prime(const uint8_t* dictionary, size_t len);
+
+private:
+    std::unique_ptr<uint8_t[]> m_history;
+    size_t m_size = 0;
+};
+
+/// Build a dictionary of at most size bytes (up to cLzWindow) from captured
+/// traffic: the stretches whose content recurs most often across the sample.
+std::vector<uint8_t> trainLzDictionary(const uint8_t* sample, size_t len, size_t size);
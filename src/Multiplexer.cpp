@@ -0,0 +1,930 @@
+/*
+ * Multiplexer.cpp
+ */
+#include "Multiplexer.h"
+
+#include "Frame.h"
+#include "Log.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Stop reading a virtual port once its input ring cannot take two more reads
+// (one may complete after pausing), resume when the ring is half empty...
+constexpr size_t cChannelInHeadroom = 2 * cMaxDataSize;
+
+// ...and stop reading the link while a virtual port has this much unwritten.
+constexpr size_t cChannelOutHighWater = 64 * 1024;
+constexpr size_t cChannelOutLowWater = 16 * 1024;
+
+constexpr size_t cLinkReadSize = 16 * 1024;
+
+// Frame buffers shared by the virtual ports' output on top of the reserve
+// needed to absorb link reads after pausing. A channel's output is held in
+// these, so cChannelOutHighWater should stay well below the total.
+constexpr size_t cPoolFrames = 256;
+
+// Most buffers one virtual port write gathers.
+constexpr int cChannelWriteIov = 64;
+
+// Most payload bytes gathered into one link write. Bounds how long a batch
+// holds the link before channels that became ready meanwhile get a turn.
+constexpr size_t cMaxBatchBytes = 16 * 1024;
+
+// Channels below the top priority only get a frame onto the link while the
+// kernel holds less than another frame for it, so a top-priority frame waits
+// behind at most about two; FrameSizer keeps those frames short while it
+// matters. How often to look again without a known line rate:
+constexpr uint64_t cOutputPollNs = 1000000;
+
+// Bonded links only get new frames while the kernel holds less than this for
+// them, so a slow link cannot sit on data a faster one could have sent.
+constexpr size_t cBondQueueBytes = 2 * cMaxFrameSize;
+
+// Control frames a channel has due, as bits of Multiplexer::m_controlWhat.
+constexpr uint8_t cSendCredit = 1;
+constexpr uint8_t cSendProbe = 2;
+
+// Ahead of a compressed channel's first frame: its dictionary's CRC-32C,
+// big-endian.
+constexpr size_t cDictionaryCheckSize = 4;
+
+// Payload of the empty frame that ends a message after its last data went.
+constexpr uint8_t cNoData[1] = {};
+
+} // namespace
+
+Multiplexer::Path::Path(std::unique_ptr<Link> l)
+    : link(std::move(l))
+    , sizer(link->byteTimeNs())
+{
+}
+
+Multiplexer::Multiplexer(IoEngine& io, std::unique_ptr<Link> link)
+    : m_io(io)
+{
+    // Paths are referred to by address from I/O callbacks.
+    m_paths.reserve(Arq::cMaxPaths);
+    m_paths.emplace_back(std::move(link));
+    setHandlers(0);
+}
+
+Multiplexer::~Multiplexer()
+{
+    stop();
+}
+
+void Multiplexer::addChannel(std::unique_ptr<Channel> channel)
+{
+    if (m_started) {
+        throw std::logic_error("Multiplexer::addChannel after start()");
+    }
+    if (m_byId[channel->id()]) {
+        throw std::invalid_argument("duplicate channel id " + std::to_string(channel->id()));
+    }
+    if (channel->encoder() && !link().arq()) {
+        // Both ends' histories have to stay the same, so no frame may be lost.
+        throw std::invalid_argument("channel " + std::to_string(channel->id()) + ": compression needs reliable mode");
+    }
+    m_byId[channel->id()] = channel.get();
+    m_channels.push_back(std::move(channel));
+}
+
+void Multiplexer::enableFlowControl(size_t window)
+{
+    if (m_started) {
+        throw std::logic_error("Multiplexer::enableFlowControl after start()");
+    }
+    m_flow = std::make_unique<FlowControl>(window);
+}
+
+void Multiplexer::addLink(std::unique_ptr<Link> link)
+{
+    if (m_started) {
+        throw std::logic_error("Multiplexer::addLink after start()");
+    }
+    link->shareArq(*m_paths[0].link, uint8_t(m_paths.size()));
+    m_paths.emplace_back(std::move(link));
+    setHandlers(m_paths.size() - 1);
+}
+
+void Multiplexer::setFailover(unsigned heartbeatMs)
+{
+    if (m_started) {
+        throw std::logic_error("Multiplexer::setFailover after start()");
+    }
+    if (heartbeatMs == 0 || heartbeatMs > cMaxHeartbeatMs) {
+        throw std::invalid_argument("heartbeat must be 1 to " + std::to_string(cMaxHeartbeatMs) + " ms");
+    }
+    m_heartbeatNs = uint64_t(heartbeatMs) * 1000000;
+}
+
+void Multiplexer::setHandlers(size_t index)
+{
+    Link& link = *m_paths[index].link;
+    link.setFrameHandler([this](uint8_t id, const uint8_t* data, size_t len, bool frameEnd, bool more) {
+        onPayload(id, data, len, frameEnd, more);
+    });
+    link.setControlHandler([this, index](uint8_t id, const uint8_t* payload) {
+        onControl(m_paths[index], id, payload);
+    });
+}
+
+void Multiplexer::start()
+{
+    // Everything the forwarding path needs is allocated here. One link read
+    // spreads at most cLinkReadSize bytes over every channel, each of which
+    // may start a new buffer, and one more read can complete after the link
+    // is paused.
+    if (!m_pool) {
+        m_poolReserve = 2 * (cLinkReadSize / cMaxFrameSize + 1 + m_channels.size());
+        m_pool = std::make_unique<FramePool>(cPoolFrames + m_poolReserve);
+        for (Path& path : m_paths) {
+            path.txBatch.reserve(m_channels.size());
+            m_io.reserveWrite(path.link->fd(), int(Link::cMaxBatchIov));
+        }
+        m_dirtyChannels.reserve(m_channels.size());
+        m_stalled.reserve(m_channels.size());
+        m_controlDue.reserve(m_channels.size());
+        m_openMessages.reserve(m_channels.size());
+        m_coalescing.reserve(m_channels.size());
+        for (auto& channel : m_channels) {
+            m_io.reserveWrite(channel->fd(), cChannelWriteIov);
+        }
+    }
+    // Under Drr priorities do not apply, so nothing is held back.
+    bool drr = m_txReady.policy() == TxPolicy::Drr;
+    m_topPriority = drr ? cPriorityLevels : cPriorityLevels - 1;
+    for (auto& channel : m_channels) {
+        if (!drr) {
+            m_topPriority = std::min(m_topPriority, channel->priority());
+        }
+        m_txReady.setWeight(channel->id(), channel->weight());
+    }
+    m_lowerChannels = std::any_of(m_channels.begin(), m_channels.end(),
+                                  [this](const auto& channel) { return channel->priority() > m_topPriority; });
+    if (m_flow) {
+        // Let the peer know it may start sending.
+        for (auto& channel : m_channels) {
+            queueControl(channel->id(), cSendCredit);
+        }
+    }
+    // Every link starts out as heard from.
+    uint64_t now = monotonicNs();
+    for (Path& path : m_paths) {
+        path.lastRxNs = now;
+        path.heartbeatAt = now;
+    }
+    m_started = true;
+    m_flushHook = m_io.addFlushHook([this] { flush(); });
+    for (auto& channel : m_channels) {
+        Channel* ch = channel.get();
+        m_io.watchRead(ch->fd(), cMaxDataSize, [this, ch](const uint8_t* data, ssize_t n) {
+            onChannelData(*ch, data, n);
+        });
+    }
+    for (Path& path : m_paths) {
+        if (path.up) {
+            watchLink(path);
+        }
+    }
+}
+
+void Multiplexer::watchLink(Path& path)
+{
+    Path* p = &path;
+    m_io.watchRead(path.link->fd(), cLinkReadSize, [this, p](const uint8_t* data, ssize_t n) {
+        onLinkData(*p, data, n);
+    });
+}
+
+void Multiplexer::stop()
+{
+    if (!m_started) {
+        return;
+    }
+    m_io.removeFlushHook(m_flushHook);
+    for (auto& channel : m_channels) {
+        m_io.unwatch(channel->fd());
+    }
+    for (Path& path : m_paths) {
+        if (path.up) {
+            m_io.unwatch(path.link->fd());
+        }
+    }
+    m_started = false;
+}
+
+void Multiplexer::flush()
+{
+    if (!m_openMessages.empty()) {
+        endIdleMessages();
+    }
+    if (!m_coalescing.empty()) {
+        releaseCoalesced();
+    }
+    flushLink();
+    for (Channel* channel : m_dirtyChannels) {
+        m_dirty[channel->id()] = false;
+        if (m_byId[channel->id()] == channel) {
+            flushChannel(*channel);
+        }
+    }
+    m_dirtyChannels.clear();
+}
+
+void Multiplexer::onChannelData(Channel& channel, const uint8_t* data, ssize_t n)
+{
+    if (n <= 0) {
+        if (n < 0) {
+            logWarning("channel %u: read failed: %s", unsigned(channel.id()), strerror(int(-n)));
+        }
+        closeChannel(channel);
+        return;
+    }
+    size_t queued = channel.queueInput(data, size_t(n));
+    if (queued < size_t(n)) {
+        logWarning("channel %u: input ring full, %zu bytes lost", unsigned(channel.id()), size_t(n) - queued);
+        m_stats.overrunBytes += size_t(n) - queued;
+    }
+    // A complete message need not wait for more input.
+    bool ended = false;
+    if (channel.maxMessage() > 0 && channel.delimiter() >= 0) {
+        ended = endDelimitedMessages(channel, data, queued);
+    } else if (channel.maxMessage() > 0) {
+        openMessage(channel);
+    }
+    if (channel.coalesceNs() > 0 && !ended) {
+        coalesce(channel, queued);
+    } else {
+        stopCoalescing(channel);
+        markTxReady(channel);
+    }
+    uint8_t id = channel.id();
+    if (!m_inputPaused[id] && channel.input().writable() < cChannelInHeadroom) {
+        m_inputPaused[id] = true;
+        m_io.pauseRead(channel.fd(), true);
+    }
+}
+
+void Multiplexer::onChannelWritten(Channel& channel, ssize_t n)
+{
+    channel.output().endWrite(*m_pool);
+    if (n < 0) {
+        logWarning("channel %u: write failed: %s", unsigned(channel.id()), strerror(int(-n)));
+        closeChannel(channel);
+        return;
+    }
+    uint8_t id = channel.id();
+    if (m_flow && m_flow->updateDue(id, channel.output().size())) {
+        queueControl(id, cSendCredit);
+    }
+    if (m_congested[id] && channel.output().size() <= cChannelOutLowWater) {
+        m_congested[id] = false;
+        m_congestedChannels--;
+    }
+    if (m_poolLow && m_pool->available() >= 2 * m_poolReserve) {
+        m_poolLow = false;
+    }
+    updateLinkReadPause();
+    if (!channel.output().empty()) {
+        markDirty(channel);
+    }
+}
+
+void Multiplexer::onLinkData(Path& path, const uint8_t* data, ssize_t n)
+{
+    if (n <= 0) {
+        linkFailed(path, "read", n);
+        return;
+    }
+    if (m_heartbeatNs) {
+        path.lastRxNs = monotonicNs();
+    }
+    path.link->receive(data, size_t(n));
+    if (!m_poolLow && m_pool->available() < m_poolReserve) {
+        m_poolLow = true;
+        updateLinkReadPause();
+        // Held messages would keep the pool from ever draining.
+        for (auto& channel : m_channels) {
+            if (channel->output().held() > 0 && m_byId[channel->id()]) {
+                channel->output().commit();
+                m_stats.splitMessages++;
+                markDirty(*channel);
+            }
+        }
+    }
+}
+
+void Multiplexer::onLinkWritten(Path& path, ssize_t n)
+{
+    batchWritten(path);
+    if (n < 0) {
+        linkFailed(path, "write", n);
+    }
+}
+
+void Multiplexer::batchWritten(Path& path)
+{
+    path.link->endWrite();
+    for (auto& [channel, bytes] : path.txBatch) {
+        channel->input().consume(bytes);
+        uint8_t id = channel->id();
+        m_txInFlight[id] -= bytes;
+        if (m_byId[id] != channel) {
+            continue;
+        }
+        if (m_inputPaused[id] && channel->input().writable() >= channel->input().capacity() / 2) {
+            m_inputPaused[id] = false;
+            m_io.pauseRead(channel->fd(), false);
+        }
+        if (channel->txPending()) {
+            markTxReady(*channel);
+        }
+    }
+    path.txBatch.clear();
+}
+
+void Multiplexer::onPayload(uint8_t id, const uint8_t* data, size_t len, bool frameEnd, bool more)
+{
+    Channel* channel = m_byId[id];
+    if (!channel) {
+        m_stats.droppedFrames += frameEnd;
+        m_stats.droppedBytes += len;
+        return;
+    }
+    if (LzDecoder* decoder = channel->decoder()) {
+        if (m_dictionaryMismatch[id]) {
+            m_stats.decompressErrors++;
+            return;
+        }
+        // Empty frames only end messages, and carry no dictionary check.
+        if (!m_dictionaryChecked[id] && len > 0) {
+            m_dictionaryChecked[id] = true;
+            uint32_t crc = 0;
+            if (len >= cDictionaryCheckSize) {
+                crc = uint32_t(data[0]) << 24 | uint32_t(data[1]) << 16 | uint32_t(data[2]) << 8 | data[3];
+            }
+            if (len < cDictionaryCheckSize || crc != channel->dictionaryCrc()) {
+                logWarning("channel %u: the peer compresses with another dictionary (CRC %08x, ours %08x); "
+                           "its data is dropped",
+                           unsigned(id), unsigned(crc), unsigned(channel->dictionaryCrc()));
+                m_dictionaryMismatch[id] = true;
+                m_stats.decompressErrors++;
+                return;
+            }
+            data += cDictionaryCheckSize;
+            len -= cDictionaryCheckSize;
+        }
+        // Reliable mode hands frames over whole.
+        if (!decoder->decompress(data, len, data, len)) {
+            logWarning("channel %u: bad compressed frame dropped", unsigned(id));
+            m_stats.decompressErrors++;
+            return;
+        }
+    }
+    if (m_flow) {
+        m_flow->received(id, len);
+    }
+    // In message mode a message is written to the virtual port once its
+    // last frame is in, unless it outgrows what may be held for it.
+    bool hold = channel->maxMessage() > 0 && (!frameEnd || more);
+    size_t queued = channel->queueOutput(*m_pool, data, len, hold);
+    if (queued < len) {
+        logWarning("channel %u: frame pool empty, %zu bytes lost", unsigned(id), len - queued);
+        m_stats.poolDroppedBytes += len - queued;
+    }
+    if (hold && holdingTooMuch(*channel)) {
+        channel->output().commit();
+        m_stats.splitMessages++;
+    }
+    markDirty(*channel);
+    if (!m_congested[id] && channel->output().size() >= cChannelOutHighWater) {
+        m_congested[id] = true;
+        m_congestedChannels++;
+        updateLinkReadPause();
+    }
+}
+
+void Multiplexer::onControl(Path& path, uint8_t id, const uint8_t* payload)
+{
+    uint32_t value = decodeControlValue(payload);
+    if (payload[0] == cControlHeartbeat) {
+        path.peerHears = value != 0;
+        return;
+    }
+    Channel* channel = m_byId[id];
+    if (!channel || !m_flow) {
+        return;
+    }
+    switch (payload[0]) {
+    case cControlCredit:
+        m_flow->setLimit(id, value);
+        if (m_flow->stalled(id) && m_flow->credit(id) > 0) {
+            unstall(id);
+            markTxReady(*channel);
+        }
+        break;
+    case cControlProbe:
+        // Without retransmission, what has not arrived by now was lost.
+        if (!link().arq()) {
+            m_flow->resync(id, value);
+        }
+        queueControl(id, cSendCredit);
+        break;
+    default:
+        break;
+    }
+}
+
+void Multiplexer::closeChannel(Channel& channel)
+{
+    uint8_t id = channel.id();
+    logWarning("channel %u: virtual port closed", unsigned(id));
+    m_io.unwatch(channel.fd());
+    m_byId[id] = nullptr;
+    m_inputPaused[id] = false;
+    if (m_flow && m_flow->stalled(id)) {
+        unstall(id);
+    }
+    auto open = std::find(m_openMessages.begin(), m_openMessages.end(), &channel);
+    if (open != m_openMessages.end()) {
+        m_openMessages.erase(open);
+    }
+    stopCoalescing(channel);
+    // Nobody will read what is still queued; an unfinished write to the
+    // closed port can only fail.
+    channel.output().clear(*m_pool);
+    if (m_congested[id]) {
+        m_congested[id] = false;
+        m_congestedChannels--;
+    }
+    updateLinkReadPause();
+}
+
+void Multiplexer::linkFailed(Path& path, const char* what, ssize_t err)
+{
+    if (!path.up) {
+        return;
+    }
+    path.up = false;
+    std::string name = m_paths.size() > 1 ? "link " + std::to_string(&path - m_paths.data()) : "physical link";
+    if (err == 0) {
+        logError("%s closed", name.c_str());
+    } else {
+        logError("%s %s failed: %s", name.c_str(), what, strerror(int(-err)));
+    }
+    if (std::any_of(m_paths.begin(), m_paths.end(), [](const Path& p) { return p.up; })) {
+        // The others carry on. A write in flight never completes once the
+        // link is unwatched, so its input is let go here; the Arq resends
+        // whatever the peer does not acknowledge.
+        if (path.link->writing()) {
+            batchWritten(path);
+        }
+        m_io.unwatch(path.link->fd());
+        if (&path == &m_paths[m_active]) {
+            uint64_t now = monotonicNs();
+            auto next = std::find_if(m_paths.begin(), m_paths.end(), [&](const Path& p) { return works(p, now); });
+            if (next == m_paths.end()) {
+                next = std::find_if(m_paths.begin(), m_paths.end(), [](const Path& p) { return p.up; });
+            }
+            switchTo(size_t(next - m_paths.begin()));
+        }
+        return;
+    }
+    m_linkUp = false;
+    m_io.stop();
+}
+
+void Multiplexer::flushLink()
+{
+    if (!m_linkUp) {
+        return;
+    }
+    if (m_heartbeatNs) {
+        checkActive();
+    }
+    // The active link goes first, so acknowledgements take it when they can.
+    flushPath(m_paths[m_active]);
+    for (Path& path : m_paths) {
+        if (path.up && &path != &m_paths[m_active]) {
+            flushPath(path);
+        }
+    }
+}
+
+void Multiplexer::flushPath(Path& path)
+{
+    Link& link = *path.link;
+    if (link.writing()) {
+        return;
+    }
+    // Control frames go on the active link, and so does all data when the
+    // others are standbys.
+    bool active = &path == &m_paths[m_active];
+    bool data = active || m_heartbeatNs == 0;
+
+    if (m_heartbeatNs) {
+        uint64_t now = monotonicNs();
+        if (now >= path.heartbeatAt && link.addControl(0, cControlHeartbeat, hears(path, now))) {
+            path.heartbeatAt = now + m_heartbeatNs;
+        }
+        m_io.wakeBy(path.heartbeatAt);
+    }
+    // In reliable mode lost frames go first.
+    if (data) {
+        link.addResends();
+    }
+    if (active && m_flow) {
+        addControlFrames(link);
+    }
+
+    // Gather frames from the ready channels in the order the scheduler picks
+    // (highest priority first, or weighted turns), straight out of their
+    // input rings. A channel that still has input once its part of the batch
+    // is written rejoins at the back of its queue.
+    size_t budget = !data ? 0 : m_paths.size() > 1 ? bondBudget(path) : cMaxBatchBytes;
+    bool lowerSent = false;
+    while (budget > 0 && !m_txReady.empty() && !link.batchFull()) {
+        uint8_t id = m_txReady.front();
+        Channel* channel = m_byId[id];
+        if (channel && m_flow && m_flow->credit(id) == 0) {
+            m_txReady.pop();
+            stall(*channel);
+            continue;
+        }
+        size_t limit = std::min(budget, m_txReady.allowance(id));
+        size_t lowerFrame = 0;
+        if (channel && channel->priority() > m_topPriority) {
+            if (lowerSent || !linkHasRoomForLower(path, lowerFrame)) {
+                break;
+            }
+            lowerSent = true;
+            limit = std::min(limit, lowerFrame);
+        }
+        m_txReady.pop();
+        if (!channel) {
+            continue;
+        }
+        if (m_flow) {
+            limit = std::min(limit, m_flow->credit(id));
+        }
+        size_t taken = takeInput(link, *channel, limit);
+        budget -= taken;
+        if (m_flow) {
+            m_flow->sent(id, taken);
+        }
+        if (lowerFrame > 0 && taken > 0) {
+            path.sizer.picked(lowerFrame);
+        } else if (m_lowerChannels && taken > 0 && channel->priority() == m_topPriority) {
+            uint64_t now = monotonicNs();
+            for (Path& other : m_paths) {
+                other.sizer.urgent(now);
+            }
+        }
+        m_txInFlight[id] += taken;
+        m_txReady.used(id, taken, m_txInFlight[id] == channel->input().readable());
+        if (taken > 0) {
+            path.txBatch.emplace_back(channel, taken);
+        }
+    }
+
+    const iovec* iov;
+    int count;
+    if (link.beginWrite(iov, count)) {
+        Path* p = &path;
+        m_io.write(link.fd(), iov, count, [this, p](ssize_t n) { onLinkWritten(*p, n); });
+    } else if (link.arq()) {
+        m_io.wakeBy(link.nextTimeout());
+    }
+}
+
+bool Multiplexer::hears(const Path& path, uint64_t now) const
+{
+    return now - path.lastRxNs < cDeadHeartbeats * m_heartbeatNs;
+}
+
+bool Multiplexer::works(const Path& path, uint64_t now) const
+{
+    return path.up && (!m_heartbeatNs || (hears(path, now) && path.peerHears));
+}
+
+void Multiplexer::checkActive()
+{
+    uint64_t now = monotonicNs();
+    Path& active = m_paths[m_active];
+    if (works(active, now)) {
+        return;
+    }
+    for (size_t i = 0; i < m_paths.size(); ++i) {
+        if (works(m_paths[i], now)) {
+            logWarning("link %zu: %s", m_active,
+                       hears(active, now) ? "the peer hears nothing on it" : "nothing heard on it");
+            switchTo(i);
+            return;
+        }
+    }
+}
+
+void Multiplexer::switchTo(size_t index)
+{
+    // Frames left unacknowledged on the old link are resent on this one.
+    m_active = index;
+    if (m_heartbeatNs) {
+        logWarning("failing over to link %zu", index);
+        m_stats.failovers++;
+    }
+}
+
+size_t Multiplexer::bondBudget(Path& path)
+{
+    size_t queued = path.link->outputQueued();
+    if (queued < cBondQueueBytes) {
+        return cBondQueueBytes;
+    }
+    uint64_t byteTime = path.link->byteTimeNs();
+    m_io.wakeBy(monotonicNs() + (byteTime ? (queued - cBondQueueBytes + 1) * byteTime : cOutputPollNs));
+    return 0;
+}
+
+size_t Multiplexer::takeInput(Link& link, Channel& channel, size_t limit)
+{
+    // A stream goes in frames of up to cMaxDataSize. A message is cut at its
+    // end as well, and every frame but its last carries the more flag; one
+    // still open when the input runs out is ended later by an empty frame.
+    // A compressed frame stands for as much input as fits, which only the
+    // encoder can tell, so it may only start once the frame is sure to be
+    // taken: its history moves on either way. Input already in a bonded
+    // link's write in flight is skipped.
+    const SpscRing& input = channel.input();
+    bool messages = channel.maxMessage() > 0;
+    LzEncoder* encoder = channel.encoder();
+    size_t skip = m_txInFlight[channel.id()];
+    size_t taken = 0;
+    for (;;) {
+        size_t rest = messages ? channel.messageRemaining(skip + taken) : SIZE_MAX;
+        if (rest == 0) {
+            if (!link.addFrame(channel.id(), cNoData, 0)) {
+                break;
+            }
+            channel.messageSent();
+            continue;
+        }
+        const uint8_t* data;
+        size_t len = input.peek(skip + taken, data, std::min({limit - taken, encoder ? cLzMaxInput : cMaxDataSize, rest}));
+        if (len == 0) {
+            break;
+        }
+        if (encoder) {
+            if (link.batchFull()) {
+                break;
+            }
+            size_t check = 0;
+            if (!m_dictionarySent[channel.id()]) {
+                m_dictionarySent[channel.id()] = true;
+                uint32_t crc = channel.dictionaryCrc();
+                m_packed[0] = uint8_t(crc >> 24);
+                m_packed[1] = uint8_t(crc >> 16);
+                m_packed[2] = uint8_t(crc >> 8);
+                m_packed[3] = uint8_t(crc);
+                check = cDictionaryCheckSize;
+            }
+            size_t packed;
+            len = encoder->compress(data, len, m_packed.data() + check, m_packed.size() - check, packed);
+            link.addFrame(channel.id(), m_packed.data(), check + packed, messages && len < rest);
+            m_stats.compressedIn += len;
+            m_stats.compressedOut += packed;
+        } else if (!link.addFrame(channel.id(), data, len, messages && len < rest)) {
+            break;
+        }
+        taken += len;
+        if (len == rest) {
+            channel.messageSent();
+        }
+    }
+    return taken;
+}
+
+bool Multiplexer::endDelimitedMessages(Channel& channel, const uint8_t* data, size_t len)
+{
+    // data is the tail of the input queued so far.
+    uint64_t start = channel.stats().bytesFromPort - len;
+    bool ended = false;
+    const uint8_t* end = data + len;
+    for (const uint8_t* p = data; p < end;) {
+        auto* delimiter = static_cast<const uint8_t*>(std::memchr(p, channel.delimiter(), size_t(end - p)));
+        if (!delimiter) {
+            break;
+        }
+        p = delimiter + 1;
+        channel.endMessageAt(start + uint64_t(p - data));
+        ended = true;
+    }
+    return ended;
+}
+
+void Multiplexer::coalesce(Channel& channel, size_t bytes)
+{
+    // A read into an empty ring waits for company; one that finds earlier
+    // input waiting joins it, and one that finds it on its way to the link
+    // goes along with the rest.
+    size_t readable = channel.input().readable();
+    auto waiting = std::find(m_coalescing.begin(), m_coalescing.end(), &channel);
+    if (waiting != m_coalescing.end()) {
+        m_stats.coalescedReads++;
+        if (readable >= channel.coalesceBytes()) {
+            *waiting = m_coalescing.back();
+            m_coalescing.pop_back();
+            markTxReady(channel);
+        }
+        return;
+    }
+    if (readable > bytes || readable >= channel.coalesceBytes()) {
+        markTxReady(channel);
+        return;
+    }
+    channel.setCoalesceFromNs(monotonicNs());
+    m_coalescing.push_back(&channel);
+}
+
+void Multiplexer::stopCoalescing(Channel& channel)
+{
+    auto waiting = std::find(m_coalescing.begin(), m_coalescing.end(), &channel);
+    if (waiting != m_coalescing.end()) {
+        *waiting = m_coalescing.back();
+        m_coalescing.pop_back();
+    }
+}
+
+void Multiplexer::releaseCoalesced()
+{
+    uint64_t now = monotonicNs();
+    for (size_t i = 0; i < m_coalescing.size();) {
+        Channel* channel = m_coalescing[i];
+        uint64_t sendAt = channel->coalesceFromNs() + channel->coalesceNs();
+        if (now < sendAt) {
+            m_io.wakeBy(sendAt);
+            ++i;
+            continue;
+        }
+        markTxReady(*channel);
+        m_coalescing[i] = m_coalescing.back();
+        m_coalescing.pop_back();
+    }
+}
+
+void Multiplexer::openMessage(Channel& channel)
+{
+    channel.setLastInputNs(monotonicNs());
+    if (std::find(m_openMessages.begin(), m_openMessages.end(), &channel) == m_openMessages.end()) {
+        m_openMessages.push_back(&channel);
+    }
+}
+
+void Multiplexer::endIdleMessages()
+{
+    uint64_t now = monotonicNs();
+    for (size_t i = 0; i < m_openMessages.size();) {
+        Channel* channel = m_openMessages[i];
+        uint64_t endAt = channel->lastInputNs() + channel->messageIdleNs();
+        if (now < endAt) {
+            m_io.wakeBy(endAt);
+            ++i;
+            continue;
+        }
+        channel->endMessage();
+        markTxReady(*channel);
+        m_openMessages[i] = m_openMessages.back();
+        m_openMessages.pop_back();
+    }
+}
+
+bool Multiplexer::holdingTooMuch(Channel& channel) const
+{
+    // The peer cannot send past the credit it was given, and credit does not
+    // come back for held bytes, so a full window is too much as well.
+    size_t held = channel.output().held();
+    return held > channel.maxMessage() || (m_flow && held >= m_flow->window());
+}
+
+bool Multiplexer::linkHasRoomForLower(Path& path, size_t& frameSize)
+{
+    // The kernel has been handed all but the batch being gathered.
+    Link& link = *path.link;
+    FrameSizer& sizer = path.sizer;
+    uint64_t now = monotonicNs();
+    size_t queued = link.outputQueued();
+    sizer.sample(now, link.stats().bytesOut - link.batchBytes(), queued);
+    frameSize = sizer.frameSize(now);
+    size_t frameBytes = cHeaderSize + frameSize;
+    if (queued < frameBytes) {
+        return true;
+    }
+    uint64_t wait = sizer.byteTimeNs() ? (queued - frameBytes + 1) * sizer.byteTimeNs() : cOutputPollNs;
+    m_io.wakeBy(now + wait);
+    return false;
+}
+
+void Multiplexer::flushChannel(Channel& channel)
+{
+    iovec iov[cChannelWriteIov];
+    int count = channel.output().beginWrite(iov, cChannelWriteIov);
+    if (count > 0) {
+        Channel* ch = &channel;
+        m_io.write(channel.fd(), iov, count, [this, ch](ssize_t n) { onChannelWritten(*ch, n); });
+    }
+}
+
+void Multiplexer::markDirty(Channel& channel)
+{
+    if (!m_dirty[channel.id()]) {
+        m_dirty[channel.id()] = true;
+        m_dirtyChannels.push_back(&channel);
+    }
+}
+
+void Multiplexer::markTxReady(Channel& channel)
+{
+    m_txReady.push(channel.id(), channel.priority());
+}
+
+void Multiplexer::stall(Channel& channel)
+{
+    uint8_t id = channel.id();
+    if (!m_flow->stalled(id)) {
+        m_flow->stall(id, monotonicNs());
+        m_stalled.push_back(id);
+        m_stats.creditStalls++;
+    }
+}
+
+void Multiplexer::unstall(uint8_t id)
+{
+    m_flow->unstall(id);
+    m_stalled.erase(std::find(m_stalled.begin(), m_stalled.end(), id));
+}
+
+void Multiplexer::queueControl(uint8_t id, uint8_t what)
+{
+    if (m_controlWhat[id] == 0) {
+        m_controlDue.push_back(id);
+    }
+    m_controlWhat[id] |= what;
+}
+
+void Multiplexer::addControlFrames(Link& link)
+{
+    uint64_t now = monotonicNs();
+    uint64_t wake = UINT64_MAX;
+    for (uint8_t id : m_stalled) {
+        if (m_flow->probeDue(id, now)) {
+            queueControl(id, cSendProbe);
+            m_stats.creditProbes++;
+        }
+        wake = std::min(wake, m_flow->probeAt(id));
+    }
+    if (wake != UINT64_MAX) {
+        m_io.wakeBy(wake);
+    }
+
+    size_t done = 0;
+    for (; done < m_controlDue.size(); ++done) {
+        uint8_t id = m_controlDue[done];
+        Channel* channel = m_byId[id];
+        uint8_t what = m_controlWhat[id];
+        if (channel && (what & cSendCredit)) {
+            uint32_t limit = m_flow->limit(id, channel->output().size());
+            if (!link.addControl(id, cControlCredit, limit)) {
+                break;
+            }
+            m_flow->advertised(id, limit);
+            what &= uint8_t(~cSendCredit);
+        }
+        if (channel && (what & cSendProbe)) {
+            if (!link.addControl(id, cControlProbe, m_flow->sentCount(id))) {
+                m_controlWhat[id] = what;
+                break;
+            }
+        }
+        m_controlWhat[id] = 0;
+    }
+    m_controlDue.erase(m_controlDue.begin(), m_controlDue.begin() + ptrdiff_t(done));
+}
+
+void Multiplexer::updateLinkReadPause()
+{
+    bool paused = m_congestedChannels > 0 || m_poolLow;
+    if (paused != m_linkReadPaused) {
+        m_linkReadPaused = paused;
+        for (Path& path : m_paths) {
+            if (path.up) {
+                m_io.pauseRead(path.link->fd(), paused);
+            }
+        }
+    }
+}
@@ -0,0 +1,208 @@
+/*
+ * Multiplexer.h
+ *
+ * Forwards bytes between the virtual channels and the physical link on a
+ * single IoEngine thread. All fds are non-blocking; flow control between the
+ * two directions is done by pausing reads instead of blocking.
+ *
+ * Several physical links may be bonded into one (addLink()): frames go out
+ * on whichever link has its kernel queue running short, so each carries a
+ * share in proportion to its line rate, and the shared Arq puts them back in
+ * order at the peer. With failover (setFailover()) the extra links are
+ * standbys instead: all traffic stays on one link while heartbeats on every
+ * link tell which ones still work both ways.
+ */
+#pragma once
+
+#include "Channel.h"
+#include "FlowControl.h"
+#include "FramePool.h"
+#include "FrameSizer.h"
+#include "IoEngine.h"
+#include "Link.h"
+#include "TxScheduler.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class Multiplexer
+{
+public:
+    struct Stats
+    {
+        uint64_t droppedFrames = 0; // frames for channels not configured here
+        uint64_t droppedBytes = 0;
+        uint64_t overrunBytes = 0; // read from a virtual port with its ring full
+        uint64_t poolDroppedBytes = 0; // received for a virtual port with no frame buffer free
+        uint64_t creditStalls = 0; // times a channel ran out of credit from the peer
+        uint64_t creditProbes = 0;
+        uint64_t splitMessages = 0; // messages written before their end arrived
+        uint64_t compressedIn = 0;  // channel bytes sent compressed...
+        uint64_t compressedOut = 0; // ...and their size on the link
+        uint64_t decompressErrors = 0;
+        uint64_t coalescedReads = 0; // virtual port reads joined to earlier input
+        uint64_t failovers = 0;      // switches to another link
+    };
+
+    static constexpr unsigned cDefaultHeartbeatMs = 100;
+    static constexpr unsigned cMaxHeartbeatMs = 10000;
+
+    Multiplexer(IoEngine& io, std::unique_ptr<Link> link);
+    ~Multiplexer();
+
+    Multiplexer(const Multiplexer&) = delete;
+    Multiplexer& operator=(const Multiplexer&) = delete;
+
+    /// Add a channel before start(). Channel ids must be unique, and
+    /// compression needs a reliable link. A compressed channel's first frame
+    /// carries the CRC-32C of its dictionary ahead of the compressed data;
+    /// if the peer's differs, nothing it sends on the channel is
+    /// decompressed, and each frame counts in decompressErrors.
+    void addChannel(std::unique_ptr<Channel> channel);
+
+    /// How channels share the link; set before start().
+    void setTxPolicy(TxPolicy policy) { m_txReady.setPolicy(policy); }
+
+    /// Per-channel flow control with the peer, which must enable it too:
+    /// each side lets the other have at most window bytes waiting for each
+    /// of its virtual ports. Call before start().
+    void enableFlowControl(size_t window = FlowControl::cDefaultWindow);
+    const FlowControl* flowControl() const { return m_flow.get(); }
+
+    /// Bond another physical link to the one given to the constructor;
+    /// call before start(). All links must be reliable, and the peer bonds
+    /// as many, in the same order. A bonded link that fails is dropped and
+    /// its unacknowledged frames are resent on the others.
+    void addLink(std::unique_ptr<Link> link);
+
+    /// Keep the links added by addLink() as standbys instead of bonding
+    /// them; call before start(). A heartbeat goes out on every link each
+    /// heartbeatMs, and once nothing has been heard on the link in use for
+    /// cDeadHeartbeats of them, or the peer says it hears nothing on it, all
+    /// channels move to the first link that works. Unacknowledged frames
+    /// follow them, so each channel's data stays in order.
+    void setFailover(unsigned heartbeatMs = cDefaultHeartbeatMs);
+    static constexpr unsigned cDeadHeartbeats = 5;
+
+    /// Which link carries the channels' data (the first one unless failover
+    /// moved them, or the first one still up when bonded).
+    size_t activeLink() const { return m_active; }
+
+    /// How big frames from channels below the top priority are cut on the
+    /// first link.
+    const FrameSizer& frameSizer() const { return m_paths[0].sizer; }
+
+    /// Allocate the frame pool and start reading the link and every channel.
+    void start();
+
+    /// Stop all I/O on the link and the channels.
+    void stop();
+
+    Channel* channel(uint8_t id) const { return m_byId[id]; }
+    size_t channelCount() const { return m_channels.size(); }
+    Link& link(size_t i = 0) { return *m_paths[i].link; }
+    size_t linkCount() const { return m_paths.size(); }
+
+    /// False once the physical link, or every bonded one, reported
+    /// end-of-file or a fatal error; the engine is stopped at that point.
+    bool linkUp() const { return m_linkUp; }
+
+    const Stats& stats() const { return m_stats; }
+
+    /// Buffers for data on its way from the link to the virtual ports; only
+    /// valid after start().
+    const FramePool& framePool() const { return *m_pool; }
+
+private:
+    /// A physical link and what rides on its write in flight.
+    struct Path
+    {
+        explicit Path(std::unique_ptr<Link> l);
+
+        std::unique_ptr<Link> link;
+        FrameSizer sizer;
+        std::vector<std::pair<Channel*, size_t>> txBatch; // input bytes in the link write in flight
+        bool up = true;
+        // Failover.
+        uint64_t lastRxNs = 0;     // when anything last arrived
+        uint64_t heartbeatAt = 0;  // when the next heartbeat is due
+        bool peerHears = true;     // what the peer's last heartbeat said
+    };
+
+    void onChannelData(Channel& channel, const uint8_t* data, ssize_t n);
+    void onChannelWritten(Channel& channel, ssize_t n);
+    void onLinkData(Path& path, const uint8_t* data, ssize_t n);
+    void onLinkWritten(Path& path, ssize_t n);
+    void batchWritten(Path& path);
+    void onPayload(uint8_t id, const uint8_t* data, size_t len, bool frameEnd, bool more);
+    void onControl(Path& path, uint8_t id, const uint8_t* payload);
+    void closeChannel(Channel& channel);
+    void linkFailed(Path& path, const char* what, ssize_t err);
+    void watchLink(Path& path);
+    void setHandlers(size_t index);
+    bool hears(const Path& path, uint64_t now) const;
+    bool works(const Path& path, uint64_t now) const;
+    void checkActive();
+    void switchTo(size_t index);
+
+    void flush();
+    void flushLink();
+    void flushPath(Path& path);
+    size_t bondBudget(Path& path);
+    size_t takeInput(Link& link, Channel& channel, size_t limit);
+    void flushChannel(Channel& channel);
+    void markDirty(Channel& channel);
+    void markTxReady(Channel& channel);
+    void stall(Channel& channel);
+    void unstall(uint8_t id);
+    void queueControl(uint8_t id, uint8_t what);
+    void addControlFrames(Link& link);
+    bool endDelimitedMessages(Channel& channel, const uint8_t* data, size_t len);
+    void coalesce(Channel& channel, size_t bytes);
+    void stopCoalescing(Channel& channel);
+    void releaseCoalesced();
+    void openMessage(Channel& channel);
+    void endIdleMessages();
+    bool holdingTooMuch(Channel& channel) const;
+    bool linkHasRoomForLower(Path& path, size_t& frameSize);
+    void updateLinkReadPause();
+
+    IoEngine& m_io;
+    std::vector<Path> m_paths; // the physical links; more than one when bonded
+    size_t m_active = 0;       // carries control frames, and with failover all data
+    uint64_t m_heartbeatNs = 0; // 0 unless failing over
+    std::unique_ptr<FramePool> m_pool; // outlives the channels' output queues
+    size_t m_poolReserve = 0;
+    std::vector<std::unique_ptr<Channel>> m_channels;
+    std::array<Channel*, 256> m_byId{};
+
+    bool m_started = false;
+    int m_flushHook = 0;
+    std::vector<Channel*> m_dirtyChannels; // have output to start writing
+    std::array<bool, 256> m_dirty{};
+    TxScheduler m_txReady; // channels with input for the link
+    unsigned m_topPriority = cDefaultPriority; // highest of any channel
+    bool m_lowerChannels = false;              // some are below it
+    std::array<size_t, 256> m_txInFlight{}; // input bytes in link writes, not yet consumed
+    std::array<bool, 256> m_inputPaused{};  // input ring nearly full
+    size_t m_congestedChannels = 0;        // channels whose output is above high water
+    std::array<bool, 256> m_congested{};
+    std::unique_ptr<FlowControl> m_flow; // nullptr without flow control
+    std::vector<uint8_t> m_stalled;      // channels waiting for credit
+    std::vector<uint8_t> m_controlDue;   // channels with control frames to send
+    std::array<uint8_t, 256> m_controlWhat{}; // which ones
+    std::vector<Channel*> m_openMessages;     // message-mode input not yet ended
+    std::vector<Channel*> m_coalescing;       // input waiting for more
+    std::array<uint8_t, cMaxDataSize> m_packed{}; // a compressed payload on its way into the link
+    std::array<bool, 256> m_dictionarySent{};    // first compressed frame has gone
+    std::array<bool, 256> m_dictionaryChecked{}; // first from the peer has come
+    std::array<bool, 256> m_dictionaryMismatch{}; // and named another dictionary
+    bool m_poolLow = false;
+    bool m_linkReadPaused = false;
+    bool m_linkUp = true;
+
+    Stats m_stats;
+};
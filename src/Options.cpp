@@ -0,0 +1,452 @@
+/*
+ * Options.cpp
+ */
+#include "Options.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <getopt.h>
+#include <stdexcept>
+
+namespace {
+
+unsigned long parseNumber(const std::string& text, unsigned long max, const char* what)
+{
+    if (text.empty()) {
+        throw std::invalid_argument(std::string("missing ") + what);
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long value = std::strtoul(text.c_str(), &end, 0);
+    if (errno != 0 || *end != '\0' || value > max || text[0] == '-') {
+        throw std::invalid_argument(std::string("bad ") + what + " '" + text + "'");
+    }
+    return value;
+}
+
+/// A byte count with an optional k or M suffix.
+size_t parseSize(std::string text, size_t min, size_t max, const char* what)
+{
+    size_t scale = 1;
+    if (!text.empty() && (text.back() == 'k' || text.back() == 'K')) {
+        scale = 1024;
+        text.pop_back();
+    } else if (!text.empty() && text.back() == 'M') {
+        scale = 1024 * 1024;
+        text.pop_back();
+    }
+    size_t value = parseNumber(text, max / scale, what) * scale;
+    if (value < min) {
+        throw std::invalid_argument(std::string(what) + " must be at least " + std::to_string(min));
+    }
+    return value;
+}
+
+/// A number of milliseconds, possibly fractional, in nanoseconds.
+uint64_t parseMillis(const std::string& text, const char* what)
+{
+    char* end = nullptr;
+    errno = 0;
+    double ms = std::strtod(text.c_str(), &end);
+    if (text.empty() || errno != 0 || *end != '\0' || !(ms >= 0 && ms <= 60000)) {
+        throw std::invalid_argument(std::string("bad ") + what + " '" + text + "'");
+    }
+    return uint64_t(ms * 1e6);
+}
+
+/// A probability, 0 to 1, such as 1e-5.
+double parseRate(const std::string& text, const char* what)
+{
+    char* end = nullptr;
+    errno = 0;
+    double rate = std::strtod(text.c_str(), &end);
+    if (text.empty() || errno != 0 || *end != '\0' || !(rate >= 0 && rate <= 1)) {
+        throw std::invalid_argument(std::string("bad ") + what + " '" + text + "'");
+    }
+    return rate;
+}
+
+/// A message delimiter: one character standing for itself, nl, cr, nul or
+/// a byte value such as 0x1e.
+int parseDelimiter(const std::string& text)
+{
+    if (text.size() == 1) {
+        return uint8_t(text[0]);
+    }
+    if (text == "nl") {
+        return '\n';
+    }
+    if (text == "cr") {
+        return '\r';
+    }
+    if (text == "nul") {
+        return 0;
+    }
+    return int(parseNumber(text, 0xff, "delimiter"));
+}
+
+void applyChannelOption(ChannelSpec& spec, const std::string& option)
+{
+    size_t eq = option.find('=');
+    std::string key = option.substr(0, eq);
+    std::string value = option.substr(eq + 1);
+    if (key == "ring") {
+        spec.ringSize = parseSize(value, cMinRingSize, cMaxRingSize, "ring size");
+    } else if (key == "prio") {
+        spec.priority = unsigned(parseNumber(value, cPriorityLevels - 1, "priority"));
+    } else if (key == "weight") {
+        spec.weight = unsigned(parseNumber(value, cMaxWeight, "weight"));
+        if (spec.weight == 0) {
+            throw std::invalid_argument("weight must be at least 1");
+        }
+    } else if (key == "msg") {
+        spec.maxMessage = parseSize(value, 1, cMaxMessageSize, "message size");
+    } else if (key == "compress") {
+        if (value == "lz") {
+            spec.compress = true;
+        } else if (value == "none") {
+            spec.compress = false;
+        } else {
+            throw std::invalid_argument("unknown compression '" + value + "'");
+        }
+    } else if (key == "dict") {
+        if (value.empty()) {
+            throw std::invalid_argument("missing dictionary file");
+        }
+        spec.dictionary = value;
+        spec.compress = true;
+    } else if (key == "coalesce") {
+        spec.coalesceMs = unsigned(parseNumber(value, cMaxCoalesceMs, "coalescing time"));
+    } else if (key == "fill") {
+        spec.coalesceBytes = parseSize(value, 1, cMaxCoalesceBytes, "coalescing size");
+    } else if (key == "delim") {
+        spec.delimiter = parseDelimiter(value);
+    } else if (key == "idle") {
+        spec.messageIdleMs = unsigned(parseNumber(value, cMaxMessageIdleMs, "message idle time"));
+        if (spec.messageIdleMs == 0) {
+            throw std::invalid_argument("message idle time must be at least 1 ms");
+        }
+    } else {
+        throw std::invalid_argument("unknown channel option '" + key + "'");
+    }
+}
+
+} // namespace
+
+LinkEmulator::Config parseEmulation(const std::string& text)
+{
+    LinkEmulator::Config config;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string option = text.substr(start, end - start);
+        size_t eq = option.find('=');
+        std::string key = option.substr(0, eq);
+        std::string value = eq == std::string::npos ? std::string() : option.substr(eq + 1);
+        if (key == "baud") {
+            config.baud = unsigned(parseNumber(value, 100000000, "emulated baud rate"));
+        } else if (key == "delay") {
+            config.delayNs = parseMillis(value, "emulated delay");
+        } else if (key == "jitter") {
+            config.jitterNs = parseMillis(value, "emulated jitter");
+        } else if (key == "drop") {
+            config.dropRate = parseRate(value, "byte loss rate");
+        } else if (key == "ber") {
+            config.bitErrorRate = parseRate(value, "bit error rate");
+        } else if (key == "seed") {
+            config.seed = parseNumber(value, ULONG_MAX, "seed");
+        } else {
+            throw std::invalid_argument("unknown emulation setting '" + key + "'");
+        }
+        start = end + 1;
+    }
+    return config;
+}
+
+ChannelSpec parseChannelSpec(const std::string& text)
+{
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) {
+        throw std::invalid_argument("channel spec '" + text + "' is not channel:devicePath");
+    }
+    ChannelSpec spec;
+    spec.id = uint8_t(parseNumber(text.substr(0, colon), 255, "channel id"));
+    spec.path = text.substr(colon + 1);
+
+    // Trailing ":key=value" fields are options; the path is everything before.
+    std::vector<std::string> options;
+    size_t last;
+    while ((last = spec.path.rfind(':')) != std::string::npos &&
+           spec.path.find('=', last) != std::string::npos) {
+        options.insert(options.begin(), spec.path.substr(last + 1));
+        spec.path.erase(last);
+    }
+    if (spec.path.empty()) {
+        throw std::invalid_argument("channel spec '" + text + "' has no device path");
+    }
+    for (const std::string& option : options) {
+        applyChannelOption(spec, option);
+    }
+    if (spec.delimiter >= 0 && spec.maxMessage == 0) {
+        spec.maxMessage = cMaxMessageSize;
+    }
+    return spec;
+}
+
+Options parseOptions(int argc, char* argv[])
+{
+    static const option longOptions[] = {
+        {"channel", required_argument, nullptr, 'c'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"low-latency", no_argument, nullptr, 'L'},
+        {"io-engine", required_argument, nullptr, 'e'},
+        {"framing", required_argument, nullptr, 'f'},
+        {"checksum", required_argument, nullptr, 'k'},
+        {"header", required_argument, nullptr, 'H'},
+        {"scheduler", required_argument, nullptr, 's'},
+        {"reliable", no_argument, nullptr, 'r'},
+        {"window", required_argument, nullptr, 'w'},
+        {"credit", required_argument, nullptr, 'C'},
+        {"failover", no_argument, nullptr, 'F'},
+        {"heartbeat", required_argument, nullptr, 't'},
+        {"emulate", required_argument, nullptr, 'E'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    Options opts;
+    bool seen[256] = {};
+    bool checksumGiven = false;
+    // 0 rather than 1 makes glibc drop all state of an earlier scan,
+    // including one that was abandoned by an exception.
+    optind = 0;
+    opterr = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "c:b:Le:f:k:H:s:rw:C:Ft:E:vh", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'c': {
+            ChannelSpec spec = parseChannelSpec(optarg);
+            if (seen[spec.id]) {
+                throw std::invalid_argument("channel " + std::to_string(spec.id) + " given twice");
+            }
+            seen[spec.id] = true;
+            opts.channels.push_back(spec);
+            break;
+        }
+        case 'b':
+            opts.baud = unsigned(parseNumber(optarg, 100000000, "baud rate"));
+            if (opts.baud == 0) {
+                throw std::invalid_argument("baud rate must be at least 1");
+            }
+            break;
+        case 'L':
+            opts.lowLatency = true;
+            break;
+        case 'e':
+            if (!IoEngine::parseKind(optarg, opts.ioEngine)) {
+                throw std::invalid_argument(std::string("unknown I/O engine '") + optarg + "'");
+            }
+            break;
+        case 'f':
+            if (std::string(optarg) == "length") {
+                opts.framing = Framing::Length;
+            } else if (std::string(optarg) == "cobs") {
+                opts.framing = Framing::Cobs;
+            } else {
+                throw std::invalid_argument(std::string("unknown framing '") + optarg + "'");
+            }
+            break;
+        case 'k':
+            checksumGiven = true;
+            if (std::string(optarg) == "none") {
+                opts.checksum = Checksum::None;
+            } else if (std::string(optarg) == "crc16") {
+                opts.checksum = Checksum::Crc16;
+            } else if (std::string(optarg) == "crc32") {
+                opts.checksum = Checksum::Crc32;
+            } else {
+                throw std::invalid_argument(std::string("unknown checksum '") + optarg + "'");
+            }
+            break;
+        case 'H':
+            if (std::string(optarg) == "standard") {
+                opts.header = HeaderFormat::Standard;
+            } else if (std::string(optarg) == "compact") {
+                opts.header = HeaderFormat::Compact;
+            } else {
+                throw std::invalid_argument(std::string("unknown header format '") + optarg + "'");
+            }
+            break;
+        case 's':
+            if (std::string(optarg) == "priority") {
+                opts.txPolicy = TxPolicy::Priority;
+            } else if (std::string(optarg) == "drr") {
+                opts.txPolicy = TxPolicy::Drr;
+            } else {
+                throw std::invalid_argument(std::string("unknown scheduler '") + optarg + "'");
+            }
+            break;
+        case 'r':
+            opts.reliable = true;
+            break;
+        case 'w':
+            opts.window = unsigned(parseNumber(optarg, Arq::cMaxWindow, "window"));
+            if (opts.window == 0) {
+                throw std::invalid_argument("window must be at least 1");
+            }
+            break;
+        case 'C':
+            opts.creditWindow = parseSize(optarg, FlowControl::cMinWindow, FlowControl::cMaxWindow, "credit window");
+            break;
+        case 'F':
+            opts.failover = true;
+            break;
+        case 't':
+            opts.heartbeatMs = unsigned(parseNumber(optarg, Multiplexer::cMaxHeartbeatMs, "heartbeat"));
+            if (opts.heartbeatMs == 0) {
+                throw std::invalid_argument("heartbeat must be at least 1 ms");
+            }
+            break;
+        case 'E':
+            opts.emulate = true;
+            opts.emulation = parseEmulation(optarg);
+            break;
+        case 'v':
+            if (opts.logLevel < LogLevel::Debug) {
+                opts.logLevel = LogLevel(int(opts.logLevel) + 1);
+            }
+            break;
+        case 'h':
+            opts.showHelp = true;
+            return opts;
+        default:
+            throw std::invalid_argument(std::string("unknown or incomplete option '") + argv[optind - 1] + "'");
+        }
+    }
+
+    if (optind == argc) {
+        throw std::invalid_argument("no physical device given");
+    }
+    opts.device = argv[optind];
+    opts.bonded.assign(argv + optind + 1, argv + argc);
+    if (opts.bonded.size() >= Arq::cMaxPaths) {
+        throw std::invalid_argument("at most " + std::to_string(Arq::cMaxPaths) + " physical devices");
+    }
+    if (opts.channels.empty()) {
+        throw std::invalid_argument("no channels given (-c channel:devicePath)");
+    }
+    if (opts.reliable && opts.checksum == Checksum::None) {
+        // Retransmission is only as good as the detection of corrupt frames.
+        if (checksumGiven) {
+            throw std::invalid_argument("--reliable needs a checksum (-k crc16 or crc32)");
+        }
+        opts.checksum = Checksum::Crc32;
+    }
+    if (opts.failover && opts.bonded.empty()) {
+        throw std::invalid_argument("--failover needs a standby physical device");
+    }
+    if (!opts.bonded.empty() && !opts.reliable) {
+        // Frames are put back in order, or resent on another link, by their
+        // sequence numbers.
+        throw std::invalid_argument(opts.failover ? "--failover needs --reliable"
+                                                  : "bonding several physical devices needs --reliable");
+    }
+    for (const ChannelSpec& spec : opts.channels) {
+        if (spec.compress && !opts.reliable) {
+            throw std::invalid_argument("channel " + std::to_string(spec.id) + ": compression needs --reliable");
+        }
+    }
+    return opts;
+}
+
+void printUsage(FILE* out)
+{
+    std::fprintf(out,
+        "Usage: serial-mux [options] -c channel:devicePath [-c ...] physicalDevice...\n"
+        "\n"
+        "A physicalDevice is a serial port (/dev/ttyS0 or serial:/dev/ttyS0) or a\n"
+        "socket to a peer serial-mux:\n"
+        "  tcp://HOST:PORT, unix:PATH         connect to a peer listening with\n"
+        "  tcp-listen://[HOST]:PORT,          ...these, which wait for it\n"
+        "  unix-listen:PATH\n"
+        "  udp://HOST:PORT[?bind=[ADDR:]PORT][&mtu=BYTES]\n"
+        "                                     datagrams, received on the bind\n"
+        "                                     port (default PORT), of at most\n"
+        "                                     mtu bytes (default 1472)\n"
+        "IPv6 addresses go in brackets. -b and -L only apply to serial ports.\n"
+        "\n"
+        "More than one physicalDevice bonds them into one link (needs -r; the far\n"
+        "side lists its ends of the cables in the same order), or with -F makes\n"
+        "the others standbys for the first.\n"
+        "\n"
+        "  -c, --channel ID:PATH[:OPT=VALUE...]\n"
+        "                          create virtual port PATH for channel ID (0..255)\n"
+        "                          options: ring=BYTES  input buffer (default 16k,\n"
+        "                                               4k..16M, k/M suffixes)\n"
+        "                                   prio=N      link priority, 0 (highest)\n"
+        "                                               to 7, default 4\n"
+        "                                   weight=N    link share with -s drr,\n"
+        "                                               1 to 64, default 1\n"
+        "                                   msg=BYTES   message mode: input ends a\n"
+        "                                               message when idle; the\n"
+        "                                               far side writes each\n"
+        "                                               message of up to BYTES\n"
+        "                                               (max 64k) in one piece\n"
+        "                                   idle=MS     quiet time that ends a\n"
+        "                                               message, default 2\n"
+        "                                   delim=C     message mode ending each\n"
+        "                                               message after byte C (a\n"
+        "                                               character, nl, cr, nul or\n"
+        "                                               0xNN) instead of on idle\n"
+        "                                   coalesce=MS wait up to MS for more input\n"
+        "                                               before framing it, default\n"
+        "                                               2, 0 sends each read at once\n"
+        "                                   fill=BYTES  ...or until BYTES are waiting\n"
+        "                                               (default 1k, max 16k)\n"
+        "                                   compress=lz streaming compression;\n"
+        "                                               needs -r, and the same\n"
+        "                                               option on the far side\n"
+        "                                   dict=FILE   compress=lz starting from a\n"
+        "                                               dictionary (serial-mux-dict)\n"
+        "  -b, --baud RATE         physical port baud rate (default 115200); any\n"
+        "                          rate the driver supports, e.g. 3000000\n"
+        "  -L, --low-latency       have the port driver pass on received bytes\n"
+        "                          at once (low_latency, FTDI latency_timer)\n"
+        "  -e, --io-engine NAME    uring, epoll (default) or poll; uring falls\n"
+        "                          back to epoll if the kernel lacks it\n"
+        "  -f, --framing MODE      length (default) or cobs; cobs resyncs within\n"
+        "                          one frame after line errors. Both ends must match\n"
+        "  -k, --checksum TYPE     none (default), crc16 or crc32 trailer on every\n"
+        "                          frame; corrupt frames are dropped. Both ends must match\n"
+        "  -H, --header FORMAT     standard (default; 3 bytes) or compact (1 byte\n"
+        "                          for up to 15 bytes on channels 0..7, else 2-3).\n"
+        "                          Both ends must match\n"
+        "  -s, --scheduler NAME    how channels share the link: priority (default;\n"
+        "                          strict prio=, turns within a priority) or drr\n"
+        "                          (weighted deficit round robin by weight=)\n"
+        "  -r, --reliable          acknowledge and resend lost frames (selective\n"
+        "                          repeat); implies -k crc32 unless -k is given\n"
+        "  -w, --window FRAMES     frames in flight unacknowledged with -r (1..128,\n"
+        "                          default 32)\n"
+        "  -C, --credit BYTES      per-channel flow control: let the peer have at\n"
+        "                          most BYTES waiting for each virtual port here\n"
+        "                          (1k..64k, e.g. 16k), so a port nobody reads\n"
+        "                          stops only its own channel. Both ends need -C\n"
+        "  -F, --failover          the physical devices after the first are\n"
+        "                          standbys: all channels move to one of them when\n"
+        "                          heartbeats show the link in use has failed\n"
+        "  -t, --heartbeat MS      heartbeat interval with -F (default 100); a\n"
+        "                          link is failed after 5 missed\n"
+        "  -E, --emulate KEY=VALUE[,...]\n"
+        "                          run each physical link through an emulated\n"
+        "                          serial line (for testing; give it one side):\n"
+        "                          baud=RATE, delay=MS, jitter=MS, drop=P (byte\n"
+        "                          loss), ber=P (bit errors), seed=N. Not for udp\n"
+        "  -v, --verbose           more logging (repeat for debug)\n"
+        "  -h, --help              show this help\n");
+}
@@ -0,0 +1,54 @@
+/*
+ * Options.h
+ *
+ * Command line parsing for serial-mux.
+ */
+#pragma once
+
+#include "Arq.h"
+#include "Channel.h"
+#include "FlowControl.h"
+#include "Frame.h"
+#include "IoEngine.h"
+#include "LinkEmulator.h"
+#include "Log.h"
+#include "Multiplexer.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct Options
+{
+    std::vector<ChannelSpec> channels;
+    std::string device;
+    std::vector<std::string> bonded; // further physical devices bonded to device...
+    bool failover = false;           // ...or standing by for it
+    unsigned heartbeatMs = Multiplexer::cDefaultHeartbeatMs;
+    unsigned baud = 115200;
+    bool lowLatency = false;
+    IoEngine::Kind ioEngine = IoEngine::Kind::Epoll;
+    Framing framing = Framing::Length;
+    HeaderFormat header = HeaderFormat::Standard;
+    Checksum checksum = Checksum::None;
+    TxPolicy txPolicy = TxPolicy::Priority;
+    bool reliable = false;
+    unsigned window = Arq::cDefaultWindow;
+    size_t creditWindow = 0; // 0: no per-channel flow control
+    bool emulate = false;    // put a LinkEmulator in front of each physical link
+    LinkEmulator::Config emulation;
+    LogLevel logLevel = LogLevel::Warning;
+    bool showHelp = false;
+};
+
+/// Parse "channel:devicePath[:option=value...]". Throws std::invalid_argument.
+ChannelSpec parseChannelSpec(const std::string& text);
+
+/// Parse "key=value,..." line emulation settings (-E). Throws
+/// std::invalid_argument.
+LinkEmulator::Config parseEmulation(const std::string& text);
+
+/// Parse the full command line. Throws std::invalid_argument on bad usage.
+Options parseOptions(int argc, char* argv[]);
+
+void printUsage(FILE* out);
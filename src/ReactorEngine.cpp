@@ -0,0 +1,217 @@
+/*
+ * ReactorEngine.cpp
+ */
+#include "ReactorEngine.h"
+
+#include "Util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <stdexcept>
+#include <unistd.h>
+
+ReactorEngine::ReactorEngine(EventLoop::Backend backend)
+    : m_loop(backend)
+{
+}
+
+ReactorEngine::~ReactorEngine() = default;
+
+IoEngine::Kind ReactorEngine::kind() const
+{
+    return m_loop.backend() == EventLoop::Backend::Epoll ? Kind::Epoll : Kind::Poll;
+}
+
+ReactorEngine::FdState& ReactorEngine::state(int fd)
+{
+    if (fd < 0) {
+        throw std::invalid_argument("ReactorEngine: bad fd");
+    }
+    if (size_t(fd) >= m_states.size()) {
+        m_states.resize(size_t(fd) + 1);
+    }
+    if (!m_states[fd]) {
+        auto st = std::make_unique<FdState>();
+        st->fd = fd;
+        FdState* raw = st.get();
+        m_loop.add(fd, 0, [this, raw](uint32_t events) { onEvent(*raw, events); });
+        m_states[fd] = std::move(st);
+    }
+    return *m_states[fd];
+}
+
+void ReactorEngine::watchRead(int fd, size_t bufferSize, ReadHandler onData)
+{
+    FdState& st = state(fd);
+    if (st.reading) {
+        throw std::logic_error("ReactorEngine: fd already being read");
+    }
+    st.readBuf.resize(bufferSize);
+    st.onData = std::move(onData);
+    st.reading = true;
+    st.paused = false;
+    updateInterest(st);
+}
+
+void ReactorEngine::pauseRead(int fd, bool paused)
+{
+    if (fd < 0 || size_t(fd) >= m_states.size() || !m_states[fd]) {
+        return;
+    }
+    FdState& st = *m_states[fd];
+    st.paused = paused;
+    updateInterest(st);
+}
+
+void ReactorEngine::write(int fd, const iovec* iov, int count, WriteHandler onDone)
+{
+    FdState& st = state(fd);
+    if (st.writing) {
+        throw std::logic_error("ReactorEngine: write already in flight");
+    }
+    st.writeIov.assign(iov, iov + count);
+    st.writeIndex = 0;
+    st.written = 0;
+    st.onWritten = std::move(onDone);
+    st.writing = true;
+    st.writeBlocked = false;
+    continueWrite(st);
+    updateInterest(st);
+}
+
+void ReactorEngine::reserveWrite(int fd, int maxIov)
+{
+    state(fd).writeIov.reserve(size_t(maxIov));
+    // Each fd has at most one write completing at a time.
+    m_writers++;
+    m_completions.reserve(m_writers);
+    m_dispatching.reserve(m_writers);
+}
+
+void ReactorEngine::unwatch(int fd)
+{
+    if (fd < 0 || size_t(fd) >= m_states.size() || !m_states[fd]) {
+        return;
+    }
+    m_loop.remove(fd);
+    m_states[fd]->fd = -1;
+    // Completions queued for it may still reference the state.
+    m_retired.push_back(std::move(m_states[fd]));
+}
+
+int ReactorEngine::runOnce(int timeoutMs)
+{
+    timeoutMs = runFlushHooks(timeoutMs);
+
+    int dispatched = m_loop.runOnce(m_completions.empty() ? timeoutMs : 0);
+    m_syscalls++;
+
+    // Handlers may queue new completions; those run on the next pass. Both
+    // vectors keep their capacity, so this does not allocate.
+    m_dispatching.swap(m_completions);
+    for (Completion& c : m_dispatching) {
+        if (c.state->fd >= 0) {
+            c.handler(c.result);
+            ++dispatched;
+        }
+    }
+    m_dispatching.clear();
+    if (m_completions.empty()) {
+        m_retired.clear();
+    }
+    return dispatched;
+}
+
+void ReactorEngine::stop()
+{
+    m_stop.store(true, std::memory_order_relaxed);
+    m_loop.stop();
+}
+
+void ReactorEngine::onEvent(FdState& st, uint32_t events)
+{
+    if ((events & (EventLoop::cWritable | EventLoop::cHangup)) && st.writing && st.writeBlocked) {
+        continueWrite(st);
+    }
+
+    bool readable = (events & EventLoop::cReadable) && !st.paused;
+    if (st.reading && (readable || (events & EventLoop::cHangup))) {
+        ssize_t n = ::read(st.fd, st.readBuf.data(), st.readBuf.size());
+        m_syscalls++;
+        if (n > 0) {
+            st.onData(st.readBuf.data(), n);
+        } else if (n == 0) {
+            st.reading = false;
+            st.onData(st.readBuf.data(), 0);
+        } else if (!wouldBlock(errno) && !peerNotListening(errno)) {
+            int err = errno;
+            st.reading = false;
+            st.onData(nullptr, -err);
+        }
+    }
+
+    // The handler may have unwatched the fd.
+    if (st.fd >= 0) {
+        updateInterest(st);
+    }
+}
+
+void ReactorEngine::continueWrite(FdState& st)
+{
+    st.writeBlocked = false;
+    while (st.writeIndex < st.writeIov.size()) {
+        int count = int(std::min<size_t>(st.writeIov.size() - st.writeIndex, IOV_MAX));
+        ssize_t n = ::writev(st.fd, &st.writeIov[st.writeIndex], count);
+        m_syscalls++;
+        if (n < 0) {
+            if (errno == EINTR || peerNotListening(errno)) {
+                continue;
+            }
+            if (wouldBlock(errno)) {
+                st.writeBlocked = true;
+                return;
+            }
+            finishWrite(st, -errno);
+            return;
+        }
+        st.written += n;
+        size_t left = size_t(n);
+        while (left > 0 && st.writeIndex < st.writeIov.size()) {
+            iovec& v = st.writeIov[st.writeIndex];
+            if (left >= v.iov_len) {
+                left -= v.iov_len;
+                st.writeIndex++;
+            } else {
+                v.iov_base = static_cast<uint8_t*>(v.iov_base) + left;
+                v.iov_len -= left;
+                left = 0;
+            }
+        }
+        // Skip empty trailing iovecs.
+        while (st.writeIndex < st.writeIov.size() && st.writeIov[st.writeIndex].iov_len == 0) {
+            st.writeIndex++;
+        }
+    }
+    finishWrite(st, st.written);
+}
+
+void ReactorEngine::finishWrite(FdState& st, ssize_t result)
+{
+    st.writing = false;
+    st.writeBlocked = false;
+    m_completions.push_back({&st, std::move(st.onWritten), result});
+    st.onWritten = nullptr;
+}
+
+void ReactorEngine::updateInterest(FdState& st)
+{
+    uint32_t events = 0;
+    if (st.reading && !st.paused) {
+        events |= EventLoop::cReadable;
+    }
+    if (st.writing && st.writeBlocked) {
+        events |= EventLoop::cWritable;
+    }
+    m_loop.modify(st.fd, events);
+}
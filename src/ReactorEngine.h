@@ -0,0 +1,71 @@
+/*
+ * ReactorEngine.h
+ *
+ * IoEngine on top of the readiness EventLoop (epoll or poll). Reads happen
+ * when the fd is readable; writes are attempted immediately and finished
+ * from writable notifications, with completions delivered on the next
+ * iteration.
+ */
+#pragma once
+
+#include "EventLoop.h"
+#include "IoEngine.h"
+
+#include <memory>
+#include <vector>
+
+class ReactorEngine : public IoEngine
+{
+public:
+    explicit ReactorEngine(EventLoop::Backend backend);
+    ~ReactorEngine() override;
+
+    Kind kind() const override;
+
+    void watchRead(int fd, size_t bufferSize, ReadHandler onData) override;
+    void pauseRead(int fd, bool paused) override;
+    void write(int fd, const iovec* iov, int count, WriteHandler onDone) override;
+    void reserveWrite(int fd, int maxIov) override;
+    void unwatch(int fd) override;
+
+    int runOnce(int timeoutMs) override;
+    void stop() override;
+
+private:
+    struct FdState
+    {
+        int fd = -1;
+
+        std::vector<uint8_t> readBuf;
+        ReadHandler onData;
+        bool reading = false;
+        bool paused = false;
+
+        std::vector<iovec> writeIov;
+        size_t writeIndex = 0;
+        ssize_t written = 0;
+        WriteHandler onWritten;
+        bool writing = false;
+        bool writeBlocked = false;
+    };
+
+    struct Completion
+    {
+        FdState* state;
+        WriteHandler handler;
+        ssize_t result;
+    };
+
+    FdState& state(int fd);
+    void onEvent(FdState& state, uint32_t events);
+    void continueWrite(FdState& state);
+    void finishWrite(FdState& state, ssize_t result);
+    void updateInterest(FdState& state);
+
+    EventLoop m_loop;
+    std::vector<std::unique_ptr<FdState>> m_states; // indexed by fd
+    std::vector<std::unique_ptr<FdState>> m_retired;
+    std::vector<Completion> m_completions;
+    std::vector<Completion> m_dispatching;
+    size_t m_writers = 0; // fds given reserveWrite()
+};
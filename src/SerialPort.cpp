@@ -0,0 +1,160 @@
+/*
+ * SerialPort.cpp
+ */
+#include "SerialPort.h"
+
+#include "BaudRate.h"
+#include "Log.h"
+#include "Util.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+void setAsyncLowLatency(int fd, const std::string& device)
+{
+    serial_struct serial;
+    if (::ioctl(fd, TIOCGSERIAL, &serial) < 0) {
+        logInfo("%s: no serial driver settings (%s), low_latency not set", device.c_str(), strerror(errno));
+        return;
+    }
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (::ioctl(fd, TIOCSSERIAL, &serial) < 0) {
+        logWarning("%s: setting low_latency failed: %s", device.c_str(), strerror(errno));
+    }
+}
+
+/// Write value to a tty attribute in sysfs, if the device has it. Device
+/// may be a symlink such as /dev/serial/by-id/...; sysfs knows the tty by
+/// its real name.
+void setTtyAttribute(const std::string& device, const char* attribute, const char* value)
+{
+    char real[PATH_MAX];
+    if (!::realpath(device.c_str(), real)) {
+        logInfo("%s: cannot resolve the device (%s), %s not set", device.c_str(), strerror(errno), attribute);
+        return;
+    }
+    const char* name = std::strrchr(real, '/');
+    std::string path = std::string("/sys/class/tty/") + (name ? name + 1 : real) + "/device/" + attribute;
+    if (::access(path.c_str(), F_OK) < 0) {
+        path = std::string("/sys/class/tty/") + (name ? name + 1 : real) + "/" + attribute;
+        if (::access(path.c_str(), F_OK) < 0) {
+            logInfo("%s: no %s setting, not set", device.c_str(), attribute);
+            return;
+        }
+    }
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || ::write(fd, value, std::strlen(value)) < 0) {
+        logWarning("%s: setting %s failed: %s", device.c_str(), path.c_str(), strerror(errno));
+    } else {
+        logInfo("%s: %s set to %s", device.c_str(), attribute, value);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+} // namespace
+
+speed_t baudToSpeed(unsigned baud)
+{
+    switch (baud) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 576000: return B576000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 1152000: return B1152000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    case 2500000: return B2500000;
+    case 3000000: return B3000000;
+    case 3500000: return B3500000;
+    case 4000000: return B4000000;
+    default: return B0;
+    }
+}
+
+int openSerialPort(const std::string& device, unsigned baud, bool lowLatency)
+{
+    int fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        throwErrno("open " + device);
+    }
+    if (!::isatty(fd)) {
+        logInfo("%s is not a tty, using it as a plain byte stream", device.c_str());
+        return fd;
+    }
+
+    speed_t speed = baudToSpeed(baud);
+
+    termios tio;
+    if (::tcgetattr(fd, &tio) < 0) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        throwErrno("tcgetattr " + device);
+    }
+    ::cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    // Non-canonical reads return as soon as one byte is there, with no
+    // inter-byte timer.
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (speed != B0) {
+        ::cfsetispeed(&tio, speed);
+        ::cfsetospeed(&tio, speed);
+    }
+    if (::tcsetattr(fd, TCSANOW, &tio) < 0) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        throwErrno("tcsetattr " + device);
+    }
+    if (speed == B0) {
+        // Not in the table: the driver gets the number itself.
+        unsigned actual;
+        try {
+            actual = setBaudRate(fd, baud);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        // A UART divides its clock, so some rates are only approximated; a
+        // few percent off and the far end sees garbage.
+        if (actual == 0) {
+            logWarning("%s: %u baud requested, but the rate could not be read back", device.c_str(), baud);
+        } else if (actual != baud) {
+            logWarning("%s: %u baud requested, driver set %u", device.c_str(), baud, actual);
+        } else {
+            logInfo("%s: %u baud (non-standard rate)", device.c_str(), baud);
+        }
+    }
+    if (lowLatency) {
+        setAsyncLowLatency(fd, device);
+        // FTDI adapters hold received bytes for up to 16 ms by default.
+        setTtyAttribute(device, "latency_timer", "1");
+        // The UART rounds this to the lowest trigger level it has.
+        setTtyAttribute(device, "rx_trig_bytes", "1");
+    }
+    ::tcflush(fd, TCIOFLUSH);
+    return fd;
+}
@@ -0,0 +1,25 @@
+/*
+ * SerialPort.h
+ *
+ * Opening and configuring the physical serial device.
+ */
+#pragma once
+
+#include <string>
+#include <termios.h>
+
+/// Map a numeric baud rate to its termios Bxxxx constant, or B0 if the
+/// rate has no constant.
+speed_t baudToSpeed(unsigned baud);
+
+/// Open device non-blocking in raw 8N1 mode at the given baud rate, which
+/// need not have a constant (see BaudRate.h).
+/// Devices that are not ttys (FIFOs, sockets) are opened without any termios
+/// configuration. Throws on failure; returns the open fd.
+///
+/// With lowLatency the driver is also told to hand over received bytes at
+/// once rather than collect them: the ASYNC_LOW_LATENCY serial flag, the
+/// shortest latency_timer of FTDI USB adapters and the lowest receive FIFO
+/// trigger level of 16550-style UARTs, where the device has them. These
+/// outlive the process, like the line settings.
+int openSerialPort(const std::string& device, unsigned baud, bool lowLatency = false);
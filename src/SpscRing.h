@@ -0,0 +1,100 @@
+/*
+ * SpscRing.h
+ *
+ * Fixed-capacity single-producer/single-consumer byte ring. Each side only
+ * stores its own index and loads the other's with acquire ordering, so the
+ * producer and consumer never take a lock, even from different threads.
+ * The consumer reads in place and releases bytes later, which lets the Link
+ * send straight out of the ring.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+class SpscRing
+{
+public:
+    /// capacity is rounded up to a power of two.
+    explicit SpscRing(size_t capacity)
+        : m_capacity(roundUp(capacity))
+        , m_mask(m_capacity - 1)
+        , m_buf(new uint8_t[m_capacity])
+    {
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t capacity() const { return m_capacity; }
+
+    // Producer side.
+
+    /// Bytes that can be written without overwriting unconsumed data.
+    size_t writable() const
+    {
+        return m_capacity - (m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire));
+    }
+
+    /// Copy in up to len bytes; returns how many fitted.
+    size_t write(const uint8_t* data, size_t len)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        len = std::min(len, m_capacity - (head - m_tail.load(std::memory_order_acquire)));
+        size_t at = head & m_mask;
+        size_t first = std::min(len, m_capacity - at);
+        std::memcpy(m_buf.get() + at, data, first);
+        std::memcpy(m_buf.get(), data + first, len - first);
+        m_head.store(head + len, std::memory_order_release);
+        return len;
+    }
+
+    // Consumer side.
+
+    size_t readable() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_relaxed);
+    }
+    bool empty() const { return readable() == 0; }
+
+    /// Point data at the contiguous bytes starting offset bytes past the read
+    /// position and return how many there are, at most maxLen. They stay put
+    /// until consume() releases them.
+    size_t peek(size_t offset, const uint8_t*& data, size_t maxLen) const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t avail = m_head.load(std::memory_order_acquire) - tail;
+        if (offset >= avail) {
+            return 0;
+        }
+        size_t at = (tail + offset) & m_mask;
+        data = m_buf.get() + at;
+        return std::min({avail - offset, m_capacity - at, maxLen});
+    }
+
+    /// Hand n bytes back to the producer.
+    void consume(size_t n)
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+private:
+    static size_t roundUp(size_t n)
+    {
+        size_t c = 1;
+        while (c < n) {
+            c <<= 1;
+        }
+        return c;
+    }
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<uint8_t[]> m_buf;
+    alignas(64) std::atomic<size_t> m_head{0}; // stored by the producer only
+    alignas(64) std::atomic<size_t> m_tail{0}; // stored by the consumer only
+};
@@ -0,0 +1,292 @@
+/*
+ * Transport.cpp
+ */
+#include "Transport.h"
+
+#include "Log.h"
+#include "SerialPort.h"
+#include "Util.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Ethernet payload less IPv4 and UDP headers: no fragmentation on most paths.
+constexpr size_t cDefaultDatagram = 1472;
+// The IPv6 minimum MTU; comfortably more than one full frame in any framing.
+constexpr size_t cMinDatagram = 1280;
+
+bool startsWith(const std::string& text, const char* prefix)
+{
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+/// Close fd without disturbing errno, and throw for what failed.
+[[noreturn]] void closeAndThrow(int fd, const std::string& what)
+{
+    int err = errno;
+    ::close(fd);
+    errno = err;
+    throwErrno(what);
+}
+
+struct HostPort
+{
+    std::string host; // empty: any address
+    std::string port;
+};
+
+/// Split "HOST:PORT", "[IPV6]:PORT" or ":PORT".
+HostPort parseHostPort(const std::string& text, const std::string& uri)
+{
+    HostPort hp;
+    size_t colon;
+    if (!text.empty() && text[0] == '[') {
+        size_t close = text.find(']');
+        if (close == std::string::npos || close + 1 >= text.size() || text[close + 1] != ':') {
+            throw std::invalid_argument("bad address in '" + uri + "'");
+        }
+        hp.host = text.substr(1, close - 1);
+        colon = close + 1;
+    } else {
+        colon = text.rfind(':');
+        if (colon == std::string::npos) {
+            throw std::invalid_argument("no port in '" + uri + "'");
+        }
+        hp.host = text.substr(0, colon);
+    }
+    hp.port = text.substr(colon + 1);
+    if (hp.port.empty()) {
+        throw std::invalid_argument("no port in '" + uri + "'");
+    }
+    return hp;
+}
+
+/// Resolve hp for a socket of the given type; an empty host is the
+/// wildcard address of family (AF_UNSPEC: IPv6, which takes IPv4 too).
+addrinfo* resolve(const HostPort& hp, int type, int family, const std::string& uri)
+{
+    addrinfo hints{};
+    hints.ai_family = family;
+    hints.ai_socktype = type;
+    if (hp.host.empty()) {
+        hints.ai_flags = AI_PASSIVE;
+        if (family == AF_UNSPEC) {
+            hints.ai_family = AF_INET6;
+        }
+    }
+    addrinfo* result = nullptr;
+    int rc = ::getaddrinfo(hp.host.empty() ? nullptr : hp.host.c_str(), hp.port.c_str(), &hints, &result);
+    if (rc != 0) {
+        throw std::runtime_error(uri + ": " + ::gai_strerror(rc));
+    }
+    return result;
+}
+
+/// Try each address in turn; returns an fd connected (or, with bindOnly,
+/// bound) to the first that works.
+int openFirst(addrinfo* list, bool bindOnly, const std::string& uri)
+{
+    int err = EADDRNOTAVAIL;
+    for (addrinfo* ai = list; ai; ai = ai->ai_next) {
+        int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        int one = 1;
+        if (bindOnly) {
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if ((bindOnly ? ::bind(fd, ai->ai_addr, ai->ai_addrlen) : ::connect(fd, ai->ai_addr, ai->ai_addrlen)) == 0) {
+            return fd;
+        }
+        err = errno;
+        ::close(fd);
+    }
+    errno = err;
+    throwErrno((bindOnly ? "bind " : "connect ") + uri);
+}
+
+/// Wait for one connection on the bound stream socket listener, which is
+/// closed either way.
+int acceptOne(int listener, const std::string& uri)
+{
+    if (::listen(listener, 1) < 0) {
+        closeAndThrow(listener, "listen " + uri);
+    }
+    logInfo("%s: waiting for the peer to connect", uri.c_str());
+    int fd;
+    do {
+        fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        closeAndThrow(listener, "accept " + uri);
+    }
+    ::close(listener);
+    return fd;
+}
+
+Transport openTcp(const std::string& uri, const std::string& address, bool listen)
+{
+    HostPort hp = parseHostPort(address, uri);
+    addrinfo* list = resolve(hp, SOCK_STREAM, AF_UNSPEC, uri);
+    int fd;
+    try {
+        fd = openFirst(list, listen, uri);
+    } catch (...) {
+        ::freeaddrinfo(list);
+        throw;
+    }
+    ::freeaddrinfo(list);
+    if (listen) {
+        fd = acceptOne(fd, uri);
+    }
+    // Batches are already as big as they get; Nagle would only hold back
+    // the small frames that are waiting for an answer.
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return {fd, 0, 0};
+}
+
+Transport openUnix(const std::string& uri, const std::string& path, bool listen)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("bad socket path in '" + uri + "'");
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throwErrno("socket " + uri);
+    }
+    if (!listen) {
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            closeAndThrow(fd, "connect " + uri);
+        }
+        return {fd, 0, 0};
+    }
+    // A socket left behind by an earlier run, but nothing else, is replaced.
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        ::unlink(path.c_str());
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        closeAndThrow(fd, "bind " + uri);
+    }
+    try {
+        fd = acceptOne(fd, uri);
+    } catch (...) {
+        ::unlink(path.c_str());
+        throw;
+    }
+    // Connected; nobody else is to find it.
+    ::unlink(path.c_str());
+    return {fd, 0, 0};
+}
+
+Transport openUdp(const std::string& uri, std::string address)
+{
+    std::string bind;
+    size_t mtu = cDefaultDatagram;
+    size_t query = address.find('?');
+    if (query != std::string::npos) {
+        std::string options = address.substr(query + 1);
+        address.erase(query);
+        size_t start = 0;
+        while (start <= options.size()) {
+            size_t end = options.find('&', start);
+            if (end == std::string::npos) {
+                end = options.size();
+            }
+            std::string option = options.substr(start, end - start);
+            if (startsWith(option, "bind=")) {
+                bind = option.substr(5);
+            } else if (startsWith(option, "mtu=")) {
+                char* last = nullptr;
+                mtu = std::strtoul(option.c_str() + 4, &last, 10);
+                if (*last != '\0' || mtu < cMinDatagram || mtu > cMaxDatagram) {
+                    throw std::invalid_argument("mtu in '" + uri + "' must be " + std::to_string(cMinDatagram) +
+                                                " to " + std::to_string(cMaxDatagram));
+                }
+            } else {
+                throw std::invalid_argument("unknown option '" + option + "' in '" + uri + "'");
+            }
+            start = end + 1;
+        }
+    }
+    HostPort peer = parseHostPort(address, uri);
+    HostPort local;
+    if (bind.empty()) {
+        local.port = peer.port;
+    } else if (bind.find(':') == std::string::npos) {
+        local.port = bind;
+    } else {
+        local = parseHostPort(bind, uri);
+    }
+
+    addrinfo* peerList = resolve(peer, SOCK_DGRAM, AF_UNSPEC, uri);
+    // Bound in the peer's family: a connected socket cannot change it.
+    int family = peerList->ai_family;
+    addrinfo* localList = nullptr;
+    int fd;
+    try {
+        localList = resolve(local, SOCK_DGRAM, family, uri);
+        fd = openFirst(localList, true, uri);
+    } catch (...) {
+        ::freeaddrinfo(peerList);
+        if (localList) {
+            ::freeaddrinfo(localList);
+        }
+        throw;
+    }
+    ::freeaddrinfo(localList);
+    // Connected, so writev() knows where to send and only the peer's
+    // datagrams are received.
+    int rc = ::connect(fd, peerList->ai_addr, peerList->ai_addrlen);
+    ::freeaddrinfo(peerList);
+    if (rc < 0) {
+        closeAndThrow(fd, "connect " + uri);
+    }
+    return {fd, 0, mtu};
+}
+
+} // namespace
+
+bool isSerialUri(const std::string& uri)
+{
+    return !startsWith(uri, "tcp://") && !startsWith(uri, "tcp-listen://") && !startsWith(uri, "udp://") &&
+           !startsWith(uri, "unix:") && !startsWith(uri, "unix-listen:");
+}
+
+Transport openTransport(const std::string& uri, unsigned baud, bool lowLatency)
+{
+    if (startsWith(uri, "tcp://")) {
+        return openTcp(uri, uri.substr(6), false);
+    }
+    if (startsWith(uri, "tcp-listen://")) {
+        return openTcp(uri, uri.substr(13), true);
+    }
+    if (startsWith(uri, "unix:")) {
+        return openUnix(uri, uri.substr(5), false);
+    }
+    if (startsWith(uri, "unix-listen:")) {
+        return openUnix(uri, uri.substr(12), true);
+    }
+    if (startsWith(uri, "udp://")) {
+        return openUdp(uri, uri.substr(6));
+    }
+    std::string device = startsWith(uri, "serial:") ? uri.substr(7) : uri;
+    return {openSerialPort(device, baud, lowLatency), baud, 0};
+}
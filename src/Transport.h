@@ -0,0 +1,41 @@
+/*
+ * Transport.h
+ *
+ * What the multiplexed stream runs over. The physical link is named by a
+ * URI-style argument:
+ *   /dev/ttyS0, serial:/dev/ttyS0   a serial port (see openSerialPort())
+ *   tcp://HOST:PORT                 connect to a peer listening with...
+ *   tcp-listen://[HOST]:PORT        ...this, which waits for one connection
+ *   unix:PATH                       the same over a Unix domain socket...
+ *   unix-listen:PATH                ...which this creates
+ *   udp://HOST:PORT[?bind=[ADDR:]PORT][&mtu=BYTES]
+ *                                   datagrams to HOST:PORT, received on the
+ *                                   bind port (default PORT), each at most
+ *                                   mtu bytes (default 1472)
+ * HOST may be a name or an address, IPv6 in brackets. Whatever it is, the
+ * Link gets a non-blocking fd; only datagrams need it to know more: each
+ * write is one datagram, so a batch must fit in one, and a lost datagram
+ * takes whole frames with it rather than leaving the decoder mid-frame.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/// An open physical link.
+struct Transport
+{
+    int fd = -1;
+    unsigned baud = 0;   // line rate, 0 where there is none
+    size_t maxWrite = 0; // most bytes one write may carry (LinkConfig::maxWrite)
+};
+
+/// Open the link uri names. baud and lowLatency apply to serial ports.
+/// Listening schemes block until the peer connects. Throws on failure.
+Transport openTransport(const std::string& uri, unsigned baud, bool lowLatency = false);
+
+/// Most bytes a udp:// mtu may be: one datagram has to fit one link read.
+constexpr size_t cMaxDatagram = 16 * 1024;
+
+/// True if uri names a serial port rather than a socket.
+bool isSerialUri(const std::string& uri);
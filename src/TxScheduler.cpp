@@ -0,0 +1,69 @@
+/*
+ * TxScheduler.cpp
+ */
+#include "TxScheduler.h"
+
+#include <algorithm>
+#include <cstdint>
+
+void TxScheduler::setWeight(uint8_t id, unsigned weight)
+{
+    m_weight[id] = uint8_t(std::clamp(weight, 1u, cMaxWeight));
+}
+
+void TxScheduler::push(uint8_t id, unsigned level)
+{
+    if (m_queued[id]) {
+        return;
+    }
+    if (m_policy == TxPolicy::Drr) {
+        level = 0;
+    }
+    m_queued[id] = true;
+    if (m_levels & (1u << level)) {
+        m_next[m_tail[level]] = id;
+    } else {
+        m_head[level] = id;
+        m_levels |= 1u << level;
+    }
+    m_tail[level] = id;
+}
+
+void TxScheduler::pop()
+{
+    unsigned level = frontLevel();
+    uint8_t id = m_head[level];
+    m_queued[id] = false;
+    if (m_tail[level] == id) {
+        m_levels &= ~(1u << level);
+    } else {
+        m_head[level] = m_next[id];
+    }
+}
+
+size_t TxScheduler::allowance(uint8_t id)
+{
+    if (m_policy != TxPolicy::Drr) {
+        return SIZE_MAX;
+    }
+    if (!m_inTurn[id]) {
+        m_inTurn[id] = true;
+        m_deficit[id] += m_weight[id] * cDrrQuantum;
+    }
+    return m_deficit[id];
+}
+
+void TxScheduler::used(uint8_t id, size_t bytes, bool drained)
+{
+    if (m_policy != TxPolicy::Drr) {
+        return;
+    }
+    m_deficit[id] -= std::min(bytes, m_deficit[id]);
+    if (drained) {
+        m_deficit[id] = 0;
+    }
+    // A turn cut short by the batch filling up carries on next time.
+    if (drained || m_deficit[id] == 0) {
+        m_inTurn[id] = false;
+    }
+}
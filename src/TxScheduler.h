@@ -0,0 +1,86 @@
+/*
+ * TxScheduler.h
+ *
+ * Decides which channel's input goes onto the link next, under one of two
+ * policies:
+ *
+ *   Priority: channels with input waiting are queued by priority level, 0
+ *   being the highest; the highest non-empty level is found from a
+ *   bitmask, and channels within a level take turns.
+ *
+ *   Drr: weighted deficit round robin. Channels take turns in one queue;
+ *   each turn adds weight * cDrrQuantum bytes to the channel's deficit and
+ *   the channel may send up to its deficit. Frames can be cut anywhere, so
+ *   a turn always sends something and the link is shared in proportion to
+ *   the weights whatever the traffic.
+ *
+ * Queueing and picking are O(1) and never allocate.
+ */
+#pragma once
+
+#include "Frame.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+constexpr unsigned cPriorityLevels = 8;
+constexpr unsigned cDefaultPriority = 4;
+
+constexpr unsigned cDefaultWeight = 1;
+constexpr unsigned cMaxWeight = 64;
+/// Bytes one unit of weight earns per turn.
+constexpr size_t cDrrQuantum = cMaxDataSize;
+
+enum class TxPolicy
+{
+    Priority,
+    Drr,
+};
+
+class TxScheduler
+{
+public:
+    TxScheduler() { m_weight.fill(uint8_t(cDefaultWeight)); }
+
+    void setPolicy(TxPolicy policy) { m_policy = policy; }
+    TxPolicy policy() const { return m_policy; }
+
+    /// Drr: share of the link for channel id, 1..cMaxWeight.
+    void setWeight(uint8_t id, unsigned weight);
+
+    /// Queue channel id unless it is already queued. level is its priority
+    /// (ignored under Drr).
+    void push(uint8_t id, unsigned level);
+
+    bool empty() const { return m_levels == 0; }
+    bool queued(uint8_t id) const { return m_queued[id]; }
+
+    /// The channel to serve next; only valid if !empty().
+    uint8_t front() const { return m_head[frontLevel()]; }
+    unsigned frontLevel() const { return unsigned(__builtin_ctz(m_levels)); }
+
+    /// Remove front().
+    void pop();
+
+    /// Bytes channel id may send now; starts a turn if it is not in one.
+    /// Unlimited under Priority.
+    size_t allowance(uint8_t id);
+
+    /// Channel id sent bytes of its allowance; drained if it has nothing
+    /// left to send, which forfeits the rest of its deficit.
+    void used(uint8_t id, size_t bytes, bool drained);
+
+private:
+    TxPolicy m_policy = TxPolicy::Priority;
+    std::array<uint8_t, 256> m_next{}; // next channel id in the same level
+    std::array<bool, 256> m_queued{};
+    std::array<uint8_t, cPriorityLevels> m_head{};
+    std::array<uint8_t, cPriorityLevels> m_tail{};
+    unsigned m_levels = 0; // bit n set: level n has channels queued
+
+    // Drr.
+    std::array<uint8_t, 256> m_weight;
+    std::array<size_t, 256> m_deficit{};
+    std::array<bool, 256> m_inTurn{};
+};
@@ -0,0 +1,535 @@
+/*
+ * UringEngine.cpp
+ */
+#include "UringEngine.h"
+
+#include "Log.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <endian.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint64_t cOpMask = 3;
+constexpr uint64_t cNoTag = 0; // user_data of cancel requests, ignored on completion
+
+int sysSetup(unsigned entries, io_uring_params* params)
+{
+    return int(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void* arg, size_t argSize)
+{
+    return int(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+int sysRegister(int fd, unsigned opcode, const void* arg, unsigned count)
+{
+    return int(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+uint32_t pollMask(uint32_t events)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16); // poll32_events is word-swapped
+#endif
+    return events;
+}
+
+template <typename T>
+T* at(void* base, uint32_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+} // namespace
+
+UringEngine::UringEngine(unsigned entries)
+{
+    io_uring_params params{};
+    m_ringFd = sysSetup(entries, &params);
+    if (m_ringFd < 0) {
+        throwErrno("io_uring_setup");
+    }
+
+    auto fail = [this](const std::string& what) {
+        int err = errno;
+        if (m_sqes) {
+            ::munmap(m_sqes, m_sqesSize);
+        }
+        if (m_cqRing && m_cqRing != m_sqRing) {
+            ::munmap(m_cqRing, m_cqRingSize);
+        }
+        if (m_sqRing) {
+            ::munmap(m_sqRing, m_sqRingSize);
+        }
+        ::close(m_ringFd);
+        errno = err;
+        throwErrno(what);
+    };
+
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        errno = ENOTSUP;
+        fail("io_uring_setup: kernel too old (needs EXT_ARG and NODROP)");
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    void* sq = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_ringFd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        fail("mmap(SQ ring)");
+    }
+    m_sqRing = sq;
+    if (singleMmap) {
+        m_cqRing = m_sqRing;
+    } else {
+        void* cq = ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          m_ringFd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            fail("mmap(CQ ring)");
+        }
+        m_cqRing = cq;
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        fail("mmap(SQEs)");
+    }
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    m_sqEntries = params.sq_entries;
+    m_sqHead = at<unsigned>(m_sqRing, params.sq_off.head);
+    m_sqTail = at<unsigned>(m_sqRing, params.sq_off.tail);
+    m_sqMask = *at<unsigned>(m_sqRing, params.sq_off.ring_mask);
+    m_sqArray = at<unsigned>(m_sqRing, params.sq_off.array);
+    m_sqLocalTail = *m_sqTail;
+
+    m_cqHead = at<unsigned>(m_cqRing, params.cq_off.head);
+    m_cqTail = at<unsigned>(m_cqRing, params.cq_off.tail);
+    m_cqMask = *at<unsigned>(m_cqRing, params.cq_off.ring_mask);
+    m_cqes = at<io_uring_cqe>(m_cqRing, params.cq_off.cqes);
+
+    m_wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd < 0) {
+        fail("eventfd");
+    }
+    watchRead(m_wakeFd, sizeof(uint64_t), [](const uint8_t*, ssize_t) {});
+}
+
+UringEngine::~UringEngine()
+{
+    // Let the kernel finish with every buffer before it is freed.
+    for (auto& st : m_states) {
+        if (st && !st->retired) {
+            unwatch(st->fd);
+        }
+    }
+    uint64_t deadline = monotonicNs() + 1000000000ull;
+    auto pending = [this] {
+        return std::any_of(m_retired.begin(), m_retired.end(), [](const auto& st) { return st->inflight > 0; });
+    };
+    while (pending() && monotonicNs() < deadline) {
+        try {
+            submitPending(1, 10);
+        } catch (const std::exception&) {
+            break;
+        }
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            onCompletion(m_cqes[head & m_cqMask]);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    ::munmap(m_sqes, m_sqesSize);
+    if (m_cqRing != m_sqRing) {
+        ::munmap(m_cqRing, m_cqRingSize);
+    }
+    ::munmap(m_sqRing, m_sqRingSize);
+    ::close(m_ringFd);
+    ::close(m_wakeFd);
+}
+
+UringEngine::FdState& UringEngine::state(int fd)
+{
+    if (fd < 0) {
+        throw std::invalid_argument("UringEngine: bad fd");
+    }
+    if (size_t(fd) >= m_states.size()) {
+        m_states.resize(size_t(fd) + 1);
+    }
+    if (!m_states[fd]) {
+        m_states[fd] = std::make_unique<FdState>();
+        m_states[fd]->fd = fd;
+    }
+    return *m_states[fd];
+}
+
+UringEngine::FdState* UringEngine::find(int fd)
+{
+    if (fd < 0 || size_t(fd) >= m_states.size()) {
+        return nullptr;
+    }
+    return m_states[fd].get();
+}
+
+void UringEngine::watchRead(int fd, size_t bufferSize, ReadHandler onData)
+{
+    FdState& st = state(fd);
+    if (st.reading) {
+        throw std::logic_error("UringEngine: fd already being read");
+    }
+    st.readBuf.resize(bufferSize);
+    st.bufIndex = -1;
+    st.onData = std::move(onData);
+    st.reading = true;
+    st.paused = false;
+    armRead(st);
+}
+
+void UringEngine::pauseRead(int fd, bool paused)
+{
+    FdState* st = find(fd);
+    if (!st) {
+        return;
+    }
+    st->paused = paused;
+    if (!paused) {
+        armRead(*st);
+    }
+}
+
+void UringEngine::write(int fd, const iovec* iov, int count, WriteHandler onDone)
+{
+    FdState& st = state(fd);
+    if (st.writing) {
+        throw std::logic_error("UringEngine: write already in flight");
+    }
+    st.writeIov.assign(iov, iov + count);
+    st.writeIndex = 0;
+    st.written = 0;
+    st.onWritten = std::move(onDone);
+    st.writing = true;
+    submitWrite(st, false);
+}
+
+void UringEngine::reserveWrite(int fd, int maxIov)
+{
+    state(fd).writeIov.reserve(size_t(maxIov));
+}
+
+void UringEngine::unwatch(int fd)
+{
+    FdState* st = find(fd);
+    if (!st) {
+        return;
+    }
+    st->retired = true;
+    if (st->readArmed) {
+        cancel(*st, OpPollRead);
+        cancel(*st, OpRead);
+    }
+    if (st->writing) {
+        cancel(*st, OpPollWrite);
+        cancel(*st, OpWrite);
+    }
+    // Freed once its last completion is in; a handler may be running on it now.
+    m_retired.push_back(std::move(m_states[fd]));
+}
+
+int UringEngine::runOnce(int timeoutMs)
+{
+    if (!m_started) {
+        m_started = true;
+        registerBuffers();
+        for (auto& st : m_states) {
+            if (st) {
+                armRead(*st);
+            }
+        }
+    }
+
+    timeoutMs = runFlushHooks(timeoutMs);
+
+    bool haveCompletions = *m_cqHead != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    submitPending(haveCompletions || timeoutMs == 0 ? 0 : 1, timeoutMs);
+
+    int dispatched = 0;
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        io_uring_cqe cqe = m_cqes[head & m_cqMask];
+        ++head;
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        onCompletion(cqe);
+        ++dispatched;
+    }
+
+    m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                   [](const auto& st) { return st->inflight == 0; }),
+                    m_retired.end());
+    return dispatched;
+}
+
+void UringEngine::stop()
+{
+    m_stop.store(true, std::memory_order_relaxed);
+    uint64_t one = 1;
+    ssize_t rc = ::write(m_wakeFd, &one, sizeof(one));
+    (void)rc;
+}
+
+io_uring_sqe* UringEngine::getSqe(unsigned needed)
+{
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqLocalTail + needed - head > m_sqEntries) {
+        submitPending(0, 0);
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqLocalTail + needed - head > m_sqEntries) {
+            throw std::runtime_error("io_uring submission queue full");
+        }
+    }
+    unsigned index = m_sqLocalTail & m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    m_sqLocalTail++;
+    return sqe;
+}
+
+void UringEngine::submitPending(unsigned minComplete, int timeoutMs)
+{
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (toSubmit == 0 && minComplete == 0) {
+        return;
+    }
+
+    unsigned flags = 0;
+    const void* arg = nullptr;
+    size_t argSize = 0;
+    __kernel_timespec ts{};
+    io_uring_getevents_arg eventsArg{};
+    if (minComplete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeoutMs >= 0) {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+            eventsArg.ts = reinterpret_cast<uint64_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+            arg = &eventsArg;
+            argSize = sizeof(eventsArg);
+        }
+    }
+
+    m_syscalls++;
+    if (sysEnter(m_ringFd, toSubmit, minComplete, flags, arg, argSize) < 0) {
+        if (errno == EINTR || errno == ETIME || errno == EBUSY || errno == EAGAIN) {
+            return;
+        }
+        throwErrno("io_uring_enter");
+    }
+}
+
+void UringEngine::registerBuffers()
+{
+    std::vector<iovec> iovs;
+    std::vector<FdState*> owners;
+    for (auto& st : m_states) {
+        if (st && st->reading && !st->readBuf.empty()) {
+            iovs.push_back({st->readBuf.data(), st->readBuf.size()});
+            owners.push_back(st.get());
+        }
+    }
+    if (iovs.empty()) {
+        return;
+    }
+    if (sysRegister(m_ringFd, IORING_REGISTER_BUFFERS, iovs.data(), unsigned(iovs.size())) < 0) {
+        // Typically RLIMIT_MEMLOCK on older kernels; plain reads still work.
+        logDebug("io_uring buffer registration failed (%s), using unregistered reads", strerror(errno));
+        return;
+    }
+    for (size_t i = 0; i < owners.size(); ++i) {
+        owners[i]->bufIndex = int(i);
+    }
+}
+
+void UringEngine::armRead(FdState& st)
+{
+    if (!m_started || st.retired || !st.reading || st.paused || st.readArmed) {
+        return;
+    }
+    // The O_NONBLOCK read would fail with EAGAIN on its own, so it is linked
+    // behind a poll that completes once data is there.
+    io_uring_sqe* poll = getSqe(2);
+    poll->opcode = IORING_OP_POLL_ADD;
+    poll->fd = st.fd;
+    poll->poll32_events = pollMask(POLLIN);
+    poll->flags = IOSQE_IO_LINK;
+    poll->user_data = reinterpret_cast<uint64_t>(&st) | OpPollRead;
+
+    io_uring_sqe* read = getSqe();
+    read->opcode = st.bufIndex >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    read->fd = st.fd;
+    read->addr = reinterpret_cast<uint64_t>(st.readBuf.data());
+    read->len = uint32_t(st.readBuf.size());
+    read->off = uint64_t(-1);
+    read->buf_index = uint16_t(std::max(st.bufIndex, 0));
+    read->user_data = reinterpret_cast<uint64_t>(&st) | OpRead;
+
+    st.inflight += 2;
+    st.readArmed = true;
+}
+
+void UringEngine::submitWrite(FdState& st, bool afterPoll)
+{
+    if (afterPoll) {
+        io_uring_sqe* poll = getSqe(2);
+        poll->opcode = IORING_OP_POLL_ADD;
+        poll->fd = st.fd;
+        poll->poll32_events = pollMask(POLLOUT);
+        poll->flags = IOSQE_IO_LINK;
+        poll->user_data = reinterpret_cast<uint64_t>(&st) | OpPollWrite;
+        st.inflight++;
+    }
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = st.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(st.writeIov.data() + st.writeIndex);
+    sqe->len = uint32_t(std::min<size_t>(st.writeIov.size() - st.writeIndex, IOV_MAX));
+    sqe->off = uint64_t(-1);
+    sqe->user_data = reinterpret_cast<uint64_t>(&st) | OpWrite;
+    st.inflight++;
+}
+
+void UringEngine::finishWrite(FdState& st, ssize_t result)
+{
+    st.writing = false;
+    WriteHandler handler = std::move(st.onWritten);
+    st.onWritten = nullptr;
+    handler(result);
+}
+
+void UringEngine::cancel(FdState& st, Op op)
+{
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = reinterpret_cast<uint64_t>(&st) | op;
+    sqe->user_data = cNoTag;
+}
+
+void UringEngine::onCompletion(const io_uring_cqe& cqe)
+{
+    if (cqe.user_data == cNoTag) {
+        return;
+    }
+    FdState& st = *reinterpret_cast<FdState*>(cqe.user_data & ~cOpMask);
+    Op op = Op(cqe.user_data & cOpMask);
+    st.inflight--;
+    if (st.retired) {
+        return;
+    }
+
+    switch (op) {
+    case OpPollRead:
+        if (cqe.res < 0 && cqe.res != -ECANCELED) {
+            st.readPollError = cqe.res;
+        }
+        break;
+    case OpPollWrite:
+        if (cqe.res < 0 && cqe.res != -ECANCELED) {
+            st.writePollError = cqe.res;
+        }
+        break;
+    case OpRead:
+        onReadCompletion(st, cqe.res);
+        break;
+    case OpWrite:
+        onWriteCompletion(st, cqe.res);
+        break;
+    }
+}
+
+void UringEngine::onReadCompletion(FdState& st, int res)
+{
+    st.readArmed = false;
+    if (res == -ECANCELED) {
+        // The linked poll failed; its error is the read's error.
+        res = st.readPollError;
+        st.readPollError = 0;
+        if (res == 0) {
+            res = -EAGAIN;
+        }
+    }
+    if (res == -EAGAIN || res == -EINTR || peerNotListening(-res)) {
+        armRead(st);
+        return;
+    }
+    if (res > 0) {
+        st.onData(st.readBuf.data(), res);
+        armRead(st);
+        return;
+    }
+    st.reading = false;
+    st.onData(res == 0 ? st.readBuf.data() : nullptr, res);
+}
+
+void UringEngine::onWriteCompletion(FdState& st, int res)
+{
+    if (res == -ECANCELED) {
+        res = st.writePollError;
+        st.writePollError = 0;
+        if (res == 0) {
+            res = -EAGAIN;
+        }
+    }
+    if (res == -EAGAIN || res == -EINTR) {
+        submitWrite(st, true);
+        return;
+    }
+    if (peerNotListening(-res)) {
+        submitWrite(st, false);
+        return;
+    }
+    if (res < 0) {
+        finishWrite(st, res);
+        return;
+    }
+
+    st.written += res;
+    size_t left = size_t(res);
+    while (st.writeIndex < st.writeIov.size()) {
+        iovec& v = st.writeIov[st.writeIndex];
+        if (left < v.iov_len) {
+            v.iov_base = static_cast<uint8_t*>(v.iov_base) + left;
+            v.iov_len -= left;
+            break;
+        }
+        left -= v.iov_len;
+        st.writeIndex++;
+    }
+    if (st.writeIndex < st.writeIov.size()) {
+        // Short write: the fd is full, wait for room before continuing.
+        submitWrite(st, true);
+    } else {
+        finishWrite(st, st.written);
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ * Util.h
+ *
+ * Small system helpers shared by the multiplexer modules.
+ */
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Put a file descriptor into O_NONBLOCK mode. Throws std::system_error.
+void setNonBlocking(int fd);
+
+/// Throw std::system_error built from the current errno.
+[[noreturn]] void throwErrno(const std::string& what);
+
+/// The whole contents of a file. Throws std::system_error.
+std::vector<uint8_t> readFile(const std::string& path);
+
+/// CLOCK_MONOTONIC in nanoseconds.
+uint64_t monotonicNs();
+
+/// True for the errno values that mean "try again later" on a non-blocking fd.
+inline bool wouldBlock(int err)
+{
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
+
+/// True for the error a connected datagram socket reports once after an
+/// earlier datagram found nobody listening (ICMP port unreachable). That
+/// datagram is lost; the socket itself works on.
+inline bool peerNotListening(int err)
+{
+    return err == ECONNREFUSED;
+}
@@ -0,0 +1,142 @@
+/*
+ * dict_main.cpp
+ *
+ * serial-mux-dict: train a compression dictionary (dict= on a channel) from
+ * captured traffic of that channel.
+ */
+#include "Lz.h"
+#include "Util.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <getopt.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr size_t cDefaultDictionarySize = 16 * 1024;
+// A dictionary under this fraction of the size asked for is warned about.
+constexpr size_t cSmallDictionaryFraction = 4;
+
+void printUsage(FILE* out)
+{
+    std::fprintf(out,
+        "Usage: serial-mux-dict [-s BYTES] -o DICTIONARY CAPTURE...\n"
+        "\n"
+        "Build a dictionary for -c ID:PATH:dict=DICTIONARY from files holding\n"
+        "traffic typical of the channel, e.g. a log of a shell session.\n"
+        "\n"
+        "  -o, --output FILE       dictionary to write\n"
+        "  -s, --size BYTES        dictionary size (default 16k, at most 64k)\n"
+        "  -h, --help              this text\n");
+}
+
+/// Bytes with an optional k suffix; 0 if malformed.
+size_t parseSize(const char* text)
+{
+    char* end = nullptr;
+    errno = 0;
+    unsigned long value = std::strtoul(text, &end, 0);
+    if (errno != 0 || end == text || text[0] == '-') {
+        return 0;
+    }
+    if (*end == 'k' || *end == 'K') {
+        value *= 1024;
+        end++;
+    }
+    return *end == '\0' && value <= cLzWindow ? size_t(value) : 0;
+}
+
+void writeFile(const std::string& path, const std::vector<uint8_t>& data)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throwErrno("open " + path);
+    }
+    for (size_t done = 0; done < data.size();) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno != EINTR) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            throwErrno("write " + path);
+        }
+        done += n > 0 ? size_t(n) : 0;
+    }
+    if (::close(fd) < 0) {
+        throwErrno("close " + path);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    static const option longOptions[] = {
+        {"output", required_argument, nullptr, 'o'},
+        {"size", required_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    std::string output;
+    size_t size = cDefaultDictionarySize;
+    opterr = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "o:s:h", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'o':
+            output = optarg;
+            break;
+        case 's':
+            size = parseSize(optarg);
+            if (size == 0) {
+                std::fprintf(stderr, "serial-mux-dict: bad size '%s'\n", optarg);
+                return 2;
+            }
+            break;
+        case 'h':
+            printUsage(stdout);
+            return 0;
+        default:
+            printUsage(stderr);
+            return 2;
+        }
+    }
+    if (output.empty() || optind == argc) {
+        printUsage(stderr);
+        return 2;
+    }
+
+    try {
+        std::vector<uint8_t> sample;
+        for (int i = optind; i < argc; ++i) {
+            std::vector<uint8_t> capture = readFile(argv[i]);
+            sample.insert(sample.end(), capture.begin(), capture.end());
+        }
+        std::vector<uint8_t> dictionary = trainLzDictionary(sample.data(), sample.size(), size);
+        if (dictionary.empty()) {
+            std::fprintf(stderr, "serial-mux-dict: nothing in %zu bytes of samples recurs; no dictionary written\n",
+                         sample.size());
+            return 1;
+        }
+        writeFile(output, dictionary);
+        std::printf("%s: %zu bytes from %zu of samples\n", output.c_str(), dictionary.size(), sample.size());
+        if (dictionary.size() < size / cSmallDictionaryFraction) {
+            std::fflush(stdout);
+            std::fprintf(stderr,
+                         "serial-mux-dict: warning: only %zu of %zu bytes asked for; the samples are too short or "
+                         "too varied for the dictionary to help much\n",
+                         dictionary.size(), size);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "serial-mux-dict: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * main.cpp
+ *
+ * serial-mux: multiplex several virtual serial ports over one physical port.
+ */
+#include "AllocCounter.h"
+#include "Channel.h"
+#include "IoEngine.h"
+#include "Link.h"
+#include "LinkEmulator.h"
+#include "Log.h"
+#include "Multiplexer.h"
+#include "Options.h"
+#include "Transport.h"
+
+#include <csignal>
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+IoEngine* gEngine = nullptr;
+
+void onSignal(int)
+{
+    if (gEngine) {
+        gEngine->stop();
+    }
+}
+
+void installSignalHandlers()
+{
+    struct sigaction sa{};
+    sa.sa_handler = onSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGHUP, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opts;
+    try {
+        opts = parseOptions(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        std::fprintf(stderr, "serial-mux: %s\n", e.what());
+        printUsage(stderr);
+        return 2;
+    }
+    if (opts.showHelp) {
+        printUsage(stdout);
+        return 0;
+    }
+    setLogLevel(opts.logLevel);
+
+    try {
+        std::unique_ptr<IoEngine> engine = IoEngine::create(opts.ioEngine);
+        LinkConfig linkConfig;
+        linkConfig.framing = opts.framing;
+        linkConfig.checksum = opts.checksum;
+        linkConfig.header = opts.header;
+        linkConfig.reliable = opts.reliable;
+        linkConfig.window = opts.window;
+        std::vector<std::unique_ptr<LinkEmulator>> emulators;
+        auto openLink = [&](const std::string& uri) {
+            Transport transport = openTransport(uri, opts.baud, opts.lowLatency);
+            if (opts.emulate) {
+                // The emulator relays a byte stream and knows nothing of
+                // datagram boundaries.
+                if (transport.maxWrite > 0) {
+                    ::close(transport.fd);
+                    throw std::invalid_argument("-E cannot run over " + uri);
+                }
+                int fds[2];
+                try {
+                    LinkEmulator::makeSocketPair(fds);
+                } catch (...) {
+                    ::close(transport.fd);
+                    throw;
+                }
+                emulators.push_back(std::make_unique<LinkEmulator>(fds[1], transport.fd, opts.emulation));
+                transport.fd = fds[0];
+                if (opts.emulation.baud) {
+                    transport.baud = opts.emulation.baud;
+                }
+            }
+            LinkConfig config = linkConfig;
+            config.baud = transport.baud;
+            config.maxWrite = transport.maxWrite;
+            return std::make_unique<Link>(transport.fd, config);
+        };
+        Multiplexer mux(*engine, openLink(opts.device));
+        for (const std::string& device : opts.bonded) {
+            mux.addLink(openLink(device));
+        }
+        if (opts.failover) {
+            mux.setFailover(opts.heartbeatMs);
+        }
+        mux.setTxPolicy(opts.txPolicy);
+        if (opts.creditWindow > 0) {
+            mux.enableFlowControl(opts.creditWindow);
+        }
+        for (const ChannelSpec& spec : opts.channels) {
+            mux.addChannel(Channel::createPty(spec));
+        }
+
+        gEngine = engine.get();
+        installSignalHandlers();
+        mux.start();
+        logInfo("%zu channels on %s%s (%s)", mux.channelCount(), opts.device.c_str(),
+                opts.bonded.empty() ? "" : opts.failover ? " with standby ports" : " and bonded ports",
+                IoEngine::kindName(engine->kind()));
+        uint64_t allocations = heapAllocations();
+        engine->run();
+        gEngine = nullptr;
+        logInfo("frame pool: %zu buffers, fewest free %zu; %llu heap allocations while running",
+                mux.framePool().capacity(), mux.framePool().stats().lowestAvailable,
+                (unsigned long long)(heapAllocations() - allocations));
+        const Link::Stats& link = mux.link().stats();
+        logInfo("link: %llu frames in; dropped %llu bad headers, %llu bad frames, %llu checksum errors",
+                (unsigned long long)link.framesIn, (unsigned long long)link.badHeaders,
+                (unsigned long long)link.badFrames, (unsigned long long)link.crcErrors);
+        if (const Arq* arq = mux.link().arq()) {
+            const Arq::Stats& s = arq->stats();
+            logInfo("reliable: %llu frames sent, %llu resent (%llu timeouts, %llu fast), %llu received, "
+                    "%llu out of order, %llu duplicates, rtt %.1f ms",
+                    (unsigned long long)s.framesSent, (unsigned long long)s.retransmits,
+                    (unsigned long long)s.timeouts, (unsigned long long)s.fastRetransmits,
+                    (unsigned long long)s.framesReceived, (unsigned long long)s.outOfOrder,
+                    (unsigned long long)s.duplicates, double(s.rttNs) / 1e6);
+        }
+        if (mux.flowControl()) {
+            logInfo("flow control: %llu stalls for credit, %llu probes",
+                    (unsigned long long)mux.stats().creditStalls, (unsigned long long)mux.stats().creditProbes);
+        }
+        const FrameSizer::Stats& sizes = mux.frameSizer().stats();
+        if (sizes.fullFrames + sizes.smallFrames > 0) {
+            logInfo("lower-priority frames: %llu full size, %llu cut short (smallest %zu bytes); "
+                    "line rate %llu bytes/s",
+                    (unsigned long long)sizes.fullFrames, (unsigned long long)sizes.smallFrames, sizes.smallest,
+                    (unsigned long long)mux.frameSizer().bytesPerSec());
+        }
+        if (mux.stats().compressedIn > 0 || mux.stats().decompressErrors > 0) {
+            logInfo("compression: %llu channel bytes sent as %llu; %llu bad frames received",
+                    (unsigned long long)mux.stats().compressedIn, (unsigned long long)mux.stats().compressedOut,
+                    (unsigned long long)mux.stats().decompressErrors);
+        }
+        if (mux.stats().coalescedReads > 0) {
+            logInfo("%llu virtual port reads coalesced into earlier frames",
+                    (unsigned long long)mux.stats().coalescedReads);
+        }
+        if (mux.stats().failovers > 0) {
+            logInfo("%llu failovers; ended on link %zu", (unsigned long long)mux.stats().failovers, mux.activeLink());
+        }
+        for (auto& emulator : emulators) {
+            emulator->stop();
+            const LinkEmulator::Stats& out = emulator->stats(true);
+            const LinkEmulator::Stats& in = emulator->stats(false);
+            logInfo("emulated line: %llu bytes out (%llu lost, %llu bits flipped), %llu in (%llu lost, "
+                    "%llu bits flipped)",
+                    (unsigned long long)out.bytesIn, (unsigned long long)out.bytesDropped,
+                    (unsigned long long)out.bitsFlipped, (unsigned long long)in.bytesIn,
+                    (unsigned long long)in.bytesDropped, (unsigned long long)in.bitsFlipped);
+        }
+        if (mux.stats().splitMessages > 0) {
+            logInfo("%llu messages too big to hold were written in pieces",
+                    (unsigned long long)mux.stats().splitMessages);
+        }
+        return mux.linkUp() ? 0 : 1;
+    } catch (const std::exception& e) {
+        logError("%s", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,201 @@
+/*
+ * MuxHarness.h
+ *
+ * Two Multiplexers ("A" and "B") connected back to back through a socketpair
+ * standing in for the serial cable, or through a LinkEmulator. Each channel's virtual port is also a
+ * socketpair; the test holds the user end of each.
+ */
+#pragma once
+
+#include "Channel.h"
+#include "IoEngine.h"
+#include "Link.h"
+#include "LinkEmulator.h"
+#include "Multiplexer.h"
+#include "Util.h"
+
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace test {
+
+inline void makeSocketPair(int fds[2])
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        throwErrno("socketpair");
+    }
+}
+
+struct MuxEnd
+{
+    explicit MuxEnd(IoEngine::Kind kind)
+        : io(IoEngine::create(kind))
+    {
+    }
+
+    ~MuxEnd()
+    {
+        mux.reset();
+        for (int fd : userFds) {
+            ::close(fd);
+        }
+    }
+
+    /// Read everything currently available from channel index i's user end.
+    std::string drain(size_t i)
+    {
+        std::string out;
+        char buf[4096];
+        ssize_t n;
+        while ((n = ::read(userFds[i], buf, sizeof(buf))) > 0) {
+            out.append(buf, size_t(n));
+        }
+        return out;
+    }
+
+    bool send(size_t i, const std::string& data)
+    {
+        return ::write(userFds[i], data.data(), data.size()) == ssize_t(data.size());
+    }
+
+    std::unique_ptr<IoEngine> io;
+    std::unique_ptr<Multiplexer> mux;
+    std::vector<int> userFds; // indexed like the channel id list
+};
+
+class MuxPair
+{
+public:
+    explicit MuxPair(const std::vector<uint8_t>& channelIds,
+                     IoEngine::Kind kind = IoEngine::Kind::Epoll,
+                     size_t ringSize = cDefaultRingSize,
+                     const LinkConfig& config = LinkConfig())
+        : MuxPair(specs(channelIds, ringSize), kind, config)
+    {
+    }
+
+    /// How the pair is put together, beyond the channels and link framing.
+    struct Options
+    {
+        TxPolicy policy = TxPolicy::Priority;
+        size_t creditWindow = 0; // 0 leaves flow control off
+        /// More than one link bonds them (the link config must be reliable),
+        /// or with heartbeatMs makes the extra ones standbys.
+        size_t links = 1;
+        unsigned heartbeatMs = 0;
+        /// Makes the first link an emulated serial line.
+        std::optional<LinkEmulator::Config> emulation;
+        /// b's channels, if not the same as a's; indexed alike.
+        std::vector<ChannelSpec> peerChannels;
+    };
+
+    /// Channels with options; the paths are not used.
+    MuxPair(const std::vector<ChannelSpec>& channels, IoEngine::Kind kind, const LinkConfig& config = LinkConfig())
+        : MuxPair(channels, kind, config, Options())
+    {
+    }
+
+    MuxPair(const std::vector<ChannelSpec>& channels, IoEngine::Kind kind, const LinkConfig& config,
+            const Options& options)
+        : m_a(kind)
+        , m_b(kind)
+    {
+        // As in serial-mux itself: a write to a peer that went away first is
+        // an error, not a signal.
+        ::signal(SIGPIPE, SIG_IGN);
+        int link[2];
+        if (options.emulation) {
+            int far[2];
+            LinkEmulator::makeSocketPair(link);
+            LinkEmulator::makeSocketPair(far);
+            m_emulator = std::make_unique<LinkEmulator>(link[1], far[1], *options.emulation);
+            link[1] = far[0];
+        } else {
+            makeSocketPair(link);
+        }
+        m_a.mux = std::make_unique<Multiplexer>(*m_a.io, std::make_unique<Link>(link[0], config));
+        m_b.mux = std::make_unique<Multiplexer>(*m_b.io, std::make_unique<Link>(link[1], config));
+        for (size_t i = 1; i < options.links; ++i) {
+            makeSocketPair(link);
+            m_a.mux->addLink(std::make_unique<Link>(link[0], config));
+            m_b.mux->addLink(std::make_unique<Link>(link[1], config));
+        }
+        if (options.heartbeatMs > 0) {
+            m_a.mux->setFailover(options.heartbeatMs);
+            m_b.mux->setFailover(options.heartbeatMs);
+        }
+        m_a.mux->setTxPolicy(options.policy);
+        m_b.mux->setTxPolicy(options.policy);
+        if (options.creditWindow > 0) {
+            m_a.mux->enableFlowControl(options.creditWindow);
+            m_b.mux->enableFlowControl(options.creditWindow);
+        }
+        for (const ChannelSpec& spec : channels) {
+            addChannel(m_a, spec);
+        }
+        for (const ChannelSpec& spec : options.peerChannels.empty() ? channels : options.peerChannels) {
+            addChannel(m_b, spec);
+        }
+        m_a.mux->start();
+        m_b.mux->start();
+    }
+
+    MuxEnd& a() { return m_a; }
+    MuxEnd& b() { return m_b; }
+    LinkEmulator* emulator() { return m_emulator.get(); }
+
+    /// Run both loops once, waiting at most timeoutMs on each.
+    void pump(int timeoutMs = 0)
+    {
+        m_a.io->runOnce(timeoutMs);
+        m_b.io->runOnce(timeoutMs);
+    }
+
+    /// Pump until done() returns true or timeoutMs elapses.
+    bool pumpUntil(const std::function<bool()>& done, int timeoutMs = 2000)
+    {
+        uint64_t deadline = monotonicNs() + uint64_t(timeoutMs) * 1000000ull;
+        while (!done()) {
+            if (monotonicNs() > deadline) {
+                return false;
+            }
+            pump(1);
+        }
+        return true;
+    }
+
+private:
+    static std::vector<ChannelSpec> specs(const std::vector<uint8_t>& ids, size_t ringSize)
+    {
+        std::vector<ChannelSpec> out(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            out[i].id = ids[i];
+            out[i].ringSize = ringSize;
+        }
+        return out;
+    }
+
+    static void addChannel(MuxEnd& end, const ChannelSpec& spec)
+    {
+        int fds[2];
+        makeSocketPair(fds);
+        setNonBlocking(fds[1]);
+        auto channel = std::make_unique<Channel>(spec.id, fds[0], spec.ringSize);
+        channel->configure(spec);
+        end.mux->addChannel(std::move(channel));
+        end.userFds.push_back(fds[1]);
+    }
+
+    MuxEnd m_a;
+    MuxEnd m_b;
+    std::unique_ptr<LinkEmulator> m_emulator;
+};
+
+} // namespace test
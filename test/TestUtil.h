@@ -0,0 +1,65 @@
+/*
+ * TestUtil.h
+ *
+ * Tiny assertion helpers for the test executables. Each test binary calls
+ * its test functions from main() and returns testSummary().
+ */
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace test {
+
+inline int& failures()
+{
+    static int count = 0;
+    return count;
+}
+
+inline int summary(const char* name)
+{
+    if (failures() == 0) {
+        std::printf("%s: all tests passed\n", name);
+        return 0;
+    }
+    std::printf("%s: %d check(s) failed\n", name, failures());
+    return 1;
+}
+
+} // namespace test
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            test::failures()++;                                                       \
+        }                                                                             \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                \
+    do {                                                                              \
+        auto checkA_ = (a);                                                           \
+        auto checkB_ = (b);                                                           \
+        if (!(checkA_ == checkB_)) {                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK_EQ failed: %s == %s (%s vs %s)\n",       \
+                         __FILE__, __LINE__, #a, #b, std::to_string(checkA_).c_str(), \
+                         std::to_string(checkB_).c_str());                            \
+            test::failures()++;                                                       \
+        }                                                                             \
+    } while (0)
+
+#define CHECK_THROWS(expr)                                                            \
+    do {                                                                              \
+        bool threw_ = false;                                                          \
+        try {                                                                         \
+            (void)(expr);                                                             \
+        } catch (...) {                                                               \
+            threw_ = true;                                                            \
+        }                                                                             \
+        if (!threw_) {                                                                \
+            std::fprintf(stderr, "%s:%d: expected exception: %s\n", __FILE__, __LINE__, #expr); \
+            test::failures()++;                                                       \
+        }                                                                             \
+    } while (0)
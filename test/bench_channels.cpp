@@ -0,0 +1,178 @@
+/*
+ * bench_channels.cpp
+ *
+ * CPU cost of the forwarding loop versus the number of channels.
+ *
+ * Two multiplexers run back to back, each on its own thread, exactly as the
+ * real tool does (one event loop thread per side). A driver thread offers a
+ * fixed message rate on every channel of side A and drains side B. The CPU
+ * time consumed by the two multiplexer threads is sampled with
+ * CLOCK_THREAD_CPUTIME_ID, so the driver's own work is not counted. The
+ * engines' own syscall counters show how much batching each one achieves.
+ *
+ * Usage: bench_channels [--quick] [--engine uring|epoll|poll] [--framing length|cobs]
+ *                       [--rate MSGS_PER_SEC_PER_CHANNEL]
+ */
+#include "MuxHarness.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <thread>
+
+namespace {
+
+struct Config
+{
+    bool quick = false;
+    IoEngine::Kind engine = IoEngine::Kind::Epoll;
+    Framing framing = Framing::Length;
+    unsigned ratePerChannel = 200;
+    size_t messageSize = 16;
+};
+
+double threadCpuSeconds(pthread_t thread)
+{
+    clockid_t clock;
+    timespec ts{};
+    if (pthread_getcpuclockid(thread, &clock) == 0) {
+        clock_gettime(clock, &ts);
+    }
+    return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+}
+
+struct Result
+{
+    double cpuPercent;
+    double usPerMessage;
+    double syscallsPerMessage;
+    double framesPerWrite; // frames gathered into each write on side A's link
+    uint64_t sent;
+    uint64_t delivered;
+};
+
+Result runOne(const Config& cfg, size_t channels, double seconds)
+{
+    std::vector<uint8_t> ids;
+    for (size_t i = 0; i < channels; ++i) {
+        ids.push_back(uint8_t(i));
+    }
+    test::MuxPair pair(ids, cfg.engine, cDefaultRingSize, {cfg.framing, Checksum::None});
+
+    std::thread threadA([&] { pair.a().io->run(); });
+    std::thread threadB([&] { pair.b().io->run(); });
+
+    std::string message(cfg.messageSize, 'm');
+    message.back() = '\n';
+    const uint64_t tickNs = 10 * 1000000ull;
+    const double perTick = cfg.ratePerChannel * (tickNs * 1e-9);
+
+    uint64_t syscallStart = pair.a().io->syscalls() + pair.b().io->syscalls();
+    double cpuStart = threadCpuSeconds(threadA.native_handle()) + threadCpuSeconds(threadB.native_handle());
+    uint64_t start = monotonicNs();
+    uint64_t end = start + uint64_t(seconds * 1e9);
+    uint64_t sent = 0;
+    uint64_t deliveredBytes = 0;
+    double owed = 0;
+    char buf[65536];
+
+    for (uint64_t next = start; next < end; next += tickNs) {
+        owed += perTick;
+        while (owed >= 1.0) {
+            for (size_t i = 0; i < channels; ++i) {
+                if (::write(pair.a().userFds[i], message.data(), message.size()) == ssize_t(message.size())) {
+                    sent++;
+                }
+            }
+            owed -= 1.0;
+        }
+        for (size_t i = 0; i < channels; ++i) {
+            ssize_t n;
+            while ((n = ::read(pair.b().userFds[i], buf, sizeof(buf))) > 0) {
+                deliveredBytes += uint64_t(n);
+            }
+        }
+        uint64_t now = monotonicNs();
+        if (next + tickNs > now) {
+            timespec ts{0, long(next + tickNs - now)};
+            nanosleep(&ts, nullptr);
+        }
+    }
+    double elapsed = (monotonicNs() - start) * 1e-9;
+    double cpu = threadCpuSeconds(threadA.native_handle()) + threadCpuSeconds(threadB.native_handle()) - cpuStart;
+    uint64_t syscalls = pair.a().io->syscalls() + pair.b().io->syscalls() - syscallStart;
+
+    // Let what is still in flight arrive (coalescing alone holds input for
+    // a while) before the engines stop; the numbers above are already taken.
+    uint64_t deadline = monotonicNs() + 5000000000ull;
+    while (deliveredBytes < sent * cfg.messageSize && monotonicNs() < deadline) {
+        for (size_t i = 0; i < channels; ++i) {
+            deliveredBytes += pair.b().drain(i).size();
+        }
+        timespec ts{0, 1000000};
+        nanosleep(&ts, nullptr);
+    }
+
+    pair.a().io->stop();
+    pair.b().io->stop();
+    threadA.join();
+    threadB.join();
+    const Link::Stats& linkStats = pair.a().mux->link().stats();
+
+    Result r;
+    r.cpuPercent = 100.0 * cpu / elapsed;
+    r.sent = sent;
+    r.delivered = deliveredBytes / cfg.messageSize;
+    r.usPerMessage = sent ? cpu * 1e6 / double(sent) : 0.0;
+    r.syscallsPerMessage = sent ? double(syscalls) / double(sent) : 0.0;
+    r.framesPerWrite = linkStats.batches ? double(linkStats.framesOut) / double(linkStats.batches) : 0.0;
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Config cfg;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            cfg.quick = true;
+        } else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (!IoEngine::parseKind(argv[++i], cfg.engine)) {
+                std::fprintf(stderr, "unknown engine %s\n", argv[i]);
+                return 2;
+            }
+        } else if (std::strcmp(argv[i], "--framing") == 0 && i + 1 < argc) {
+            cfg.framing = std::strcmp(argv[++i], "cobs") == 0 ? Framing::Cobs : Framing::Length;
+        } else if (std::strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            cfg.ratePerChannel = unsigned(std::atoi(argv[++i]));
+        } else {
+            std::fprintf(stderr, "usage: %s [--quick] [--engine NAME] [--framing length|cobs] [--rate N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<size_t> counts = cfg.quick ? std::vector<size_t>{1, 8, 32}
+                                           : std::vector<size_t>{1, 2, 4, 8, 16, 32, 64, 128};
+    double seconds = cfg.quick ? 0.2 : 2.0;
+
+    std::printf("engine=%s framing=%s rate=%u msg/s/channel size=%zu bytes, both mux threads summed\n",
+                IoEngine::kindName(IoEngine::create(cfg.engine)->kind()),
+                cfg.framing == Framing::Cobs ? "cobs" : "length", cfg.ratePerChannel, cfg.messageSize);
+    std::printf("%8s %10s %10s %8s %12s %12s %12s\n", "channels", "sent", "delivered", "cpu%", "cpu us/msg",
+                "syscalls/msg", "frames/write");
+    bool ok = true;
+    for (size_t channels : counts) {
+        Result r = runOne(cfg, channels, seconds);
+        std::printf("%8zu %10llu %10llu %8.2f %12.2f %12.2f %12.2f\n", channels, (unsigned long long)r.sent,
+                    (unsigned long long)r.delivered, r.cpuPercent, r.usPerMessage, r.syscallsPerMessage,
+                    r.framesPerWrite);
+        ok = ok && r.delivered == r.sent;
+    }
+    if (!ok) {
+        std::printf("FAIL: not every message was delivered\n");
+    }
+    return ok ? 0 : 1;
+}
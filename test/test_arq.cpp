@@ -0,0 +1,267 @@
+/*
+ * test_arq.cpp
+ *
+ * Selective-repeat windows, acknowledgements and retransmit timers, driven
+ * with a fake clock.
+ */
+#include "Arq.h"
+#include "TestUtil.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t cMs = 1000000;
+
+struct Delivered
+{
+    uint8_t channel;
+    std::string data;
+};
+
+struct Receiver
+{
+    Receiver()
+        : deliver([this](uint8_t channel, const uint8_t* data, size_t len, bool) {
+            frames.push_back({channel, std::string(reinterpret_cast<const char*>(data), len)});
+        })
+    {
+    }
+
+    Arq arq;
+    Arq::Deliver deliver;
+    std::vector<Delivered> frames;
+};
+
+/// Queue a one-byte frame holding its index and mark it written at nowNs.
+uint8_t send(Arq& arq, uint8_t channel, char tag, uint64_t nowNs, uint8_t path = 0)
+{
+    uint8_t seq = arq.queue(channel, reinterpret_cast<const uint8_t*>(&tag), 1);
+    arq.sent(seq, nowNs, path);
+    return seq;
+}
+
+/// Hand the stored frame seq from sender to receiver.
+void transfer(Arq& from, uint8_t seq, Receiver& to)
+{
+    to.arq.onData(seq, from.channel(seq), from.data(seq), from.size(seq), from.more(seq), to.deliver);
+}
+
+/// Pass the receiver's acknowledgement back to the sender.
+void acknowledge(Receiver& from, Arq& to, uint64_t nowNs)
+{
+    uint8_t sack[Arq::cMaxSackSize];
+    size_t len = from.arq.encodeSack(sack);
+    to.onAck(from.arq.ackNumber(), sack, len, nowNs);
+}
+
+void testInOrder()
+{
+    Arq tx(4);
+    Receiver rx;
+    for (char c : std::string("abcd")) {
+        transfer(tx, send(tx, 7, c, 0), rx);
+    }
+    CHECK(tx.windowFull());
+    CHECK_EQ(rx.frames.size(), 4u);
+    if (rx.frames.size() == 4) {
+        CHECK(rx.frames[0].channel == 7 && rx.frames[0].data == "a");
+        CHECK(rx.frames[3].data == "d");
+    }
+    CHECK(rx.arq.ackPending());
+    CHECK(!rx.arq.haveGap());
+    acknowledge(rx, tx, 10 * cMs);
+    CHECK(!rx.arq.ackPending());
+    CHECK_EQ(tx.inFlight(), 0u);
+    CHECK_EQ(tx.stats().rttNs, 10 * cMs);
+    CHECK_EQ(tx.nextTimeout(), UINT64_MAX);
+}
+
+void testSelectiveRepeat()
+{
+    Arq tx;
+    Receiver rx;
+    uint8_t seqs[5];
+    for (int i = 0; i < 5; ++i) {
+        seqs[i] = send(tx, 1, char('0' + i), 0);
+    }
+    // Frame 1 is lost on the line.
+    for (int i : {0, 2, 3, 4}) {
+        transfer(tx, seqs[i], rx);
+    }
+    CHECK_EQ(rx.frames.size(), 1u);
+    CHECK(rx.arq.haveGap());
+    CHECK_EQ(rx.arq.stats().outOfOrder, 3u);
+
+    // The bitmap tells the sender which got through, so only frame 1 goes
+    // again, and without waiting for its timer.
+    acknowledge(rx, tx, 5 * cMs);
+    CHECK_EQ(tx.inFlight(), 4u);
+    CHECK_EQ(tx.stats().fastRetransmits, 1u);
+    CHECK_EQ(tx.nextTimeout(), 0u);
+    uint8_t resend[Arq::cMaxWindow];
+    size_t count = tx.takeResends(5 * cMs, resend, Arq::cMaxWindow);
+    CHECK_EQ(count, 1u);
+    CHECK_EQ(resend[0], seqs[1]);
+    tx.sent(resend[0], 6 * cMs);
+
+    transfer(tx, seqs[1], rx);
+    CHECK_EQ(rx.frames.size(), 5u);
+    std::string order;
+    for (const Delivered& d : rx.frames) {
+        order += d.data;
+    }
+    CHECK(order == "01234");
+    CHECK(!rx.arq.haveGap());
+    acknowledge(rx, tx, 7 * cMs);
+    CHECK_EQ(tx.inFlight(), 0u);
+    CHECK_EQ(tx.stats().retransmits, 1u);
+}
+
+void testPaths()
+{
+    // Frames striped over a slow path 0 and a fast path 1.
+    Arq tx;
+    Receiver rx;
+    uint8_t slow = send(tx, 1, 'a', 0, 0);
+    uint8_t fast = send(tx, 1, 'b', 0, 1);
+    uint8_t slowNext = send(tx, 1, 'c', 0, 0);
+    transfer(tx, fast, rx);
+    CHECK(rx.frames.empty());
+
+    // Overtaken on the other path is not lost.
+    acknowledge(rx, tx, 2 * cMs);
+    CHECK_EQ(tx.stats().fastRetransmits, 0u);
+    CHECK(tx.nextTimeout() > 2 * cMs);
+
+    // Overtaken on its own path is.
+    transfer(tx, slowNext, rx);
+    acknowledge(rx, tx, 3 * cMs);
+    CHECK_EQ(tx.stats().fastRetransmits, 1u);
+    uint8_t resend[Arq::cMaxWindow];
+    CHECK_EQ(tx.takeResends(3 * cMs, resend, Arq::cMaxWindow), 1u);
+    CHECK_EQ(resend[0], slow);
+    tx.sent(slow, 3 * cMs, 1);
+    transfer(tx, slow, rx);
+    std::string order;
+    for (const Delivered& d : rx.frames) {
+        order += d.data;
+    }
+    CHECK(order == "abc");
+}
+
+void testTimeout()
+{
+    Arq tx;
+    Receiver rx;
+    uint8_t seq = send(tx, 3, 'x', 0);
+    uint64_t rto = tx.stats().rtoNs;
+    CHECK_EQ(tx.nextTimeout(), rto);
+    uint8_t resend[Arq::cMaxWindow];
+    CHECK_EQ(tx.takeResends(rto - 1, resend, Arq::cMaxWindow), 0u);
+    CHECK_EQ(tx.takeResends(rto, resend, Arq::cMaxWindow), 1u);
+    CHECK_EQ(tx.stats().timeouts, 1u);
+    CHECK_EQ(tx.stats().rtoNs, 2 * rto);
+    // Not due again until it has been written once more.
+    CHECK_EQ(tx.nextTimeout(), UINT64_MAX);
+    tx.sent(seq, rto);
+
+    // The first copy did arrive after all; the resend is a duplicate, and
+    // the late ack must not count as a round-trip sample.
+    transfer(tx, seq, rx);
+    transfer(tx, seq, rx);
+    CHECK_EQ(rx.frames.size(), 1u);
+    CHECK_EQ(rx.arq.stats().duplicates, 1u);
+    acknowledge(rx, tx, rto + cMs);
+    CHECK_EQ(tx.inFlight(), 0u);
+    CHECK_EQ(tx.stats().rttNs, 0u);
+
+    // A stale or garbled ack number is ignored.
+    tx.onAck(uint8_t(seq + 100), nullptr, 0, rto + 2 * cMs);
+    CHECK_EQ(tx.inFlight(), 0u);
+}
+
+void testHeldWrite()
+{
+    // Frame 0 times out on path 0, and its resend goes into a batch there
+    // whose write takes a while. The first copy arrives after all, and path
+    // 1 carries the next 127 frames while the write is still going on.
+    Arq tx(Arq::cMaxWindow);
+    Receiver rx;
+    uint8_t first = send(tx, 1, 'a', 0, 0);
+    uint64_t now = tx.stats().rtoNs;
+    uint8_t resend[Arq::cMaxWindow];
+    CHECK_EQ(tx.takeResends(now, resend, Arq::cMaxWindow), 1u);
+    CHECK_EQ(resend[0], first);
+    transfer(tx, first, rx);
+    acknowledge(rx, tx, now);
+    for (int i = 1; i < int(Arq::cMaxWindow); ++i) {
+        transfer(tx, send(tx, 1, char('a' + i % 26), now, 1), rx);
+    }
+    acknowledge(rx, tx, now + cMs);
+    CHECK_EQ(tx.inFlight(), 0u);
+
+    // The window has moved all the way on, but frame 128 would take the
+    // slot the batch is still reading frame 0 from.
+    CHECK(tx.windowFull());
+    tx.sent(first, now + 2 * cMs, 0);
+    CHECK(!tx.windowFull());
+
+    // The late write neither started a timer nor touched what is next.
+    CHECK_EQ(tx.nextTimeout(), UINT64_MAX);
+    uint8_t next = send(tx, 1, 'z', now + 3 * cMs, 1);
+    CHECK_EQ(next, uint8_t(Arq::cMaxWindow));
+    transfer(tx, next, rx);
+    CHECK(rx.frames.size() == Arq::cMaxWindow + 1 && rx.frames.back().data == "z");
+    CHECK_EQ(tx.nextTimeout(), now + 3 * cMs + tx.stats().rtoNs);
+}
+
+void testWrapAround()
+{
+    // Several trips round the 8-bit sequence space, losing every 7th frame.
+    Arq tx(8);
+    Receiver rx;
+    std::string expected;
+    uint64_t now = 0;
+    size_t next = 0;
+    while (rx.frames.size() < 600) {
+        uint8_t resend[Arq::cMaxWindow];
+        size_t count = tx.takeResends(now, resend, Arq::cMaxWindow);
+        for (size_t i = 0; i < count; ++i) {
+            tx.sent(resend[i], now);
+            transfer(tx, resend[i], rx);
+        }
+        while (!tx.windowFull() && next < 600) {
+            char tag = char('a' + next % 26);
+            expected += tag;
+            uint8_t seq = send(tx, 0, tag, now);
+            if (++next % 7 != 0) {
+                transfer(tx, seq, rx);
+            }
+        }
+        now += cMs;
+        acknowledge(rx, tx, now);
+    }
+    std::string got;
+    for (const Delivered& d : rx.frames) {
+        got += d.data;
+    }
+    CHECK(got == expected);
+    CHECK_EQ(tx.stats().framesSent, 600u);
+    CHECK(tx.stats().retransmits >= 600 / 7);
+    CHECK_EQ(rx.arq.stats().duplicates, 0u);
+}
+
+} // namespace
+
+int main()
+{
+    testInOrder();
+    testSelectiveRepeat();
+    testPaths();
+    testTimeout();
+    testHeldWrite();
+    testWrapAround();
+    return test::summary("test_arq");
+}
@@ -0,0 +1,153 @@
+/*
+ * test_cobs.cpp
+ *
+ * COBS encoding, streaming decoding and the zero-byte scan under them.
+ */
+#include "Cobs.h"
+#include "TestUtil.h"
+
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+Bytes encode(const Bytes& in)
+{
+    Bytes out(cobsMaxEncodedSize(in.size()));
+    out.resize(cobsEncode(in.data(), in.size(), out.data()));
+    return out;
+}
+
+/// Decode a stream fed chunk bytes at a time; returns the valid frames.
+std::vector<Bytes> decodeStream(const Bytes& stream, size_t chunk, size_t* bad = nullptr)
+{
+    CobsDecoder decoder(2048);
+    std::vector<Bytes> frames;
+    size_t pos = 0;
+    while (pos < stream.size()) {
+        size_t n = std::min(chunk, stream.size() - pos);
+        while (n > 0) {
+            bool frameEnd;
+            size_t used = decoder.decode(stream.data() + pos, n, frameEnd);
+            pos += used;
+            n -= used;
+            if (frameEnd && decoder.valid() && decoder.size() > 0) {
+                frames.emplace_back(decoder.frame(), decoder.frame() + decoder.size());
+            } else if (frameEnd && !decoder.valid() && bad) {
+                (*bad)++;
+            }
+        }
+    }
+    return frames;
+}
+
+void testFindZeroByte()
+{
+    uint8_t buf[64];
+    for (size_t len = 0; len <= 40; ++len) {
+        for (size_t offset = 0; offset < 8; ++offset) {
+            std::fill(buf, buf + sizeof(buf), 0x01);
+            CHECK_EQ(findZeroByte(buf + offset, len), len);
+            for (size_t z = 0; z < len; ++z) {
+                buf[offset + z] = 0;
+                // A 0x01 above a zero must not be reported.
+                CHECK_EQ(findZeroByte(buf + offset, len), z);
+                buf[offset + z] = 0x01;
+            }
+        }
+    }
+}
+
+void testKnownEncodings()
+{
+    CHECK(encode({}) == Bytes({1}));
+    CHECK(encode({0}) == Bytes({1, 1}));
+    CHECK(encode({0, 0}) == Bytes({1, 1, 1}));
+    CHECK(encode({0x11, 0x22, 0, 0x33}) == Bytes({3, 0x11, 0x22, 2, 0x33}));
+    CHECK(encode({0x11, 0x22, 0x33, 0x44}) == Bytes({5, 0x11, 0x22, 0x33, 0x44}));
+
+    Bytes run254(254, 0xaa);
+    Bytes expected{0xff};
+    expected.insert(expected.end(), run254.begin(), run254.end());
+    CHECK(encode(run254) == expected);
+
+    Bytes run255(255, 0xaa);
+    expected.push_back(2);
+    expected.push_back(0xaa);
+    CHECK(encode(run255) == expected);
+}
+
+void testRoundTrip()
+{
+    std::srand(7);
+    std::vector<Bytes> inputs = {{}, {0}, {0, 0, 0}, Bytes(253, 1), Bytes(254, 1), Bytes(255, 1),
+                                 Bytes(1027, 0)};
+    for (int i = 0; i < 200; ++i) {
+        Bytes in(size_t(std::rand() % 1100));
+        for (uint8_t& b : in) {
+            // Mostly non-zero so long groups occur too.
+            b = std::rand() % 8 == 0 ? 0 : uint8_t(std::rand());
+        }
+        inputs.push_back(in);
+    }
+
+    Bytes stream;
+    std::vector<Bytes> expected;
+    for (const Bytes& in : inputs) {
+        Bytes enc = encode(in);
+        CHECK(enc.size() <= cobsMaxEncodedSize(in.size()));
+        CHECK_EQ(findZeroByte(enc.data(), enc.size()), enc.size());
+        stream.insert(stream.end(), enc.begin(), enc.end());
+        stream.push_back(0);
+        if (!in.empty()) {
+            expected.push_back(in);
+        }
+    }
+    for (size_t chunk : {size_t(1), size_t(7), size_t(4096), stream.size()}) {
+        CHECK(decodeStream(stream, chunk) == expected);
+    }
+}
+
+void testResync()
+{
+    Bytes a(100, 'a'), b(300, 'b'), c(50, 'c');
+    Bytes stream;
+    for (const Bytes* f : {&a, &b, &c}) {
+        Bytes enc = encode(*f);
+        stream.insert(stream.end(), enc.begin(), enc.end());
+        stream.push_back(0);
+    }
+    // Lose a byte in the middle of the second frame: only it is affected.
+    Bytes damaged = stream;
+    damaged.erase(damaged.begin() + 200);
+    size_t bad = 0;
+    std::vector<Bytes> frames = decodeStream(damaged, 16, &bad);
+    CHECK_EQ(frames.size(), 2u);
+    if (frames.size() == 2) {
+        CHECK(frames[0] == a);
+        CHECK(frames[1] == c);
+    }
+    CHECK_EQ(bad, 1u);
+
+    // Frames larger than the decoder's capacity are discarded.
+    CobsDecoder small(10);
+    Bytes enc = encode(Bytes(20, 'x'));
+    enc.push_back(0);
+    bool frameEnd = false;
+    CHECK_EQ(small.decode(enc.data(), enc.size(), frameEnd), enc.size());
+    CHECK(frameEnd);
+    CHECK(!small.valid());
+}
+
+} // namespace
+
+int main()
+{
+    testFindZeroByte();
+    testKnownEncodings();
+    testRoundTrip();
+    testResync();
+    return test::summary("test_cobs");
+}
@@ -0,0 +1,73 @@
+/*
+ * test_crc.cpp
+ *
+ * Frame checksums against their published check values.
+ */
+#include "Crc.h"
+#include "TestUtil.h"
+
+#include <vector>
+
+namespace {
+
+const uint8_t cCheckInput[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+
+/// Bit-at-a-time CRC-32C to compare the fast versions against.
+uint32_t crc32cReference(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+void testCheckValues()
+{
+    CHECK_EQ(crc16(cCheckInput, sizeof(cCheckInput)), 0x4b37);
+    CHECK_EQ(crc32c(cCheckInput, sizeof(cCheckInput)), 0xe3069283u);
+    CHECK_EQ(crc32cPortable(cCheckInput, sizeof(cCheckInput)), 0xe3069283u);
+    CHECK_EQ(crc32c(nullptr, 0), 0u);
+}
+
+void testIncremental()
+{
+    // Every split point, so each length of the byte-at-a-time tail is hit.
+    for (size_t split = 0; split <= sizeof(cCheckInput); ++split) {
+        size_t rest = sizeof(cCheckInput) - split;
+        CHECK_EQ(crc16(cCheckInput + split, rest, crc16(cCheckInput, split)), 0x4b37);
+        CHECK_EQ(crc32c(cCheckInput + split, rest, crc32c(cCheckInput, split)), 0xe3069283u);
+    }
+}
+
+void testImplementationsAgree()
+{
+    std::vector<uint8_t> data(1031);
+    uint32_t seed = 1;
+    for (uint8_t& byte : data) {
+        seed = seed * 1103515245 + 12345;
+        byte = uint8_t(seed >> 16);
+    }
+    // Odd offsets and lengths cover unaligned starts and short tails.
+    for (size_t offset = 0; offset < 9; ++offset) {
+        for (size_t len : {size_t(0), size_t(1), size_t(7), size_t(8), size_t(63), size_t(1022)}) {
+            uint32_t expected = crc32cReference(data.data() + offset, len);
+            CHECK_EQ(crc32c(data.data() + offset, len), expected);
+            CHECK_EQ(crc32cPortable(data.data() + offset, len), expected);
+        }
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::printf("crc32c implementation: %s\n", crc32cImplementation());
+    testCheckValues();
+    testIncremental();
+    testImplementationsAgree();
+    return test::summary("test_crc");
+}
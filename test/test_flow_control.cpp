@@ -0,0 +1,98 @@
+/*
+ * test_flow_control.cpp
+ *
+ * Credit accounting of the per-channel flow control, both directions.
+ */
+#include "FlowControl.h"
+#include "TestUtil.h"
+
+#include <cstdint>
+
+namespace {
+
+void testCredit()
+{
+    FlowControl sender(4096);
+    FlowControl receiver(4096);
+    CHECK_EQ(sender.credit(3), size_t(0));
+
+    // Nothing waiting: the whole window.
+    uint32_t limit = receiver.limit(3, 0);
+    receiver.advertised(3, limit);
+    sender.setLimit(3, limit);
+    CHECK_EQ(sender.credit(3), size_t(4096));
+
+    sender.sent(3, 3000);
+    receiver.received(3, 3000);
+    CHECK_EQ(sender.credit(3), size_t(1096));
+    CHECK_EQ(sender.credit(4), size_t(0));
+
+    // Still buffered: no more credit to give.
+    CHECK(!receiver.updateDue(3, 3000));
+    CHECK_EQ(receiver.limit(3, 3000), limit);
+    // Written to the virtual port: worth telling once a quarter window moved.
+    CHECK(!receiver.updateDue(3, 2100));
+    CHECK(receiver.updateDue(3, 1900));
+    sender.setLimit(3, receiver.limit(3, 1900));
+    CHECK_EQ(sender.credit(3), size_t(2196));
+}
+
+void testWrap()
+{
+    FlowControl sender(8192);
+    sender.sent(1, 0xfffff000u);
+    sender.setLimit(1, 0xfffff000u + 8192);
+    CHECK_EQ(sender.credit(1), size_t(8192));
+    sender.sent(1, 8000);
+    CHECK_EQ(sender.credit(1), size_t(192));
+
+    // A limit behind what was sent is no credit rather than 4 GB of it.
+    sender.setLimit(1, 100);
+    CHECK_EQ(sender.credit(1), size_t(0));
+}
+
+void testResync()
+{
+    FlowControl receiver(4096);
+    receiver.received(5, 1000);
+    receiver.advertised(5, receiver.limit(5, 0));
+    // The peer sent 1500: 500 were lost on the way and will never be written.
+    receiver.resync(5, 1500);
+    CHECK_EQ(receiver.limit(5, 0), uint32_t(1500 + 4096));
+}
+
+void testProbes()
+{
+    FlowControl sender;
+    CHECK(!sender.stalled(2));
+    CHECK(!sender.probeDue(2, 1000));
+    sender.stall(2, 1000);
+    CHECK(sender.stalled(2));
+    CHECK(!sender.probeDue(2, 1000));
+    uint64_t due = 1000 + FlowControl::cProbeIntervalNs;
+    sender.stall(2, 5000); // already stalled: keeps its schedule
+    CHECK_EQ(sender.probeAt(2), due);
+    CHECK(sender.probeDue(2, due));
+    CHECK(!sender.probeDue(2, due + 1));
+    CHECK_EQ(sender.probeAt(2), due + FlowControl::cProbeIntervalNs);
+    sender.unstall(2);
+    CHECK(!sender.stalled(2));
+}
+
+void testWindowClamp()
+{
+    CHECK_EQ(FlowControl(1).window(), FlowControl::cMinWindow);
+    CHECK_EQ(FlowControl(1 << 30).window(), FlowControl::cMaxWindow);
+}
+
+} // namespace
+
+int main()
+{
+    testCredit();
+    testWrap();
+    testResync();
+    testProbes();
+    testWindowClamp();
+    return test::summary("test_flow_control");
+}
@@ -0,0 +1,133 @@
+/*
+ * test_frame_queue.cpp
+ *
+ * Pool-backed output queues.
+ */
+#include "FramePool.h"
+#include "FrameQueue.h"
+#include "TestUtil.h"
+
+#include <string>
+
+namespace {
+
+const uint8_t* bytes(const std::string& s)
+{
+    return reinterpret_cast<const uint8_t*>(s.data());
+}
+
+std::string gather(const iovec* iov, int count)
+{
+    std::string out;
+    for (int i = 0; i < count; ++i) {
+        out.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    return out;
+}
+
+void testPacking()
+{
+    FramePool pool(4);
+    FrameQueue q;
+    // Small payloads share a buffer.
+    CHECK_EQ(q.append(pool, bytes("abc"), 3), 3u);
+    CHECK_EQ(q.append(pool, bytes("de"), 2), 2u);
+    CHECK_EQ(pool.available(), 3u);
+
+    std::string big(cMaxFrameSize + 10, 'x');
+    CHECK_EQ(q.append(pool, bytes(big), big.size()), big.size());
+    CHECK_EQ(pool.available(), 2u);
+    CHECK_EQ(q.size(), 5 + big.size());
+
+    iovec iov[4];
+    int count = q.beginWrite(iov, 4);
+    CHECK_EQ(count, 2);
+    CHECK(gather(iov, count) == "abcde" + big);
+    CHECK_EQ(q.beginWrite(iov, 4), 0);
+    q.endWrite(pool);
+    CHECK(q.empty());
+    CHECK_EQ(pool.available(), 4u);
+}
+
+void testAppendDuringWrite()
+{
+    FramePool pool(4);
+    FrameQueue q;
+    q.append(pool, bytes("one"), 3);
+    iovec iov[4];
+    CHECK_EQ(q.beginWrite(iov, 4), 1);
+    // Goes into the same buffer, after the bytes in flight.
+    q.append(pool, bytes("two"), 3);
+    CHECK(gather(iov, 1) == "one");
+    q.endWrite(pool);
+    CHECK_EQ(q.size(), 3u);
+    CHECK_EQ(pool.available(), 3u);
+    CHECK_EQ(q.beginWrite(iov, 4), 1);
+    CHECK(gather(iov, 1) == "two");
+    q.endWrite(pool);
+    CHECK_EQ(pool.available(), 4u);
+}
+
+void testExhaustion()
+{
+    FramePool pool(2);
+    FrameQueue q;
+    std::string big(3 * cMaxFrameSize, 'y');
+    CHECK_EQ(q.append(pool, bytes(big), big.size()), 2 * cMaxFrameSize);
+    CHECK_EQ(pool.available(), 0u);
+    CHECK_EQ(pool.stats().exhausted, 1u);
+    CHECK_EQ(pool.stats().lowestAvailable, 0u);
+
+    // Limited by maxIov.
+    iovec iov[1];
+    CHECK_EQ(q.beginWrite(iov, 1), 1);
+    q.endWrite(pool);
+    CHECK_EQ(q.size(), cMaxFrameSize);
+    CHECK_EQ(pool.available(), 1u);
+    q.clear(pool);
+    CHECK_EQ(pool.available(), 2u);
+}
+
+void testHold()
+{
+    FramePool pool(4);
+    FrameQueue q;
+    q.append(pool, bytes("ab"), 2);
+    std::string big(cMaxFrameSize, 'z');
+    q.append(pool, bytes(big), big.size(), true);
+    CHECK_EQ(q.held(), big.size());
+
+    // Only what is not held goes, even from the buffer it shares.
+    iovec iov[4];
+    CHECK_EQ(q.beginWrite(iov, 4), 1);
+    CHECK(gather(iov, 1) == "ab");
+    q.endWrite(pool);
+    CHECK_EQ(q.size(), big.size());
+    CHECK_EQ(q.beginWrite(iov, 4), 0);
+
+    // The end of the message lets all of it out in one write.
+    q.append(pool, bytes("!"), 1);
+    CHECK_EQ(q.held(), 0u);
+    int count = q.beginWrite(iov, 4);
+    CHECK_EQ(count, 2);
+    CHECK(gather(iov, count) == big + "!");
+    q.endWrite(pool);
+    CHECK(q.empty());
+
+    q.append(pool, bytes("cd"), 2, true);
+    q.commit();
+    CHECK_EQ(q.beginWrite(iov, 4), 1);
+    q.endWrite(pool);
+    CHECK_EQ(pool.available(), 4u);
+}
+
+} // namespace
+
+int main()
+{
+    testPacking();
+    testAppendDuringWrite();
+    testExhaustion();
+    testHold();
+    return test::summary("test_frame_queue");
+}
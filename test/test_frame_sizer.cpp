@@ -0,0 +1,87 @@
+/*
+ * test_frame_sizer.cpp
+ *
+ * Line rate measurement and the frame sizes picked from it.
+ */
+#include "FrameSizer.h"
+#include "TestUtil.h"
+
+#include <cstdint>
+
+namespace {
+
+constexpr uint64_t cMs = 1000000;
+
+void testFullSizeWhenQuiet()
+{
+    FrameSizer sizer(10 * 1000000000ull / 115200);
+    CHECK_EQ(sizer.bytesPerSec(), 11520u);
+    CHECK_EQ(sizer.frameSize(5 * cMs), cMaxDataSize);
+
+    // Top-priority traffic: frames take about cTargetDelayNs on the line...
+    sizer.urgent(10 * cMs);
+    CHECK_EQ(sizer.frameSize(10 * cMs), size_t(115));
+    CHECK_EQ(sizer.frameSize(10 * cMs + FrameSizer::cUrgentQuietNs - 1), size_t(115));
+    // ...until it has been quiet for a while.
+    CHECK_EQ(sizer.frameSize(10 * cMs + FrameSizer::cUrgentQuietNs), cMaxDataSize);
+}
+
+void testClamp()
+{
+    FrameSizer slow(10 * 1000000000ull / 1200);
+    slow.urgent(1);
+    CHECK_EQ(slow.frameSize(1), FrameSizer::cMinFrameData);
+    FrameSizer fast(10 * 1000000000ull / 4000000);
+    fast.urgent(1);
+    CHECK_EQ(fast.frameSize(1), cMaxDataSize);
+    // Nothing known about the line: no reason to cut.
+    FrameSizer unknown;
+    unknown.urgent(1);
+    CHECK_EQ(unknown.byteTimeNs(), 0u);
+    CHECK_EQ(unknown.frameSize(1), cMaxDataSize);
+}
+
+void testMeasuredRate()
+{
+    FrameSizer sizer;
+    // 2000 bytes queued; 50 ms and 1000 more bytes later 1000 are left, so
+    // the line carried 2000 bytes in 50 ms.
+    sizer.sample(100 * cMs, 2000, 2000);
+    sizer.sample(110 * cMs, 2500, 2000); // too soon to tell
+    CHECK_EQ(sizer.bytesPerSec(), 0u);
+    sizer.sample(150 * cMs, 3000, 1000);
+    CHECK_EQ(sizer.bytesPerSec(), 40000u);
+    CHECK_EQ(sizer.byteTimeNs(), 25000u);
+
+    // Later samples are averaged in.
+    sizer.sample(200 * cMs, 3000, 0); // ran dry: no sample
+    CHECK_EQ(sizer.bytesPerSec(), 40000u);
+    sizer.sample(300 * cMs, 4000, 1000);
+    sizer.sample(400 * cMs, 6000, 1000);
+    CHECK_EQ(sizer.bytesPerSec(), (3 * 40000u + 20000u) / 4);
+
+    sizer.urgent(400 * cMs);
+    CHECK_EQ(sizer.frameSize(400 * cMs), size_t(350));
+}
+
+void testStats()
+{
+    FrameSizer sizer;
+    sizer.picked(cMaxDataSize);
+    sizer.picked(200);
+    sizer.picked(100);
+    CHECK_EQ(sizer.stats().fullFrames, 1u);
+    CHECK_EQ(sizer.stats().smallFrames, 2u);
+    CHECK_EQ(sizer.stats().smallest, size_t(100));
+}
+
+} // namespace
+
+int main()
+{
+    testFullSizeWhenQuiet();
+    testClamp();
+    testMeasuredRate();
+    testStats();
+    return test::summary("test_frame_sizer");
+}
@@ -0,0 +1,550 @@
+/*
+ * test_link.cpp
+ *
+ * Frame encoding and decoding on the physical link.
+ */
+#include "Frame.h"
+#include "Link.h"
+#include "MuxHarness.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/uio.h>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+struct Received
+{
+    uint8_t channel;
+    std::string data;
+    size_t pieces;
+    bool complete;
+    bool more;
+};
+
+struct LinkFixture
+{
+    explicit LinkFixture(const LinkConfig& config = LinkConfig())
+    {
+        int fds[2];
+        test::makeSocketPair(fds);
+        link = std::make_unique<Link>(fds[0], config);
+        peer = fds[1];
+        link->setFrameHandler([this](uint8_t ch, const uint8_t* data, size_t len, bool frameEnd, bool more) {
+            if (frames.empty() || frames.back().complete) {
+                frames.push_back({ch, std::string(), 0, false, false});
+            }
+            Received& r = frames.back();
+            CHECK_EQ(r.channel, ch);
+            r.data.append(reinterpret_cast<const char*>(data), len);
+            r.pieces++;
+            r.complete = frameEnd;
+            r.more = more;
+        });
+        link->setControlHandler([this](uint8_t ch, const uint8_t* payload) {
+            controls.push_back({ch, payload[0], decodeControlValue(payload)});
+        });
+    }
+
+    ~LinkFixture() { ::close(peer); }
+
+    void feed(const uint8_t* data, size_t len) { link->receive(data, len); }
+
+    std::unique_ptr<Link> link;
+    int peer;
+    std::vector<Received> frames;
+    std::vector<std::tuple<uint8_t, uint8_t, uint32_t>> controls;
+};
+
+void testEncode()
+{
+    LinkFixture f;
+    const uint8_t abc[] = {'a', 'b', 'c'};
+    CHECK(f.link->addFrame(42, abc, 3));
+    CHECK(f.link->addFrame(1, nullptr, 0));
+    CHECK_EQ(f.link->batchFrames(), 2u);
+    CHECK_EQ(f.link->batchBytes(), 2 * cHeaderSize + 3);
+
+    // Header and payload are separate iovecs; an empty frame is just a header.
+    const iovec* iov = nullptr;
+    int count = 0;
+    CHECK(f.link->beginWrite(iov, count));
+    CHECK_EQ(count, 3);
+    CHECK(::writev(f.link->fd(), iov, count) == ssize_t(2 * cHeaderSize + 3));
+    uint8_t wire[16];
+    const uint8_t expected[] = {42, 0, 3, 'a', 'b', 'c', 1, 0, 0};
+    CHECK(::read(f.peer, wire, sizeof(wire)) == ssize_t(sizeof(expected)));
+    CHECK(std::memcmp(wire, expected, sizeof(expected)) == 0);
+
+    // Nothing can be added while the batch is in flight.
+    CHECK(!f.link->addFrame(2, abc, 1));
+    CHECK(!f.link->beginWrite(iov, count));
+    f.link->endWrite();
+    CHECK_EQ(f.link->batchFrames(), 0u);
+    CHECK(f.link->addFrame(2, abc, 1));
+    CHECK_EQ(f.link->stats().framesOut, 3u);
+    CHECK_EQ(f.link->stats().batches, 1u);
+}
+
+void testBatchLimit()
+{
+    LinkFixture f;
+    const uint8_t x = 'x';
+    for (size_t i = 0; i < Link::cMaxBatchFrames; ++i) {
+        CHECK(f.link->addFrame(uint8_t(i), &x, 1));
+    }
+    CHECK(!f.link->addFrame(0, &x, 1));
+    const iovec* iov = nullptr;
+    int count = 0;
+    CHECK(f.link->beginWrite(iov, count));
+    CHECK_EQ(count, int(2 * Link::cMaxBatchFrames));
+}
+
+void testMaxWrite(Framing framing)
+{
+    LinkConfig config;
+    config.framing = framing;
+    config.maxWrite = 1472;
+    LinkFixture f(config);
+    std::vector<uint8_t> data(cMaxDataSize, 'x');
+    // A full frame always goes, but leaves no room for another.
+    CHECK(f.link->addFrame(1, data.data(), data.size()));
+    CHECK(f.link->batchFull());
+    CHECK(!f.link->addFrame(2, data.data(), 1));
+    const iovec* iov = nullptr;
+    int count = 0;
+    CHECK(f.link->beginWrite(iov, count));
+    f.link->endWrite();
+
+    // Small frames fill up to the limit.
+    size_t frames = 0;
+    while (f.link->addFrame(1, data.data(), 100)) {
+        frames++;
+    }
+    CHECK(frames > 1);
+    CHECK(f.link->batchBytes() <= config.maxWrite);
+}
+
+void testDecodeSplitAcrossReads()
+{
+    LinkFixture f;
+    const uint8_t wire[] = {7, 0, 2, 'h', 'i', 8, 0, 0, 9, 0, 1, 'x'};
+    // Deliver one byte at a time: every header and payload is split.
+    for (uint8_t byte : wire) {
+        f.feed(&byte, 1);
+    }
+    CHECK_EQ(f.frames.size(), 3u);
+    if (f.frames.size() == 3) {
+        CHECK_EQ(f.frames[0].channel, 7);
+        CHECK(f.frames[0].data == "hi");
+        CHECK_EQ(f.frames[0].pieces, 2u);
+        CHECK_EQ(f.frames[1].channel, 8);
+        CHECK(f.frames[1].data.empty());
+        CHECK_EQ(f.frames[2].channel, 9);
+        CHECK(f.frames[2].data == "x");
+    }
+    CHECK_EQ(f.link->stats().framesIn, 3u);
+}
+
+void testDecodeInPlace()
+{
+    LinkFixture f;
+    const uint8_t wire[] = {3, 0, 4, 'a', 'b', 'c', 'd', 4, 0, 2, 'e', 'f'};
+    const uint8_t* payloads[2] = {};
+    size_t calls = 0;
+    f.link->setFrameHandler([&](uint8_t, const uint8_t* data, size_t, bool, bool) {
+        if (calls < 2) {
+            payloads[calls] = data;
+        }
+        calls++;
+    });
+    f.feed(wire, sizeof(wire));
+    // One call per frame, pointing into the caller's buffer.
+    CHECK_EQ(calls, 2u);
+    CHECK(payloads[0] == wire + 3);
+    CHECK(payloads[1] == wire + 10);
+}
+
+void testEverySplitPoint()
+{
+    const uint8_t wire[] = {3, 0, 4, 'a', 'b', 'c', 'd', 0xff, 0xff, 0x40, 0, 2, 'e', 'f'};
+    for (size_t split = 0; split <= sizeof(wire); ++split) {
+        LinkFixture f;
+        f.feed(wire, split);
+        f.feed(wire + split, sizeof(wire) - split);
+        CHECK_EQ(f.frames.size(), 2u);
+        if (f.frames.size() == 2) {
+            CHECK(f.frames[0].data == "abcd" && f.frames[0].complete);
+            CHECK(f.frames[1].data == "ef" && f.frames[1].complete);
+        }
+    }
+}
+
+void testBadLengthResync()
+{
+    LinkFixture f;
+    // 0xff 0xff is longer than cMaxDataSize, so the decoder has to hunt.
+    const uint8_t wire[] = {0xff, 0xff, 0xff, 5, 0, 1, 'z'};
+    f.feed(wire, sizeof(wire));
+    CHECK_EQ(f.frames.size(), 1u);
+    if (!f.frames.empty()) {
+        CHECK_EQ(f.frames[0].channel, 5);
+        CHECK(f.frames[0].data == "z");
+    }
+    CHECK(f.link->stats().badHeaders > 0);
+
+    // Same again with the garbage and the frame split across reads.
+    LinkFixture g;
+    for (uint8_t byte : wire) {
+        g.feed(&byte, 1);
+    }
+    CHECK_EQ(g.frames.size(), 1u);
+    if (!g.frames.empty()) {
+        CHECK_EQ(g.frames[0].channel, 5);
+        CHECK(g.frames[0].data == "z");
+    }
+    CHECK_EQ(g.link->stats().badHeaders, f.link->stats().badHeaders);
+}
+
+/// Encode frames with one link and return the bytes it wrote.
+std::vector<uint8_t> encodeWire(LinkFixture& tx, const std::vector<std::string>& payloads)
+{
+    for (size_t i = 0; i < payloads.size(); ++i) {
+        CHECK(tx.link->addFrame(uint8_t(i + 1), reinterpret_cast<const uint8_t*>(payloads[i].data()),
+                                payloads[i].size()));
+    }
+    const iovec* iov = nullptr;
+    int count = 0;
+    CHECK(tx.link->beginWrite(iov, count));
+    CHECK(::writev(tx.link->fd(), iov, count) > 0);
+    tx.link->endWrite();
+    std::vector<uint8_t> wire(65536);
+    ssize_t n = ::read(tx.peer, wire.data(), wire.size());
+    wire.resize(n > 0 ? size_t(n) : 0);
+    return wire;
+}
+
+void testCobsFraming()
+{
+    LinkFixture tx({Framing::Cobs});
+    std::string withZeros("a\0b\0\0c", 6);
+    std::vector<uint8_t> wire = encodeWire(tx, {"first", withZeros, std::string(1024, 'x'), ""});
+    // Leading delimiter plus one per frame, and none anywhere else.
+    CHECK_EQ(std::count(wire.begin(), wire.end(), 0), 5);
+
+    LinkFixture rx({Framing::Cobs});
+    for (uint8_t byte : wire) {
+        rx.feed(&byte, 1);
+    }
+    CHECK_EQ(rx.frames.size(), 4u);
+    if (rx.frames.size() == 4) {
+        CHECK(rx.frames[0].channel == 1 && rx.frames[0].data == "first");
+        CHECK(rx.frames[1].data == withZeros);
+        CHECK(rx.frames[2].data == std::string(1024, 'x'));
+        CHECK(rx.frames[3].channel == 4 && rx.frames[3].data.empty() && rx.frames[3].complete);
+    }
+}
+
+void testCobsResync()
+{
+    LinkFixture tx({Framing::Cobs});
+    std::vector<uint8_t> wire = encodeWire(tx, {"one", "two", "three"});
+    // Drop a byte from the middle of "two": only that frame is lost.
+    wire.erase(wire.begin() + 1 + 8 + 3);
+    LinkFixture rx({Framing::Cobs});
+    rx.feed(wire.data(), wire.size());
+    CHECK_EQ(rx.frames.size(), 2u);
+    if (rx.frames.size() == 2) {
+        CHECK(rx.frames[0].data == "one");
+        CHECK(rx.frames[1].data == "three");
+    }
+    CHECK_EQ(rx.link->stats().badFrames, 1u);
+}
+
+void testChecksum(const LinkConfig& config)
+{
+    LinkFixture tx(config);
+    std::vector<uint8_t> wire = encodeWire(tx, {"abc", "", std::string(1024, 'y')});
+    if (config.framing == Framing::Length) {
+        CHECK_EQ(tx.link->stats().bytesOut, uint64_t(wire.size()));
+    }
+
+    // Every split point: the trailer, or the payload before it, may arrive
+    // in a later read than the header.
+    for (size_t split = 0; split <= wire.size(); ++split) {
+        LinkFixture rx(config);
+        rx.feed(wire.data(), split);
+        rx.feed(wire.data() + split, wire.size() - split);
+        CHECK_EQ(rx.frames.size(), 3u);
+        if (rx.frames.size() == 3) {
+            CHECK(rx.frames[0].channel == 1 && rx.frames[0].data == "abc" && rx.frames[0].pieces == 1);
+            CHECK(rx.frames[1].channel == 2 && rx.frames[1].data.empty() && rx.frames[1].complete);
+            CHECK(rx.frames[2].data == std::string(1024, 'y') && rx.frames[2].pieces == 1);
+        }
+        CHECK_EQ(rx.link->stats().crcErrors, 0u);
+    }
+}
+
+void testChecksumDropsCorrupt(const LinkConfig& config)
+{
+    LinkFixture tx(config);
+    std::vector<uint8_t> wire = encodeWire(tx, {"one", "two", "three"});
+    // Flip a bit in the first payload byte of "two". In COBS mode the
+    // flipped byte must stay non-zero or it would split the frame instead.
+    size_t frameSize = cHeaderSize + 3 + trailerSize(config.checksum);
+    size_t at = config.framing == Framing::Cobs ? 1 + (frameSize + 2) + 1 + cHeaderSize : frameSize + cHeaderSize;
+    wire[at] ^= 0x01;
+    LinkFixture rx(config);
+    rx.feed(wire.data(), wire.size());
+    CHECK_EQ(rx.frames.size(), 2u);
+    if (rx.frames.size() == 2) {
+        CHECK(rx.frames[0].data == "one");
+        CHECK(rx.frames[1].data == "three");
+    }
+    CHECK_EQ(rx.link->stats().crcErrors, 1u);
+    CHECK_EQ(rx.link->stats().framesIn, 2u);
+}
+
+/// Write whatever the link has to send and return the bytes.
+std::vector<uint8_t> flushWire(LinkFixture& f)
+{
+    std::vector<uint8_t> wire;
+    const iovec* iov = nullptr;
+    int count = 0;
+    if (f.link->beginWrite(iov, count)) {
+        CHECK(::writev(f.link->fd(), iov, count) > 0);
+        f.link->endWrite();
+        wire.resize(65536);
+        ssize_t n = ::read(f.peer, wire.data(), wire.size());
+        wire.resize(n > 0 ? size_t(n) : 0);
+    }
+    return wire;
+}
+
+void testControlFrames(const LinkConfig& config)
+{
+    LinkFixture tx(config);
+    CHECK(tx.link->addFrame(1, reinterpret_cast<const uint8_t*>("ab"), 2));
+    CHECK(tx.link->addControl(7, cControlCredit, 0x01020304));
+    CHECK(tx.link->addFrame(2, reinterpret_cast<const uint8_t*>("cd"), 2));
+    std::vector<uint8_t> wire = flushWire(tx);
+
+    // Handed over whole, in order with the data, wherever the reads split.
+    for (size_t split = 0; split <= wire.size(); ++split) {
+        LinkFixture rx(config);
+        rx.feed(wire.data(), split);
+        rx.feed(wire.data() + split, wire.size() - split);
+        CHECK_EQ(rx.frames.size(), 2u);
+        CHECK_EQ(rx.controls.size(), 1u);
+        if (rx.frames.size() == 2 && rx.controls.size() == 1) {
+            CHECK(rx.frames[0].data == "ab" && rx.frames[1].data == "cd");
+            CHECK(rx.controls[0] == std::make_tuple(uint8_t(7), uint8_t(cControlCredit), uint32_t(0x01020304)));
+        }
+        CHECK_EQ(rx.link->stats().badHeaders + rx.link->stats().badFrames + rx.link->stats().crcErrors, 0u);
+    }
+}
+
+void testMoreFlag(const LinkConfig& config)
+{
+    LinkFixture tx(config);
+    const uint8_t* text = reinterpret_cast<const uint8_t*>("abcdef");
+    CHECK(tx.link->addFrame(3, text, 2, true));
+    CHECK(tx.link->addFrame(3, text + 2, 2));
+    CHECK(tx.link->addFrame(3, text + 4, 2, true));
+    CHECK(tx.link->addFrame(3, text, 0));
+    std::vector<uint8_t> wire = flushWire(tx);
+    if (config.framing == Framing::Length && !config.reliable) {
+        CHECK(wire.size() > 2 && wire[1] == 0x40 && wire[2] == 2);
+    }
+
+    LinkFixture rx(config);
+    rx.feed(wire.data(), wire.size());
+    CHECK_EQ(rx.frames.size(), 4u);
+    if (rx.frames.size() == 4) {
+        CHECK(rx.frames[0].data == "ab" && rx.frames[0].more);
+        CHECK(rx.frames[1].data == "cd" && !rx.frames[1].more);
+        CHECK(rx.frames[2].data == "ef" && rx.frames[2].more);
+        CHECK(rx.frames[3].data.empty() && !rx.frames[3].more);
+    }
+
+    // An empty frame with the flag is not a header.
+    const uint8_t bogus[] = {3, 0x40, 0};
+    LinkFixture bad;
+    bad.feed(bogus, sizeof(bogus));
+    CHECK(bad.frames.empty());
+    CHECK_EQ(bad.link->stats().badHeaders, 1u);
+}
+
+void testCompactHeaderEncoding()
+{
+    uint8_t header[cHeaderSize];
+    uint8_t compact[cMaxCompactHeaderSize];
+    uint8_t decoded[cHeaderSize];
+    auto roundTrip = [&](uint8_t channel, uint16_t numBytes) {
+        encodeHeader(header, channel, numBytes);
+        size_t size = encodeCompactHeader(compact, header);
+        CHECK_EQ(compactHeaderSize(compact[0]), size);
+        CHECK(decodeCompactHeader(compact, decoded));
+        CHECK(std::memcmp(decoded, header, cHeaderSize) == 0);
+        return size;
+    };
+    // A keystroke on a low channel fits in one byte with its header.
+    CHECK_EQ(roundTrip(3, 1), 1u);
+    CHECK_EQ(compact[0], 0x31);
+    CHECK_EQ(roundTrip(7, 15), 1u);
+    CHECK_EQ(roundTrip(0, 0), 1u);
+    CHECK_EQ(roundTrip(8, 1), 2u);
+    CHECK_EQ(roundTrip(3, 16), 3u);
+    CHECK_EQ(roundTrip(255, uint16_t(cMaxDataSize)), 3u);
+    CHECK_EQ(roundTrip(1, cMoreFlag | 4), 2u);
+    CHECK_EQ(roundTrip(1, cMoreFlag | 200), 3u);
+    CHECK_EQ(roundTrip(9, cControlFlag | cControlSize), 2u);
+    // Length bits in an extra byte that holds none.
+    const uint8_t bogus[] = {0x91, 5, 0};
+    CHECK(!decodeCompactHeader(bogus, decoded));
+}
+
+void testCompactHeader(LinkConfig config)
+{
+    config.header = HeaderFormat::Compact;
+    LinkFixture tx(config);
+    std::string big(cMaxDataSize, 'B');
+    const uint8_t key = 'k';
+    CHECK(tx.link->addFrame(2, &key, 1));
+    CHECK(tx.link->addFrame(40, &key, 1));
+    CHECK(tx.link->addFrame(5, nullptr, 0));
+    CHECK(tx.link->addControl(7, cControlProbe, 77));
+    CHECK(tx.link->addFrame(200, reinterpret_cast<const uint8_t*>(big.data()), big.size(), true));
+    CHECK(tx.link->addFrame(1, &key, 1));
+    std::vector<uint8_t> wire = flushWire(tx);
+    if (config.framing == Framing::Length && !config.reliable) {
+        // 6 frames: 1 + 2 + 1 + 2 + 3 + 1 header bytes instead of 18.
+        size_t payload = 1 + 1 + 0 + cControlSize + big.size() + 1;
+        CHECK_EQ(wire.size(), 10 + payload + 6 * trailerSize(config.checksum));
+    }
+
+    for (size_t split = 0; split <= wire.size(); split += config.reliable ? 7 : 1) {
+        LinkFixture rx(config);
+        rx.feed(wire.data(), split);
+        rx.feed(wire.data() + split, wire.size() - split);
+        CHECK_EQ(rx.frames.size(), 5u);
+        CHECK_EQ(rx.controls.size(), 1u);
+        if (rx.frames.size() == 5) {
+            CHECK(rx.frames[0].channel == 2 && rx.frames[0].data == "k");
+            CHECK(rx.frames[1].channel == 40 && rx.frames[1].data == "k");
+            CHECK(rx.frames[2].channel == 5 && rx.frames[2].data.empty());
+            CHECK(rx.frames[3].channel == 200 && rx.frames[3].data == big && rx.frames[3].more);
+            CHECK(rx.frames[4].channel == 1 && !rx.frames[4].more);
+        }
+        CHECK_EQ(rx.link->stats().badHeaders + rx.link->stats().badFrames + rx.link->stats().crcErrors, 0u);
+    }
+}
+
+void testCompactHeaderResync()
+{
+    LinkConfig config;
+    config.header = HeaderFormat::Compact;
+    LinkFixture tx(config);
+    const uint8_t text[] = {'a', 'b'};
+    CHECK(tx.link->addFrame(3, text, 2));
+    CHECK(tx.link->addFrame(4, text, 2));
+    std::vector<uint8_t> wire = flushWire(tx);
+    // A header with an impossible length in front. Past its first byte the
+    // rest is a whole 1-byte header and its payload, which have to go
+    // through the decoder again.
+    wire.insert(wire.begin(), {0x90, 0x31, 'x'});
+    LinkFixture rx(config);
+    rx.feed(wire.data(), wire.size());
+    CHECK_EQ(rx.link->stats().badHeaders, 1u);
+    CHECK_EQ(rx.frames.size(), 3u);
+    if (rx.frames.size() == 3) {
+        CHECK(rx.frames[0].channel == 3 && rx.frames[0].data == "x");
+        CHECK(rx.frames[1].channel == 3 && rx.frames[1].data == "ab");
+        CHECK(rx.frames[2].channel == 4 && rx.frames[2].data == "ab");
+    }
+}
+
+void testReliableResend()
+{
+    LinkConfig config;
+    config.checksum = Checksum::Crc16;
+    config.reliable = true;
+    LinkFixture a(config);
+    LinkFixture b(config);
+    for (const char* text : {"one", "two", "three"}) {
+        CHECK(a.link->addFrame(5, reinterpret_cast<const uint8_t*>(text), std::strlen(text)));
+    }
+    std::vector<uint8_t> wire = flushWire(a);
+    // Lose "two" entirely: ARQ header, channel header, payload and CRC.
+    size_t first = cMaxHeaderSize + 3 + 2;
+    wire.erase(wire.begin() + ptrdiff_t(first), wire.begin() + ptrdiff_t(2 * first));
+    b.feed(wire.data(), wire.size());
+    CHECK_EQ(b.frames.size(), 1u);
+
+    // b acknowledges "one" and, in the bitmap, "three"; a resends "two".
+    std::vector<uint8_t> ack = flushWire(b);
+    CHECK(!ack.empty() && ack[0] == cArqAck);
+    a.feed(ack.data(), ack.size());
+    CHECK_EQ(a.link->arq()->stats().fastRetransmits, 1u);
+    CHECK_EQ(a.link->nextTimeout(), 0u);
+    a.link->addResends();
+    CHECK_EQ(a.link->batchFrames(), 1u);
+    wire = flushWire(a);
+    b.feed(wire.data(), wire.size());
+    CHECK_EQ(b.frames.size(), 3u);
+    if (b.frames.size() == 3) {
+        CHECK(b.frames[1].channel == 5 && b.frames[1].data == "two");
+        CHECK(b.frames[2].data == "three");
+    }
+
+    ack = flushWire(b);
+    a.feed(ack.data(), ack.size());
+    CHECK_EQ(a.link->arq()->inFlight(), 0u);
+    // Nothing left to say in either direction.
+    CHECK(flushWire(a).empty());
+    CHECK(flushWire(b).empty());
+
+    // Reliable mode cannot work without detecting corrupt frames.
+    config.checksum = Checksum::None;
+    CHECK_THROWS(LinkFixture(config));
+}
+
+} // namespace
+
+int main()
+{
+    testEncode();
+    testBatchLimit();
+    testMaxWrite(Framing::Length);
+    testMaxWrite(Framing::Cobs);
+    testDecodeSplitAcrossReads();
+    testDecodeInPlace();
+    testEverySplitPoint();
+    testBadLengthResync();
+    testCobsFraming();
+    testCobsResync();
+    for (Framing framing : {Framing::Length, Framing::Cobs}) {
+        for (Checksum checksum : {Checksum::Crc16, Checksum::Crc32}) {
+            testChecksum({framing, checksum});
+            testChecksumDropsCorrupt({framing, checksum});
+        }
+    }
+    testControlFrames(LinkConfig());
+    testControlFrames({Framing::Length, Checksum::Crc16});
+    testControlFrames({Framing::Cobs});
+    testControlFrames({Framing::Cobs, Checksum::Crc32, true});
+    testMoreFlag(LinkConfig());
+    testMoreFlag({Framing::Cobs, Checksum::Crc16});
+    testMoreFlag({Framing::Length, Checksum::Crc32, true});
+    testCompactHeaderEncoding();
+    testCompactHeader(LinkConfig());
+    testCompactHeader({Framing::Length, Checksum::Crc16});
+    testCompactHeader({Framing::Cobs, Checksum::Crc32});
+    testCompactHeader({Framing::Cobs, Checksum::Crc16, true});
+    testCompactHeaderResync();
+    testReliableResend();
+    return test::summary("test_link");
+}
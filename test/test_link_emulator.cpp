@@ -0,0 +1,248 @@
+/*
+ * test_link_emulator.cpp
+ *
+ * The emulated serial line: pacing, delay and errors, and two Multiplexers
+ * in reliable mode getting data through a noisy one intact.
+ */
+#include "AllocCounter.h"
+#include "LinkEmulator.h"
+#include "MuxHarness.h"
+#include "TestUtil.h"
+
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+/// An emulator between the user ends a and b.
+struct Line
+{
+    explicit Line(const LinkEmulator::Config& config)
+    {
+        int x[2];
+        int y[2];
+        test::makeSocketPair(x);
+        test::makeSocketPair(y);
+        a = x[0];
+        b = y[0];
+        emulator = std::make_unique<LinkEmulator>(x[1], y[1], config);
+    }
+
+    ~Line()
+    {
+        emulator.reset();
+        ::close(a);
+        ::close(b);
+    }
+
+    int a;
+    int b;
+    std::unique_ptr<LinkEmulator> emulator;
+};
+
+/// Read from fd until want bytes or end of file, or timeoutMs of silence.
+std::string readSome(int fd, size_t want, int timeoutMs = 2000)
+{
+    std::string out;
+    char buf[4096];
+    pollfd pfd = {fd, POLLIN, 0};
+    while (out.size() < want && ::poll(&pfd, 1, timeoutMs) > 0) {
+        ssize_t n = ::read(fd, buf, std::min(sizeof(buf), want - out.size()));
+        if (n <= 0) {
+            break;
+        }
+        out.append(buf, size_t(n));
+    }
+    return out;
+}
+
+std::string pattern(size_t len)
+{
+    std::string text(len, '\0');
+    for (size_t i = 0; i < len; ++i) {
+        text[i] = char(i * 7 + i / 256);
+    }
+    return text;
+}
+
+void testPassThrough()
+{
+    Line line(LinkEmulator::Config{});
+    std::string text = pattern(50000);
+    CHECK(::write(line.a, text.data(), text.size()) == ssize_t(text.size()));
+    CHECK(readSome(line.b, text.size()) == text);
+
+    // The relay itself does not touch the heap.
+    char buf[256];
+    uint64_t before = heapAllocations();
+    for (int i = 0; i < 100; ++i) {
+        CHECK(::write(line.a, text.data(), sizeof(buf)) == ssize_t(sizeof(buf)));
+        size_t got = 0;
+        ssize_t n;
+        while (got < sizeof(buf) && (n = ::read(line.b, buf + got, sizeof(buf) - got)) > 0) {
+            got += size_t(n);
+        }
+    }
+    CHECK_EQ(heapAllocations() - before, uint64_t(0));
+    CHECK(::write(line.b, "back", 4) == 4);
+    CHECK(readSome(line.a, 4) == "back");
+
+    // End of file gets through.
+    ::shutdown(line.a, SHUT_WR);
+    char c;
+    pollfd pfd = {line.b, POLLIN, 0};
+    CHECK(::poll(&pfd, 1, 2000) == 1 && ::read(line.b, &c, 1) == 0);
+    line.emulator->stop();
+    CHECK_EQ(line.emulator->stats(true).bytesOut, uint64_t(text.size() + 100 * sizeof(buf)));
+    CHECK_EQ(line.emulator->stats(false).bytesOut, uint64_t(4));
+}
+
+void testBaudAndDelay()
+{
+    LinkEmulator::Config config;
+    config.baud = 100000; // 10 bytes per ms
+    config.delayNs = 30000000;
+    Line line(config);
+
+    uint64_t start = monotonicNs();
+    CHECK(::write(line.a, "x", 1) == 1);
+    CHECK(readSome(line.b, 1) == "x");
+    uint64_t took = monotonicNs() - start;
+    CHECK(took >= 30000000 && took < 200000000);
+
+    // 3000 bytes take 300 ms on the line, and the first of them comes in
+    // well before the last.
+    std::string text = pattern(3000);
+    start = monotonicNs();
+    CHECK(::write(line.a, text.data(), text.size()) == ssize_t(text.size()));
+    std::string first = readSome(line.b, 100);
+    uint64_t firstAt = monotonicNs() - start;
+    std::string rest = readSome(line.b, text.size() - first.size());
+    took = monotonicNs() - start;
+    CHECK(first + rest == text);
+    CHECK(firstAt < 150000000);
+    CHECK(took >= 300000000 && took < 1000000000);
+}
+
+void testDropsTakeLineTime()
+{
+    LinkEmulator::Config config;
+    config.baud = 100000;
+    config.dropRate = 0.5;
+    Line line(config);
+    std::string text = pattern(3000);
+    uint64_t start = monotonicNs();
+    CHECK(::write(line.a, text.data(), text.size()) == ssize_t(text.size()));
+    // About half arrives, but the last of it only once the whole 300 ms
+    // of line time have gone by.
+    size_t got = 0;
+    uint64_t lastAt = start;
+    char buf[4096];
+    pollfd pfd = {line.b, POLLIN, 0};
+    ssize_t n;
+    while (::poll(&pfd, 1, 200) > 0 && (n = ::read(line.b, buf, sizeof(buf))) > 0) {
+        got += size_t(n);
+        lastAt = monotonicNs();
+    }
+    CHECK(got > 1000 && got < 2000);
+    CHECK(lastAt - start >= 280000000);
+}
+
+void testJitterKeepsOrder()
+{
+    LinkEmulator::Config config;
+    config.jitterNs = 5000000;
+    Line line(config);
+    std::string sent;
+    for (int i = 0; i < 100; ++i) {
+        char c = char(i);
+        CHECK(::write(line.a, &c, 1) == 1);
+        sent += c;
+        ::usleep(200);
+    }
+    CHECK(readSome(line.b, sent.size()) == sent);
+}
+
+void testErrors()
+{
+    LinkEmulator::Config config;
+    config.bitErrorRate = 1e-3;
+    config.seed = 42;
+    std::string text = pattern(20000);
+    {
+        Line line(config);
+        CHECK(::write(line.a, text.data(), text.size()) == ssize_t(text.size()));
+        std::string got = readSome(line.b, text.size());
+        line.emulator->stop();
+        CHECK_EQ(got.size(), text.size());
+        uint64_t flipped = 0;
+        for (size_t i = 0; i < got.size() && i < text.size(); ++i) {
+            flipped += unsigned(__builtin_popcount(uint8_t(got[i] ^ text[i])));
+        }
+        CHECK_EQ(flipped, line.emulator->stats(true).bitsFlipped);
+        // About 160 expected.
+        CHECK(flipped > 80 && flipped < 320);
+    }
+
+    config.bitErrorRate = 0;
+    config.dropRate = 0.05;
+    Line line(config);
+    CHECK(::write(line.a, text.data(), text.size()) == ssize_t(text.size()));
+    std::string got = readSome(line.b, text.size(), 300);
+    line.emulator->stop();
+    const LinkEmulator::Stats& stats = line.emulator->stats(true);
+    CHECK_EQ(got.size() + stats.bytesDropped, text.size());
+    CHECK(stats.bytesDropped > 500 && stats.bytesDropped < 1500);
+}
+
+void testMuxOverNoisyLine(IoEngine::Kind kind)
+{
+    LinkEmulator::Config line;
+    line.baud = 1000000;
+    line.delayNs = 2000000;
+    line.jitterNs = 1000000;
+    // About a third of the 1 KB frames hit: some 25 errors in each
+    // direction, so frames are resent whatever the seed.
+    line.bitErrorRate = 2e-5;
+    line.dropRate = 2e-4;
+    ChannelSpec spec;
+    spec.id = 5;
+    LinkConfig config;
+    config.checksum = Checksum::Crc32;
+    config.reliable = true;
+    test::MuxPair::Options options;
+    options.emulation = line;
+    test::MuxPair pair({spec}, kind, config, options);
+
+    std::string text = pattern(30000);
+    std::string got;
+    size_t sent = 0;
+    CHECK(pair.pumpUntil([&] {
+        if (sent < text.size()) {
+            ssize_t n = ::write(pair.a().userFds[0], text.data() + sent, std::min<size_t>(4096, text.size() - sent));
+            if (n > 0) {
+                sent += size_t(n);
+            }
+        }
+        got += pair.b().drain(0);
+        return got.size() >= text.size();
+    }, 10000));
+    CHECK(got == text);
+    const Arq* arq = pair.a().mux->link().arq();
+    CHECK(arq && arq->stats().retransmits > 0);
+}
+
+} // namespace
+
+int main()
+{
+    testPassThrough();
+    testBaudAndDelay();
+    testDropsTakeLineTime();
+    testJitterKeepsOrder();
+    testErrors();
+    testMuxOverNoisyLine(IoEngine::Kind::Epoll);
+    testMuxOverNoisyLine(IoEngine::Kind::Uring);
+    return test::summary("test_link_emulator");
+}
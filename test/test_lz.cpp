@@ -0,0 +1,181 @@
+/*
+ * test_lz.cpp
+ *
+ * Streaming LZ compression of channel data.
+ */
+#include "Frame.h"
+#include "Lz.h"
+#include "TestUtil.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+/// Push text through an encoder/decoder pair in frames of at most cap
+/// bytes; returns the compressed size, or 0 if the output did not match.
+size_t roundTrip(LzEncoder& enc, LzDecoder& dec, const std::string& text, size_t cap = cMaxDataSize)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(text.data());
+    std::string out;
+    size_t packed = 0;
+    std::vector<uint8_t> frame(cap);
+    for (size_t done = 0; done < text.size();) {
+        size_t len;
+        size_t used = enc.compress(in + done, text.size() - done, frame.data(), cap, len);
+        CHECK(used > 0 && len <= cap);
+        if (used == 0) {
+            return 0;
+        }
+        const uint8_t* data;
+        size_t n;
+        CHECK(dec.decompress(frame.data(), len, data, n));
+        CHECK_EQ(n, used);
+        out.append(reinterpret_cast<const char*>(data), n);
+        done += used;
+        packed += len;
+    }
+    return out == text ? packed : 0;
+}
+
+std::string logLines(size_t count)
+{
+    std::string text;
+    char line[128];
+    for (size_t i = 0; i < count; ++i) {
+        std::snprintf(line, sizeof(line), "[%8zu.%03zu] sensor %zu: temperature %zu.%zu C, status OK\n", i * 7,
+                      i % 1000, i % 4, 20 + i % 7, i % 10);
+        text += line;
+    }
+    return text;
+}
+
+void testLogText()
+{
+    LzEncoder enc;
+    LzDecoder dec;
+    std::string text = logLines(5000);
+    size_t packed = roundTrip(enc, dec, text);
+    CHECK(packed > 0);
+    // Well past the 64 KB window, and most of each line is a repeat.
+    CHECK(text.size() > 3 * cLzWindow);
+    CHECK(packed * 4 < text.size());
+}
+
+void testHistoryAcrossFrames()
+{
+    // Short frames only shrink thanks to the ones before them.
+    LzEncoder enc;
+    LzDecoder dec;
+    std::string command = "get status --verbose --channel=3\n";
+    size_t first = roundTrip(enc, dec, command);
+    size_t again = roundTrip(enc, dec, command);
+    CHECK_EQ(first, command.size() + 2);
+    CHECK(again > 0 && again < 8);
+}
+
+/// A command and response session, as a shell on a channel would see it.
+std::string session(unsigned seed, size_t count)
+{
+    static const char* const commands[] = {"get status", "set led", "read sensor", "reset counters", "get version"};
+    static const char* const replies[] = {"OK", "ERROR busy", "ERROR bad argument"};
+    std::mt19937 rng(seed);
+    std::string text;
+    char line[160];
+    for (size_t i = 0; i < count; ++i) {
+        unsigned value = rng() % 10000;
+        std::snprintf(line, sizeof(line), "> %s --unit=%u --value=%u\n< %s (took %u us, seq %u)\n",
+                      commands[rng() % 5], value % 16, value, replies[rng() % 3], unsigned(rng() % 900), unsigned(rng() % 65536));
+        text += line;
+    }
+    return text;
+}
+
+void testDictionary()
+{
+    std::string capture = session(1, 4000);
+    const uint8_t* sample = reinterpret_cast<const uint8_t*>(capture.data());
+    std::vector<uint8_t> dictionary = trainLzDictionary(sample, capture.size(), 8 * 1024);
+    CHECK(!dictionary.empty() && dictionary.size() <= 8 * 1024);
+    CHECK(trainLzDictionary(sample, 1000, 8 * 1024) == std::vector<uint8_t>(sample, sample + 1000));
+    CHECK(trainLzDictionary(sample, capture.size(), 1 << 20).size() <= cLzWindow);
+
+    // A first exchange the history knows nothing about yet.
+    std::string exchange = session(2, 1);
+    LzEncoder plainEnc;
+    LzDecoder plainDec;
+    size_t plain = roundTrip(plainEnc, plainDec, exchange);
+    LzEncoder enc;
+    LzDecoder dec;
+    enc.prime(dictionary.data(), dictionary.size());
+    dec.prime(dictionary.data(), dictionary.size());
+    size_t primed = roundTrip(enc, dec, exchange);
+    CHECK(plain > exchange.size() / 2);
+    CHECK(primed > 0 && primed * 2 < plain);
+
+    // Only the last window of an oversized dictionary is kept, on both ends.
+    std::string big = logLines(2000);
+    const uint8_t* bigData = reinterpret_cast<const uint8_t*>(big.data());
+    CHECK(big.size() > cLzWindow);
+    LzEncoder bigEnc;
+    LzDecoder bigDec;
+    bigEnc.prime(bigData, big.size());
+    bigDec.prime(bigData, big.size());
+    CHECK(roundTrip(bigEnc, bigDec, logLines(3000)) > 0);
+}
+
+void testIncompressible()
+{
+    LzEncoder enc;
+    LzDecoder dec;
+    std::mt19937 rng(7);
+    std::string noise(100000, '\0');
+    for (char& c : noise) {
+        c = char(rng());
+    }
+    // Frames stay within their cap; random data costs a few bytes per frame.
+    size_t packed = roundTrip(enc, dec, noise);
+    CHECK(packed > 0 && packed < noise.size() + noise.size() / 100);
+    CHECK(roundTrip(enc, dec, noise, 64) > 0);
+    CHECK(roundTrip(enc, dec, logLines(200), 17) > 0);
+}
+
+void testMalformed()
+{
+    LzDecoder dec;
+    const uint8_t* data;
+    size_t n;
+    const uint8_t literalsCut[] = {0x30, 'a', 'b'};
+    CHECK(!dec.decompress(literalsCut, sizeof(literalsCut), data, n));
+    // A match reaching back before the start of the stream.
+    const uint8_t tooFar[] = {0x10, 'a', 5, 0};
+    CHECK(!dec.decompress(tooFar, sizeof(tooFar), data, n));
+    const uint8_t offsetCut[] = {0x10, 'a', 1};
+    CHECK(!dec.decompress(offsetCut, sizeof(offsetCut), data, n));
+    // Longer than one frame may stand for.
+    std::vector<uint8_t> tooLong = {0x1f, 'a', 1, 0};
+    tooLong.insert(tooLong.end(), cLzMaxInput / 255 + 1, 255);
+    tooLong.push_back(0);
+    CHECK(!dec.decompress(tooLong.data(), tooLong.size(), data, n));
+
+    // Failures leave the history alone.
+    const uint8_t run[] = {0x1f, 'a', 1, 0, 5};
+    CHECK(dec.decompress(run, sizeof(run), data, n));
+    CHECK_EQ(n, size_t(1 + 15 + 5 + cLzMinMatch));
+    CHECK(std::string(reinterpret_cast<const char*>(data), n) == std::string(n, 'a'));
+}
+
+} // namespace
+
+int main()
+{
+    testLogText();
+    testHistoryAcrossFrames();
+    testDictionary();
+    testIncompressible();
+    testMalformed();
+    return test::summary("test_lz");
+}
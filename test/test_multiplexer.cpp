@@ -0,0 +1,714 @@
+/*
+ * test_multiplexer.cpp
+ *
+ * End-to-end forwarding through two back-to-back multiplexers.
+ */
+#include "AllocCounter.h"
+#include "MuxHarness.h"
+#include "TestUtil.h"
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+void testRoundTrip(IoEngine::Kind kind)
+{
+    test::MuxPair pair({10, 20}, kind);
+    CHECK(pair.a().io->kind() == kind);
+
+    CHECK(pair.a().send(0, "hello"));
+    CHECK(pair.b().send(1, "world"));
+
+    std::string atB, atA;
+    bool done = pair.pumpUntil([&] {
+        atB += pair.b().drain(0);
+        atA += pair.a().drain(1);
+        return atB.size() >= 5 && atA.size() >= 5;
+    });
+    CHECK(done);
+    CHECK(atB == "hello");
+    CHECK(atA == "world");
+    // Nothing leaks onto the other channel.
+    CHECK(pair.b().drain(1).empty());
+    CHECK(pair.a().drain(0).empty());
+}
+
+void testBulkTransfer(IoEngine::Kind kind, size_t ringSize = cDefaultRingSize,
+                      const LinkConfig& config = LinkConfig())
+{
+    test::MuxPair pair({1, 2, 3}, kind, ringSize, config);
+    std::string payload;
+    for (size_t i = 0; i < 300000; ++i) {
+        payload.push_back(char('a' + i % 26));
+    }
+
+    size_t sent = 0;
+    std::string received;
+    bool done = pair.pumpUntil([&] {
+        if (sent < payload.size()) {
+            ssize_t n = ::write(pair.a().userFds[1], payload.data() + sent, payload.size() - sent);
+            if (n > 0) {
+                sent += size_t(n);
+            }
+        }
+        received += pair.b().drain(1);
+        return received.size() >= payload.size();
+    }, 10000);
+    CHECK(done);
+    CHECK(received == payload);
+    CHECK(pair.b().drain(0).empty());
+    CHECK(pair.b().drain(2).empty());
+    CHECK_EQ(pair.b().mux->link().stats().badHeaders, 0u);
+    CHECK_EQ(pair.b().mux->link().stats().badFrames, 0u);
+    CHECK_EQ(pair.b().mux->link().stats().crcErrors, 0u);
+    CHECK_EQ(pair.a().mux->stats().overrunBytes, 0u);
+}
+
+void testManyChannels()
+{
+    std::vector<uint8_t> ids;
+    for (unsigned i = 0; i < 40; ++i) {
+        ids.push_back(uint8_t(i * 6));
+    }
+    test::MuxPair pair(ids);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        CHECK(pair.a().send(i, "msg" + std::to_string(ids[i])));
+    }
+    std::vector<std::string> got(ids.size());
+    bool done = pair.pumpUntil([&] {
+        bool all = true;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            got[i] += pair.b().drain(i);
+            all = all && got[i].size() >= 3 + std::to_string(ids[i]).size();
+        }
+        return all;
+    });
+    CHECK(done);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        CHECK(got[i] == "msg" + std::to_string(ids[i]));
+    }
+}
+
+void testGatheredWrite()
+{
+    // Short commands arriving on 20 channels at once leave in one link write.
+    std::vector<uint8_t> ids;
+    for (unsigned i = 0; i < 20; ++i) {
+        ids.push_back(uint8_t(100 + i));
+    }
+    test::MuxPair pair(ids);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        CHECK(pair.a().send(i, "AT+" + std::to_string(i)));
+    }
+    std::vector<std::string> got(ids.size());
+    bool done = pair.pumpUntil([&] {
+        bool all = true;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            got[i] += pair.b().drain(i);
+            all = all && got[i] == "AT+" + std::to_string(i);
+        }
+        return all;
+    });
+    CHECK(done);
+    const Link::Stats& stats = pair.a().mux->link().stats();
+    CHECK_EQ(stats.framesOut, 20u);
+    CHECK_EQ(stats.batches, 1u);
+}
+
+void testPriority(IoEngine::Kind kind)
+{
+    ChannelSpec control;
+    control.id = 1;
+    control.priority = 0;
+    control.coalesceMs = 0;
+    ChannelSpec bulk;
+    bulk.id = 2;
+    bulk.priority = 7;
+    bulk.ringSize = 64 * 1024;
+    test::MuxPair pair({control, bulk}, kind);
+
+    // Side B is not reading, so A's link output backs up. The bulk channel
+    // may only keep about one frame queued in the kernel.
+    std::string payload(60000, 'b');
+    CHECK(pair.a().send(1, payload));
+    for (int i = 0; i < 50; ++i) {
+        pair.a().io->runOnce(0);
+    }
+    CHECK(pair.a().mux->link().stats().bytesOut <= 2 * cMaxFrameSize);
+
+    // A command now overtakes everything still waiting on the bulk channel.
+    CHECK(pair.a().send(0, "ctl"));
+    pair.a().io->runOnce(0);
+    std::string command;
+    std::string received;
+    bool done = pair.pumpUntil([&] {
+        command += pair.b().drain(0);
+        if (command.empty()) {
+            received += pair.b().drain(1);
+        }
+        return command == "ctl";
+    });
+    CHECK(done);
+    CHECK(received.size() <= 2 * cMaxDataSize);
+
+    done = pair.pumpUntil([&] {
+        received += pair.b().drain(1);
+        return received.size() >= payload.size();
+    }, 10000);
+    CHECK(done);
+    CHECK(received == payload);
+}
+
+void testAdaptiveFrameSize(IoEngine::Kind kind)
+{
+    ChannelSpec control;
+    control.id = 1;
+    control.priority = 0;
+    control.coalesceMs = 0;
+    ChannelSpec bulk;
+    bulk.id = 2;
+    bulk.priority = 7;
+    LinkConfig config;
+    config.baud = 115200;
+    test::MuxPair pair({control, bulk}, kind, config);
+
+    // Right after a command, bulk data goes in frames of about 10 ms at the
+    // configured rate, so the next command waits less.
+    CHECK(pair.a().send(0, "ctl"));
+    CHECK(pair.a().send(1, std::string(8000, 'b')));
+    std::string received;
+    CHECK(pair.pumpUntil([&] {
+        pair.b().drain(0);
+        received += pair.b().drain(1);
+        return received.size() >= 8000;
+    }));
+    const FrameSizer::Stats& sizes = pair.a().mux->frameSizer().stats();
+    CHECK(sizes.smallFrames > 0);
+    CHECK_EQ(sizes.fullFrames, 0u);
+    CHECK_EQ(sizes.smallest, size_t(115));
+    CHECK(pair.a().mux->link().stats().framesOut >= 8000 / 115);
+}
+
+void testWeightedShares(IoEngine::Kind kind)
+{
+    ChannelSpec light;
+    light.id = 1;
+    light.weight = 1;
+    light.ringSize = 64 * 1024;
+    ChannelSpec heavy = light;
+    heavy.id = 2;
+    heavy.weight = 3;
+    test::MuxPair::Options options;
+    options.policy = TxPolicy::Drr;
+    test::MuxPair pair({light, heavy}, kind, LinkConfig(), options);
+
+    // A narrow link that A fills faster than B drains it keeps both
+    // channels backlogged, so the link is shared by weight.
+    int sndbuf = 4096;
+    CHECK(::setsockopt(pair.a().mux->link().fd(), SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+    std::string chunk(16384, 'w');
+    size_t received[2] = {};
+    uint64_t deadline = monotonicNs() + 10000000000ull;
+    while (received[0] + received[1] < 300000 && monotonicNs() < deadline) {
+        for (size_t i = 0; i < 2; ++i) {
+            ssize_t n = ::write(pair.a().userFds[i], chunk.data(), chunk.size());
+            (void)n;
+        }
+        for (int i = 0; i < 16; ++i) {
+            pair.a().io->runOnce(0);
+        }
+        pair.b().io->runOnce(0);
+        for (size_t i = 0; i < 2; ++i) {
+            received[i] += pair.b().drain(i).size();
+        }
+    }
+    CHECK(received[0] + received[1] >= 300000);
+    double ratio = double(received[1]) / double(std::max<size_t>(received[0], 1));
+    CHECK(ratio > 2.5 && ratio < 3.5);
+    if (!(ratio > 2.5 && ratio < 3.5)) {
+        std::fprintf(stderr, "weighted shares: %zu vs %zu bytes\n", received[0], received[1]);
+    }
+}
+
+void testStalledReader(IoEngine::Kind kind, const LinkConfig& config)
+{
+    // Nobody reads channel 1 on B. With flow control only channel 1 stops;
+    // channel 2 keeps going.
+    ChannelSpec stalled;
+    stalled.id = 1;
+    ChannelSpec live;
+    live.id = 2;
+    constexpr size_t cWindow = 8 * 1024;
+    test::MuxPair::Options options;
+    options.creditWindow = cWindow;
+    test::MuxPair pair({stalled, live}, kind, config, options);
+    int sndbuf = 4096;
+    CHECK(::setsockopt(pair.b().mux->channel(1)->fd(), SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+
+    std::string flood(4096, 'f');
+    std::string payload;
+    for (size_t i = 0; i < 256 * 1024; ++i) {
+        payload.push_back(char('a' + i % 23));
+    }
+    std::string received;
+    size_t offset = 0;
+    bool done = pair.pumpUntil([&] {
+        ssize_t n = ::write(pair.a().userFds[0], flood.data(), flood.size());
+        (void)n;
+        if (offset < payload.size()) {
+            n = ::write(pair.a().userFds[1], payload.data() + offset, std::min<size_t>(4096, payload.size() - offset));
+            offset += n > 0 ? size_t(n) : 0;
+        }
+        received += pair.b().drain(1);
+        return received.size() >= payload.size();
+    }, 10000);
+    CHECK(done);
+    CHECK(received == payload);
+    CHECK(pair.a().mux->stats().creditStalls > 0);
+    CHECK(pair.b().mux->channel(1)->output().size() <= cWindow);
+    CHECK(pair.a().mux->channel(1)->input().readable() > 0);
+}
+
+void testMessages(IoEngine::Kind kind, const LinkConfig& config)
+{
+    // Channel 1 carries messages, channel 2 a stream sharing the link.
+    ChannelSpec messages;
+    messages.id = 1;
+    messages.maxMessage = 16 * 1024;
+    // Longer than the harness may take between two reads of one write.
+    messages.messageIdleMs = 50;
+    ChannelSpec stream;
+    stream.id = 2;
+    test::MuxPair pair({messages, stream}, kind, config);
+
+    for (size_t size : {size_t(10), size_t(10000), size_t(16 * 1024)}) {
+        std::string message;
+        for (size_t i = 0; i < size; ++i) {
+            message.push_back(char('a' + (i + size) % 26));
+        }
+        CHECK(pair.a().send(0, message));
+        CHECK(pair.a().send(1, std::string(3000, 's')));
+
+        // The first read sees all of it, although it crossed the link in
+        // frames interleaved with channel 2's.
+        std::string first;
+        bool done = pair.pumpUntil([&] {
+            pair.b().drain(1);
+            char buf[32 * 1024];
+            ssize_t n = ::read(pair.b().userFds[0], buf, sizeof(buf));
+            if (n > 0) {
+                first.assign(buf, size_t(n));
+            }
+            return n > 0;
+        });
+        CHECK(done);
+        CHECK_EQ(first.size(), message.size());
+        CHECK(first == message);
+    }
+    CHECK_EQ(pair.b().mux->stats().splitMessages, 0u);
+
+    // Too big to hold: written in pieces, but all of it.
+    std::string big(40 * 1024, 'B');
+    CHECK(pair.a().send(0, big));
+    std::string received;
+    CHECK(pair.pumpUntil([&] {
+        received += pair.b().drain(0);
+        return received.size() >= big.size();
+    }));
+    CHECK(received == big);
+}
+
+void testLines(IoEngine::Kind kind)
+{
+    ChannelSpec lines;
+    lines.id = 1;
+    lines.maxMessage = 4096;
+    lines.delimiter = '\n';
+    lines.messageIdleMs = 1;
+    test::MuxPair pair({lines}, kind);
+
+    auto readOnce = [&](std::string& into) {
+        char buf[4096];
+        ssize_t n = ::read(pair.b().userFds[0], buf, sizeof(buf));
+        if (n > 0) {
+            into.assign(buf, size_t(n));
+        }
+        return n > 0;
+    };
+
+    // Only the complete line comes out, however long the rest is idle.
+    CHECK(pair.a().send(0, "alpha\nbr"));
+    std::string first;
+    CHECK(pair.pumpUntil([&] { return readOnce(first); }));
+    CHECK(first == "alpha\n");
+    std::string early;
+    CHECK(!pair.pumpUntil([&] { return readOnce(early); }, 50));
+
+    CHECK(pair.a().send(0, "avo\n"));
+    std::string second;
+    CHECK(pair.pumpUntil([&] { return readOnce(second); }));
+    CHECK(second == "bravo\n");
+
+    // A line longer than a frame still arrives in one piece.
+    std::string line(3000, 'x');
+    line.back() = '\n';
+    for (size_t at = 0; at < line.size(); at += 500) {
+        CHECK(pair.a().send(0, line.substr(at, 500)));
+        pair.pump(0);
+    }
+    std::string third;
+    CHECK(pair.pumpUntil([&] { return readOnce(third); }));
+    CHECK(third == line);
+}
+
+void testCompression(IoEngine::Kind kind, size_t creditWindow)
+{
+    ChannelSpec logs;
+    logs.id = 1;
+    logs.compress = true;
+    ChannelSpec plain;
+    plain.id = 2;
+    LinkConfig reliable{Framing::Cobs, Checksum::Crc32, true};
+    test::MuxPair::Options options;
+    options.creditWindow = creditWindow;
+    test::MuxPair pair({logs, plain}, kind, reliable, options);
+
+    std::string text;
+    char line[96];
+    for (int i = 0; text.size() < 256 * 1024; ++i) {
+        std::snprintf(line, sizeof(line), "%06d kernel: eth0: link up, 100 Mbps, full duplex, lpa 0x%04x\n", i,
+                      i * 37 % 65536);
+        text += line;
+    }
+    std::string other(20000, 'o');
+    std::string atB, otherAtB;
+    size_t offset = 0;
+    CHECK(pair.a().send(1, other));
+    bool done = pair.pumpUntil([&] {
+        if (offset < text.size()) {
+            ssize_t n = ::write(pair.a().userFds[0], text.data() + offset, std::min<size_t>(8192, text.size() - offset));
+            offset += n > 0 ? size_t(n) : 0;
+        }
+        atB += pair.b().drain(0);
+        otherAtB += pair.b().drain(1);
+        return atB.size() >= text.size() && otherAtB.size() >= other.size();
+    }, 10000);
+    CHECK(done);
+    CHECK(atB == text);
+    CHECK(otherAtB == other);
+    const Multiplexer::Stats& stats = pair.a().mux->stats();
+    CHECK_EQ(stats.compressedIn, uint64_t(text.size()));
+    CHECK(stats.compressedOut * 3 < stats.compressedIn);
+    CHECK(pair.a().mux->link().stats().bytesOut < text.size() / 2 + other.size() * 2);
+    CHECK_EQ(pair.b().mux->stats().decompressErrors, 0u);
+
+    // Lost frames would leave the two histories apart.
+    CHECK_THROWS(test::MuxPair({logs}, kind));
+}
+
+void testDictionaryMismatch(IoEngine::Kind kind)
+{
+    std::string prefix = "/tmp/test_multiplexer." + std::to_string(::getpid());
+    std::string ours = prefix + ".ours.dict";
+    std::string theirs = prefix + ".theirs.dict";
+    std::ofstream(ours) << "kernel: eth0: link up, 100 Mbps, full duplex\n";
+    std::ofstream(theirs) << "sshd: session opened for user root\n";
+
+    // Channel 1 has other dictionaries at the two ends, channel 2 the same.
+    ChannelSpec mixed;
+    mixed.id = 1;
+    mixed.compress = true;
+    mixed.dictionary = ours;
+    ChannelSpec same = mixed;
+    same.id = 2;
+    test::MuxPair::Options options;
+    options.peerChannels = {mixed, same};
+    options.peerChannels[0].dictionary = theirs;
+    LinkConfig reliable{Framing::Cobs, Checksum::Crc32, true};
+    test::MuxPair pair({mixed, same}, kind, reliable, options);
+    ::unlink(ours.c_str());
+    ::unlink(theirs.c_str());
+
+    // Channel 2 is sent after channel 1, so once it is in, so is channel 1.
+    std::string text = "kernel: eth0: link up, 100 Mbps, full duplex\n";
+    auto exchange = [&] {
+        CHECK(pair.a().send(0, text) && pair.a().send(1, text));
+        CHECK(pair.b().send(0, text) && pair.b().send(1, text));
+        std::string atA, atB;
+        CHECK(pair.pumpUntil([&] {
+            atA += pair.a().drain(1);
+            atB += pair.b().drain(1);
+            return atA.size() >= text.size() && atB.size() >= text.size();
+        }));
+        CHECK(atA == text && atB == text);
+        CHECK(pair.a().drain(0).empty());
+        CHECK(pair.b().drain(0).empty());
+    };
+    exchange();
+    const Multiplexer::Stats& statsA = pair.a().mux->stats();
+    const Multiplexer::Stats& statsB = pair.b().mux->stats();
+    CHECK(statsA.decompressErrors >= 1 && statsB.decompressErrors >= 1);
+
+    // Later frames are refused too, though their own check is gone.
+    uint64_t errorsA = statsA.decompressErrors;
+    uint64_t errorsB = statsB.decompressErrors;
+    exchange();
+    CHECK(statsA.decompressErrors > errorsA && statsB.decompressErrors > errorsB);
+}
+
+void testBonding(IoEngine::Kind kind)
+{
+    ChannelSpec bulk;
+    bulk.id = 1;
+    ChannelSpec logs;
+    logs.id = 2;
+    logs.compress = true;
+    LinkConfig reliable{Framing::Cobs, Checksum::Crc32, true};
+    test::MuxPair::Options options;
+    options.creditWindow = 64 * 1024;
+    options.links = 2;
+    test::MuxPair pair({bulk, logs}, kind, reliable, options);
+    CHECK_EQ(pair.a().mux->linkCount(), 2u);
+
+    std::string payload, text;
+    for (size_t i = 0; i < 400000; ++i) {
+        payload.push_back(char('a' + i % 26));
+    }
+    for (int i = 0; text.size() < 100000; ++i) {
+        text += "line " + std::to_string(i) + " of the log\n";
+    }
+    size_t sent = 0, textSent = 0;
+    std::string received, textReceived;
+    auto transfer = [&](size_t until) {
+        return pair.pumpUntil([&] {
+            if (sent < until) {
+                ssize_t n = ::write(pair.a().userFds[0], payload.data() + sent, std::min<size_t>(8192, until - sent));
+                sent += n > 0 ? size_t(n) : 0;
+            }
+            if (textSent < text.size()) {
+                ssize_t n = ::write(pair.a().userFds[1], text.data() + textSent, std::min<size_t>(1000, text.size() - textSent));
+                textSent += n > 0 ? size_t(n) : 0;
+            }
+            received += pair.b().drain(0);
+            textReceived += pair.b().drain(1);
+            return received.size() >= until && textReceived.size() >= text.size();
+        }, 10000);
+    };
+    // With B not reading (once it has given credit), the first link's queue
+    // fills and the second one takes over.
+    for (int i = 0; i < 5; ++i) {
+        pair.pump(1);
+    }
+    sent = size_t(::write(pair.a().userFds[0], payload.data(), 32 * 1024));
+    for (int i = 0; i < 20; ++i) {
+        pair.a().io->runOnce(1);
+    }
+    CHECK(transfer(payload.size() / 2));
+    // Both links carried frames, and they came out in order.
+    CHECK(pair.a().mux->link(0).stats().framesOut > 0);
+    CHECK(pair.a().mux->link(1).stats().framesOut > 0);
+    CHECK(textReceived == text);
+
+    // The rest still gets there with one of the links gone.
+    ::shutdown(pair.a().mux->link(1).fd(), SHUT_RDWR);
+    CHECK(transfer(payload.size()));
+    CHECK(received == payload);
+    CHECK(pair.a().mux->linkUp());
+    CHECK(pair.b().mux->linkUp());
+    CHECK_EQ(pair.b().mux->stats().decompressErrors, 0u);
+
+    // Bonding needs the frames numbered.
+    options.creditWindow = 0;
+    CHECK_THROWS(test::MuxPair({bulk}, kind, LinkConfig(), options));
+}
+
+void testFailover(IoEngine::Kind kind)
+{
+    ChannelSpec bulk;
+    bulk.id = 1;
+    ChannelSpec quiet;
+    quiet.id = 2;
+    LinkConfig reliable{Framing::Cobs, Checksum::Crc32, true};
+    test::MuxPair::Options options;
+    options.links = 2;
+    options.heartbeatMs = 10;
+    test::MuxPair pair({bulk, quiet}, kind, reliable, options);
+
+    std::string payload;
+    for (size_t i = 0; i < 200000; ++i) {
+        payload.push_back(char('a' + i % 26));
+    }
+    size_t sent = 0;
+    std::string received;
+    auto transfer = [&](size_t until) {
+        return pair.pumpUntil([&] {
+            if (sent < until) {
+                ssize_t n = ::write(pair.a().userFds[0], payload.data() + sent, std::min<size_t>(4096, until - sent));
+                sent += n > 0 ? size_t(n) : 0;
+            }
+            received += pair.b().drain(0);
+            return received.size() >= until;
+        }, 10000);
+    };
+    CHECK(transfer(payload.size() / 2));
+    // The standby only carried heartbeats.
+    CHECK(pair.a().mux->link(1).stats().bytesOut < pair.a().mux->link(0).stats().bytesOut / 20);
+    CHECK(pair.a().mux->link(1).stats().framesOut > 0);
+    CHECK_EQ(pair.a().mux->activeLink(), 0u);
+
+    // B stops hearing the first link. It moves over, and its heartbeats on
+    // the first link tell A to follow.
+    pair.b().io->pauseRead(pair.b().mux->link(0).fd(), true);
+    CHECK(transfer(payload.size()));
+    CHECK(received == payload);
+    CHECK_EQ(pair.a().mux->activeLink(), 1u);
+    CHECK_EQ(pair.b().mux->activeLink(), 1u);
+    CHECK_EQ(pair.a().mux->stats().failovers, 1u);
+    CHECK(pair.a().mux->linkUp());
+
+    // A standby that is gone leaves nothing to fail over to.
+    ::shutdown(pair.a().mux->link(0).fd(), SHUT_RDWR);
+    CHECK(pair.a().send(1, "still here"));
+    std::string other;
+    CHECK(pair.pumpUntil([&] {
+        other += pair.b().drain(1);
+        return other.size() >= 10;
+    }));
+    CHECK(other == "still here");
+    CHECK_EQ(pair.a().mux->activeLink(), 1u);
+}
+
+void testCoalescing(IoEngine::Kind kind)
+{
+    // Keystrokes a byte at a time: one channel collects them into a frame,
+    // one sends each as it comes, and one goes as soon as 8 are waiting.
+    ChannelSpec typed;
+    typed.id = 1;
+    typed.coalesceMs = 50;
+    ChannelSpec direct;
+    direct.id = 2;
+    direct.coalesceMs = 0;
+    ChannelSpec filled;
+    filled.id = 3;
+    filled.coalesceMs = cMaxCoalesceMs;
+    filled.coalesceBytes = 8;
+    test::MuxPair pair({typed, direct, filled}, kind);
+
+    const std::string keys = "ls -l /dev\n";
+    for (char key : keys) {
+        CHECK(pair.a().send(0, std::string(1, key)));
+        pair.pump(0);
+    }
+    std::string typedAtB;
+    CHECK(pair.pumpUntil([&] {
+        typedAtB += pair.b().drain(0);
+        return typedAtB.size() >= keys.size();
+    }));
+    CHECK(typedAtB == keys);
+    CHECK(pair.a().mux->link().stats().framesOut <= 2);
+    CHECK(pair.a().mux->stats().coalescedReads >= keys.size() - 2);
+
+    uint64_t framesBefore = pair.a().mux->link().stats().framesOut;
+    for (char key : keys) {
+        CHECK(pair.a().send(1, std::string(1, key)));
+        pair.pump(0);
+    }
+    std::string directAtB;
+    CHECK(pair.pumpUntil([&] {
+        directAtB += pair.b().drain(1);
+        return directAtB.size() >= keys.size();
+    }));
+    CHECK(directAtB == keys);
+    CHECK(pair.a().mux->link().stats().framesOut - framesBefore >= keys.size() / 2);
+
+    // Long before the 100 ms wait is up.
+    for (char key : keys.substr(0, 8)) {
+        CHECK(pair.a().send(2, std::string(1, key)));
+        pair.pump(0);
+    }
+    std::string filledAtB;
+    CHECK(pair.pumpUntil([&] {
+        filledAtB += pair.b().drain(2);
+        return filledAtB.size() >= 8;
+    }, 50));
+    CHECK(filledAtB == keys.substr(0, 8));
+}
+
+void testSteadyStateAllocations(IoEngine::Kind kind, const LinkConfig& config = LinkConfig())
+{
+    test::MuxPair pair({1, 2, 3, 4}, kind, cDefaultRingSize, config);
+    std::string chunk(3000, 'z');
+    uint64_t inMux = 0;
+
+    // Traffic in both directions on every channel; only allocations made
+    // while the multiplexers run are counted, not the test's own.
+    auto exchange = [&](int rounds) {
+        std::string sink;
+        for (int r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < 4; ++i) {
+                pair.a().send(i, chunk);
+                pair.b().send(i, chunk.substr(0, 100 * (i + 1)));
+            }
+            for (int p = 0; p < 20; ++p) {
+                uint64_t before = heapAllocations();
+                pair.pump(0);
+                inMux += heapAllocations() - before;
+                for (size_t i = 0; i < 4; ++i) {
+                    sink += pair.a().drain(i);
+                    sink += pair.b().drain(i);
+                }
+                sink.clear();
+            }
+        }
+    };
+
+    exchange(50); // warm-up: engine and queue vectors reach their sizes
+    inMux = 0;
+    exchange(200);
+    CHECK_EQ(inMux, 0u);
+    CHECK(pair.a().mux->framePool().stats().acquired > 0);
+    CHECK_EQ(pair.a().mux->stats().poolDroppedBytes, 0u);
+}
+
+} // namespace
+
+int main()
+{
+    for (IoEngine::Kind kind : {IoEngine::Kind::Uring, IoEngine::Kind::Epoll, IoEngine::Kind::Poll}) {
+        testRoundTrip(kind);
+        testBulkTransfer(kind);
+        // The smallest ring wraps on nearly every batch and pauses often.
+        testBulkTransfer(kind, cMinRingSize);
+        testBulkTransfer(kind, cDefaultRingSize, {Framing::Cobs, Checksum::None});
+        testBulkTransfer(kind, cDefaultRingSize, {Framing::Length, Checksum::Crc32});
+        testBulkTransfer(kind, cDefaultRingSize, {Framing::Cobs, Checksum::Crc16});
+        testBulkTransfer(kind, cDefaultRingSize, {Framing::Length, Checksum::Crc32, true, 8});
+        testBulkTransfer(kind, cDefaultRingSize,
+                         {Framing::Cobs, Checksum::Crc16, false, Arq::cDefaultWindow, 0, HeaderFormat::Compact});
+    }
+    testManyChannels();
+    testGatheredWrite();
+    for (IoEngine::Kind kind : {IoEngine::Kind::Uring, IoEngine::Kind::Epoll}) {
+        testPriority(kind);
+        testAdaptiveFrameSize(kind);
+        testWeightedShares(kind);
+        testStalledReader(kind, LinkConfig());
+        testStalledReader(kind, {Framing::Cobs, Checksum::Crc32, true});
+        testMessages(kind, LinkConfig());
+        testMessages(kind, {Framing::Length, Checksum::Crc16, true});
+        testCoalescing(kind);
+        testLines(kind);
+        testCompression(kind, 0);
+        testCompression(kind, 8 * 1024);
+        testDictionaryMismatch(kind);
+        testBonding(kind);
+        testFailover(kind);
+    }
+    for (IoEngine::Kind kind : {IoEngine::Kind::Uring, IoEngine::Kind::Epoll, IoEngine::Kind::Poll}) {
+        testSteadyStateAllocations(kind);
+        testSteadyStateAllocations(kind, {Framing::Cobs, Checksum::Crc32, true, Arq::cDefaultWindow});
+    }
+    return test::summary("test_multiplexer");
+}
@@ -0,0 +1,196 @@
+/*
+ * test_options.cpp
+ *
+ * Command line parsing.
+ */
+#include "Options.h"
+#include "TestUtil.h"
+
+#include <initializer_list>
+#include <vector>
+
+namespace {
+
+Options parse(std::initializer_list<const char*> args)
+{
+    std::vector<std::string> storage(args.begin(), args.end());
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>("serial-mux"));
+    for (auto& s : storage) {
+        argv.push_back(&s[0]);
+    }
+    argv.push_back(nullptr);
+    return parseOptions(int(argv.size() - 1), argv.data());
+}
+
+void testChannelSpec()
+{
+    ChannelSpec spec = parseChannelSpec("10:/tmp/ptyA");
+    CHECK_EQ(spec.id, 10);
+    CHECK(spec.path == "/tmp/ptyA");
+    CHECK_EQ(parseChannelSpec("255:/x").id, 255);
+    CHECK_THROWS(parseChannelSpec("256:/x"));
+    CHECK_THROWS(parseChannelSpec("-1:/x"));
+    CHECK_THROWS(parseChannelSpec("10"));
+    CHECK_THROWS(parseChannelSpec("10:"));
+    CHECK_THROWS(parseChannelSpec(":/x"));
+}
+
+void testChannelOptions()
+{
+    CHECK_EQ(parseChannelSpec("1:/x").ringSize, cDefaultRingSize);
+    ChannelSpec spec = parseChannelSpec("10:/tmp/ptyA:ring=64k");
+    CHECK(spec.path == "/tmp/ptyA");
+    CHECK_EQ(spec.ringSize, 65536u);
+    CHECK_EQ(parseChannelSpec("10:/x:ring=8192").ringSize, 8192u);
+    CHECK_EQ(parseChannelSpec("10:/x:ring=1M").ringSize, 1048576u);
+    // Only trailing key=value fields are options.
+    CHECK(parseChannelSpec("10:/dev/serial/by-path/pci-0:1:ring=4k").path == "/dev/serial/by-path/pci-0:1");
+    CHECK_THROWS(parseChannelSpec("10:/x:ring=100"));
+    CHECK_THROWS(parseChannelSpec("10:/x:ring=1G"));
+    CHECK_THROWS(parseChannelSpec("10:/x:ring="));
+    CHECK_THROWS(parseChannelSpec("10:/x:colour=red"));
+
+    CHECK_EQ(parseChannelSpec("1:/x").priority, cDefaultPriority);
+    spec = parseChannelSpec("10:/tmp/ptyA:prio=0");
+    CHECK(spec.path == "/tmp/ptyA");
+    CHECK_EQ(spec.priority, 0u);
+    spec = parseChannelSpec("10:/x:ring=4k:prio=7");
+    CHECK_EQ(spec.priority, 7u);
+    CHECK_EQ(spec.ringSize, 4096u);
+    CHECK_THROWS(parseChannelSpec("10:/x:prio=8"));
+    CHECK_EQ(parseChannelSpec("1:/x").weight, cDefaultWeight);
+    CHECK_EQ(parseChannelSpec("10:/x:weight=5").weight, 5u);
+    CHECK_THROWS(parseChannelSpec("10:/x:weight=0"));
+    CHECK_THROWS(parseChannelSpec("10:/x:weight=65"));
+    CHECK_EQ(parseChannelSpec("1:/x").maxMessage, 0u);
+    CHECK_EQ(parseChannelSpec("10:/x:msg=4k").maxMessage, 4096u);
+    CHECK_THROWS(parseChannelSpec("10:/x:msg=0"));
+    CHECK_THROWS(parseChannelSpec("10:/x:msg=65k"));
+    CHECK_EQ(parseChannelSpec("1:/x").messageIdleMs, cDefaultMessageIdleMs);
+    CHECK_EQ(parseChannelSpec("10:/x:msg=4k:idle=20").messageIdleMs, 20u);
+    CHECK_THROWS(parseChannelSpec("10:/x:idle=0"));
+    CHECK_THROWS(parseChannelSpec("10:/x:idle=1001"));
+    ChannelSpec lines = parseChannelSpec("10:/x:delim=nl");
+    CHECK_EQ(lines.delimiter, int('\n'));
+    CHECK_EQ(lines.maxMessage, cMaxMessageSize);
+    CHECK_EQ(parseChannelSpec("10:/x").delimiter, -1);
+    CHECK_EQ(parseChannelSpec("10:/x:delim=;:msg=1k").delimiter, int(';'));
+    CHECK_EQ(parseChannelSpec("10:/x:delim=;:msg=1k").maxMessage, 1024u);
+    CHECK_EQ(parseChannelSpec("10:/x:delim=0x1e").delimiter, 0x1e);
+    CHECK_EQ(parseChannelSpec("10:/x:delim=nul").delimiter, 0);
+    CHECK_THROWS(parseChannelSpec("10:/x:delim=0x100"));
+    CHECK_THROWS(parseChannelSpec("10:/x:delim="));
+    CHECK_EQ(parseChannelSpec("10:/x").coalesceMs, cDefaultCoalesceMs);
+    ChannelSpec coalesced = parseChannelSpec("10:/x:coalesce=10:fill=64");
+    CHECK_EQ(coalesced.coalesceMs, 10u);
+    CHECK_EQ(coalesced.coalesceBytes, size_t(64));
+    CHECK_EQ(parseChannelSpec("10:/x:coalesce=0").coalesceMs, 0u);
+    CHECK_THROWS(parseChannelSpec("10:/x:coalesce=101"));
+    CHECK_THROWS(parseChannelSpec("10:/x:fill=0"));
+    CHECK_THROWS(parseChannelSpec("10:/x:fill=17k"));
+    CHECK(!parseChannelSpec("1:/x").compress);
+    CHECK(parseChannelSpec("10:/x:compress=lz").compress);
+    CHECK_THROWS(parseChannelSpec("10:/x:compress=zstd"));
+    ChannelSpec primed = parseChannelSpec("10:/x:dict=/etc/mux/shell.dict");
+    CHECK(primed.compress);
+    CHECK(primed.dictionary == "/etc/mux/shell.dict");
+    CHECK_THROWS(parseChannelSpec("10:/x:dict="));
+}
+
+void testCommandLine()
+{
+    Options opts = parse({"-c10:/tmp/ptyA", "-c", "20:/tmp/ptyB", "-b", "9600", "-e", "uring", "-v", "/dev/ttyp0"});
+    CHECK_EQ(opts.channels.size(), 2u);
+    CHECK_EQ(opts.channels[1].id, 20);
+    CHECK(opts.device == "/dev/ttyp0");
+    CHECK_EQ(opts.baud, 9600u);
+    CHECK_THROWS(parse({"-c1:/a", "-b", "0", "/dev/x"}));
+    CHECK(opts.ioEngine == IoEngine::Kind::Uring);
+    CHECK(opts.logLevel == LogLevel::Info);
+    CHECK(parse({"-c1:/a", "--io-engine=poll", "/dev/x"}).ioEngine == IoEngine::Kind::Poll);
+    CHECK_THROWS(parse({"-c1:/a", "-e", "kqueue", "/dev/x"}));
+    CHECK(parse({"-c1:/a", "/dev/x"}).framing == Framing::Length);
+    CHECK(parse({"-c1:/a", "-f", "cobs", "/dev/x"}).framing == Framing::Cobs);
+    CHECK(parse({"-c1:/a", "--framing=length", "/dev/x"}).framing == Framing::Length);
+    CHECK_THROWS(parse({"-c1:/a", "-f", "slip", "/dev/x"}));
+    CHECK(parse({"-c1:/a", "/dev/x"}).checksum == Checksum::None);
+    CHECK(parse({"-c1:/a", "-k", "crc16", "/dev/x"}).checksum == Checksum::Crc16);
+    CHECK(parse({"-c1:/a", "--checksum=crc32", "/dev/x"}).checksum == Checksum::Crc32);
+    CHECK_THROWS(parse({"-c1:/a", "-k", "md5", "/dev/x"}));
+    CHECK(parse({"-c1:/a", "/dev/x"}).header == HeaderFormat::Standard);
+    CHECK(parse({"-c1:/a", "-H", "compact", "/dev/x"}).header == HeaderFormat::Compact);
+    CHECK(parse({"-c1:/a", "--header=standard", "/dev/x"}).header == HeaderFormat::Standard);
+    CHECK_THROWS(parse({"-c1:/a", "-H", "tiny", "/dev/x"}));
+    CHECK(parse({"-c1:/a", "/dev/x"}).txPolicy == TxPolicy::Priority);
+    CHECK(parse({"-c1:/a", "-s", "drr", "/dev/x"}).txPolicy == TxPolicy::Drr);
+    CHECK_THROWS(parse({"-c1:/a", "--scheduler=fifo", "/dev/x"}));
+    CHECK(!parse({"-c1:/a", "/dev/x"}).reliable);
+    CHECK(!parse({"-c1:/a", "/dev/x"}).lowLatency);
+    CHECK(parse({"-c1:/a", "-L", "/dev/x"}).lowLatency);
+    CHECK(parse({"-c1:/a", "--low-latency", "/dev/x"}).lowLatency);
+    Options reliable = parse({"-c1:/a", "-r", "-w", "64", "/dev/x"});
+    CHECK(reliable.reliable);
+    CHECK_EQ(reliable.window, 64u);
+    CHECK(reliable.checksum == Checksum::Crc32);
+    CHECK(parse({"-c1:/a", "-r", "-k", "crc16", "/dev/x"}).checksum == Checksum::Crc16);
+    CHECK_THROWS(parse({"-c1:/a", "-r", "-k", "none", "/dev/x"}));
+    CHECK(parse({"-c1:/a:compress=lz", "-r", "/dev/x"}).channels[0].compress);
+    CHECK_THROWS(parse({"-c1:/a:compress=lz", "/dev/x"}));
+    CHECK_THROWS(parse({"-c1:/a", "-w", "129", "/dev/x"}));
+    CHECK_THROWS(parse({"-c1:/a", "-w", "0", "/dev/x"}));
+    CHECK_EQ(parse({"-c1:/a", "/dev/x"}).creditWindow, size_t(0));
+    CHECK_EQ(parse({"-c1:/a", "-C", "16k", "/dev/x"}).creditWindow, size_t(16384));
+    CHECK_EQ(parse({"-c1:/a", "--credit=2048", "/dev/x"}).creditWindow, size_t(2048));
+    CHECK_THROWS(parse({"-c1:/a", "-C", "512", "/dev/x"}));
+    CHECK_THROWS(parse({"-c1:/a", "-C", "1M", "/dev/x"}));
+
+    CHECK_THROWS(parse({"-c10:/a", "-c10:/b", "/dev/x"}));
+    CHECK_THROWS(parse({"-c10:/a"}));
+    CHECK_THROWS(parse({"/dev/x"}));
+    // More devices are bonded, which takes reliable mode.
+    CHECK_THROWS(parse({"-c10:/a", "/dev/x", "/dev/y"}));
+    Options bonded = parse({"-c10:/a", "-r", "/dev/x", "/dev/y", "/dev/z"});
+    CHECK(bonded.device == "/dev/x");
+    CHECK_EQ(bonded.bonded.size(), 2u);
+    CHECK(bonded.bonded[1] == "/dev/z");
+    CHECK(parse({"-c10:/a", "/dev/x"}).bonded.empty());
+    CHECK_THROWS(parse({"-c10:/a", "-r", "/1", "/2", "/3", "/4", "/5", "/6", "/7", "/8", "/9"}));
+    Options standby = parse({"-c10:/a", "-r", "-F", "-t", "50", "/dev/x", "/dev/y"});
+    CHECK(standby.failover);
+    CHECK_EQ(standby.heartbeatMs, 50u);
+    CHECK_EQ(parse({"-c10:/a", "-r", "--failover", "/dev/x", "/dev/y"}).heartbeatMs, Multiplexer::cDefaultHeartbeatMs);
+    CHECK_THROWS(parse({"-c10:/a", "-r", "-F", "/dev/x"}));
+    CHECK_THROWS(parse({"-c10:/a", "-F", "/dev/x", "/dev/y"}));
+    CHECK_THROWS(parse({"-c10:/a", "-r", "-F", "-t", "0", "/dev/x", "/dev/y"}));
+    CHECK(parse({"-h"}).showHelp);
+}
+
+void testEmulation()
+{
+    CHECK(!parse({"-c1:/a", "/dev/x"}).emulate);
+    Options opts = parse({"-c1:/a", "-E", "baud=9600,delay=20,jitter=0.5,drop=1e-4,ber=1e-6,seed=7", "unix:/s"});
+    CHECK(opts.emulate);
+    CHECK_EQ(opts.emulation.baud, 9600u);
+    CHECK_EQ(opts.emulation.delayNs, uint64_t(20000000));
+    CHECK_EQ(opts.emulation.jitterNs, uint64_t(500000));
+    CHECK(opts.emulation.dropRate == 1e-4);
+    CHECK(opts.emulation.bitErrorRate == 1e-6);
+    CHECK_EQ(opts.emulation.seed, uint64_t(7));
+    CHECK(parse({"-c1:/a", "--emulate=delay=5", "/dev/x"}).emulation.baud == 0);
+    CHECK_THROWS(parseEmulation("ber=2"));
+    CHECK_THROWS(parseEmulation("drop=-0.1"));
+    CHECK_THROWS(parseEmulation("delay=soon"));
+    CHECK_THROWS(parseEmulation("noise=1"));
+}
+
+} // namespace
+
+int main()
+{
+    testChannelSpec();
+    testChannelOptions();
+    testCommandLine();
+    testEmulation();
+    return test::summary("test_options");
+}
@@ -0,0 +1,77 @@
+/*
+ * test_serial_port.cpp
+ *
+ * Line rate setup of the physical port, on a pty standing in for a UART.
+ */
+#include "BaudRate.h"
+#include "SerialPort.h"
+#include "TestUtil.h"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+unsigned openedAt(const std::string& device, unsigned baud)
+{
+    int fd = openSerialPort(device, baud);
+    unsigned rate = baudRate(fd);
+    ::close(fd);
+    return rate;
+}
+
+void testRates(const std::string& device)
+{
+    CHECK_EQ(openedAt(device, 115200), 115200u);
+    CHECK_EQ(openedAt(device, 3000000), 3000000u);
+    // No Bxxxx constant for these.
+    CHECK_EQ(baudToSpeed(250000), speed_t(B0));
+    CHECK_EQ(openedAt(device, 250000), 250000u);
+    CHECK_EQ(openedAt(device, 12000000), 12000000u);
+    CHECK_EQ(openedAt(device, 31250), 31250u);
+    // 0 would mean hang up.
+    CHECK_THROWS(openSerialPort(device, 0));
+}
+
+void testLowLatency(const std::string& device)
+{
+    // A pty has none of the driver knobs; the line is set up all the same.
+    int fd = openSerialPort(device, 250000, true);
+    CHECK(fd >= 0);
+    termios tio;
+    CHECK(::tcgetattr(fd, &tio) == 0);
+    CHECK_EQ(tio.c_cc[VMIN], cc_t(1));
+    CHECK_EQ(tio.c_cc[VTIME], cc_t(0));
+    CHECK(!(tio.c_lflag & ICANON));
+    CHECK_EQ(baudRate(fd), 250000u);
+    ::close(fd);
+}
+
+void testNotATty()
+{
+    int fds[2];
+    CHECK(::pipe(fds) == 0);
+    std::string path = "/proc/self/fd/" + std::to_string(fds[0]);
+    int fd = openSerialPort(path, 250000);
+    CHECK(fd >= 0);
+    CHECK_EQ(baudRate(fd), 0u);
+    ::close(fd);
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+} // namespace
+
+int main()
+{
+    int master = ::posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(master >= 0 && ::grantpt(master) == 0 && ::unlockpt(master) == 0);
+    testRates(::ptsname(master));
+    testLowLatency(::ptsname(master));
+    testNotATty();
+    ::close(master);
+    return test::summary("test_serial_port");
+}
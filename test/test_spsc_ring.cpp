@@ -0,0 +1,115 @@
+/*
+ * test_spsc_ring.cpp
+ *
+ * The lock-free ring between the channel readers and the link transmitter.
+ */
+#include "SpscRing.h"
+#include "TestUtil.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string peekAll(const SpscRing& ring)
+{
+    std::string out;
+    const uint8_t* data;
+    size_t len;
+    while ((len = ring.peek(out.size(), data, SIZE_MAX)) > 0) {
+        out.append(reinterpret_cast<const char*>(data), len);
+    }
+    return out;
+}
+
+void testWrapAround()
+{
+    SpscRing ring(10);
+    CHECK_EQ(ring.capacity(), 16u);
+    const uint8_t* text = reinterpret_cast<const uint8_t*>("abcdefghijklmnopqrstuvwxyz");
+
+    CHECK_EQ(ring.write(text, 12), 12u);
+    ring.consume(10);
+    CHECK_EQ(ring.writable(), 14u);
+
+    // 12 bytes starting at offset 12 wrap after 4.
+    CHECK_EQ(ring.write(text + 12, 12), 12u);
+    const uint8_t* data;
+    CHECK_EQ(ring.peek(0, data, SIZE_MAX), 6u);
+    CHECK_EQ(ring.peek(6, data, SIZE_MAX), 8u);
+    CHECK_EQ(ring.peek(0, data, 3), 3u);
+    CHECK_EQ(ring.peek(14, data, SIZE_MAX), 0u);
+    CHECK(peekAll(ring) == "klmnopqrstuvwx");
+
+    // Peeking does not release anything; consume() does.
+    CHECK_EQ(ring.readable(), 14u);
+    ring.consume(14);
+    CHECK(ring.empty());
+}
+
+void testFull()
+{
+    SpscRing ring(16);
+    std::vector<uint8_t> data(20, 'x');
+    CHECK_EQ(ring.write(data.data(), data.size()), 16u);
+    CHECK_EQ(ring.writable(), 0u);
+    CHECK_EQ(ring.write(data.data(), 1), 0u);
+    ring.consume(1);
+    CHECK_EQ(ring.write(data.data(), 5), 1u);
+}
+
+void testTwoThreads()
+{
+    SpscRing ring(256);
+    const size_t total = 200000;
+    std::thread producer([&] {
+        uint8_t chunk[61];
+        size_t sent = 0;
+        while (sent < total) {
+            size_t len = std::min(sizeof(chunk), total - sent);
+            for (size_t i = 0; i < len; ++i) {
+                chunk[i] = uint8_t((sent + i) % 251);
+            }
+            size_t done = 0;
+            while (done < len) {
+                size_t n = ring.write(chunk + done, len - done);
+                if (n == 0) {
+                    // Give the consumer the CPU rather than spin out the timeslice.
+                    std::this_thread::yield();
+                }
+                done += n;
+            }
+            sent += len;
+        }
+    });
+
+    size_t received = 0;
+    bool ordered = true;
+    while (received < total) {
+        const uint8_t* data;
+        size_t len = ring.peek(0, data, SIZE_MAX);
+        if (len == 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < len; ++i) {
+            ordered = ordered && data[i] == uint8_t((received + i) % 251);
+        }
+        ring.consume(len);
+        received += len;
+    }
+    producer.join();
+    CHECK(ordered);
+    CHECK(ring.empty());
+}
+
+} // namespace
+
+int main()
+{
+    testWrapAround();
+    testFull();
+    testTwoThreads();
+    return test::summary("test_spsc_ring");
+}
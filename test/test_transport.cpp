@@ -0,0 +1,136 @@
+/*
+ * test_transport.cpp
+ *
+ * Opening the physical link over sockets, both ends in this process.
+ */
+#include "TestUtil.h"
+#include "Transport.h"
+
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+/// A loopback port nobody is using right now.
+unsigned freePort(int type)
+{
+    int fd = ::socket(AF_INET, type, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    CHECK(::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+    CHECK(::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0);
+    ::close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/// Write text on one end and check it arrives on the other in one read.
+void checkPassesData(int from, int to, const std::string& text)
+{
+    CHECK(::write(from, text.data(), text.size()) == ssize_t(text.size()));
+    char buf[64] = {};
+    ssize_t n;
+    do {
+        n = ::read(to, buf, sizeof(buf));
+    } while (n < 0 && errno == EINTR);
+    CHECK(n == ssize_t(text.size()) && std::memcmp(buf, text.data(), text.size()) == 0);
+}
+
+/// Open listenUri in a thread and connectUri here, retrying the connect
+/// until the listener is up.
+void checkStreamPair(const std::string& listenUri, const std::string& connectUri)
+{
+    Transport server;
+    std::thread listener([&] { server = openTransport(listenUri, 0); });
+    Transport client;
+    for (int attempt = 0; attempt < 200 && client.fd < 0; ++attempt) {
+        try {
+            client = openTransport(connectUri, 0);
+        } catch (const std::exception&) {
+            ::usleep(5000);
+        }
+    }
+    listener.join();
+    CHECK(client.fd >= 0 && server.fd >= 0);
+    CHECK_EQ(client.maxWrite, size_t(0));
+    CHECK_EQ(server.baud, 0u);
+    checkPassesData(client.fd, server.fd, "hello");
+    checkPassesData(server.fd, client.fd, "world");
+    ::close(client.fd);
+    ::close(server.fd);
+}
+
+void testTcp()
+{
+    unsigned port = freePort(SOCK_STREAM);
+    checkStreamPair("tcp-listen://127.0.0.1:" + std::to_string(port), "tcp://127.0.0.1:" + std::to_string(port));
+    port = freePort(SOCK_STREAM);
+    checkStreamPair("tcp-listen://:" + std::to_string(port), "tcp://localhost:" + std::to_string(port));
+}
+
+void testUnix()
+{
+    std::string path = "/tmp/test_transport." + std::to_string(::getpid());
+    checkStreamPair("unix-listen:" + path, "unix:" + path);
+    // The listener removes the socket once connected.
+    CHECK(::access(path.c_str(), F_OK) < 0);
+}
+
+void testUdp()
+{
+    std::string a = std::to_string(freePort(SOCK_DGRAM));
+    std::string b = std::to_string(freePort(SOCK_DGRAM));
+    Transport left = openTransport("udp://127.0.0.1:" + b + "?bind=" + a, 0);
+    Transport right = openTransport("udp://127.0.0.1:" + a + "?bind=127.0.0.1:" + b + "&mtu=4096", 0);
+    CHECK_EQ(left.maxWrite, size_t(1472));
+    CHECK_EQ(right.maxWrite, size_t(4096));
+    checkPassesData(left.fd, right.fd, "ping");
+    checkPassesData(right.fd, left.fd, "pong");
+    ::close(right.fd);
+
+    // Nobody listens any more: the refusal is reported, and the socket
+    // still works once it has been.
+    const char x = 'x';
+    CHECK(::write(left.fd, &x, 1) == 1);
+    ::usleep(10000);
+    char buf[4];
+    CHECK(::recv(left.fd, buf, sizeof(buf), MSG_DONTWAIT) < 0 && errno == ECONNREFUSED);
+    CHECK(::write(left.fd, &x, 1) == 1);
+    ::close(left.fd);
+}
+
+void testUris()
+{
+    CHECK(isSerialUri("/dev/ttyS0"));
+    CHECK(isSerialUri("serial:/dev/ttyUSB0"));
+    CHECK(!isSerialUri("tcp://host:1"));
+    CHECK(!isSerialUri("tcp-listen://:1"));
+    CHECK(!isSerialUri("udp://[::1]:1"));
+    CHECK(!isSerialUri("unix:/tmp/x"));
+    CHECK(!isSerialUri("unix-listen:/tmp/x"));
+
+    CHECK_THROWS(openTransport("tcp://localhost", 0));
+    CHECK_THROWS(openTransport("tcp://[::1:5000", 0));
+    CHECK_THROWS(openTransport("udp://127.0.0.1:5000?mtu=100", 0));
+    CHECK_THROWS(openTransport("udp://127.0.0.1:5000?mtu=65536", 0));
+    CHECK_THROWS(openTransport("udp://127.0.0.1:5000?port=1", 0));
+    CHECK_THROWS(openTransport("unix:", 0));
+    CHECK_THROWS(openTransport("serial:/nonexistent/tty", 115200));
+}
+
+} // namespace
+
+int main()
+{
+    testTcp();
+    testUnix();
+    testUdp();
+    testUris();
+    return test::summary("test_transport");
+}
@@ -0,0 +1,114 @@
+/*
+ * test_tx_scheduler.cpp
+ *
+ * Priority order and turn-taking of channels waiting for the link.
+ */
+#include "TestUtil.h"
+#include "TxScheduler.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+std::vector<unsigned> drain(TxScheduler& s)
+{
+    std::vector<unsigned> order;
+    while (!s.empty()) {
+        order.push_back(s.front());
+        s.pop();
+    }
+    return order;
+}
+
+void testPriorityOrder()
+{
+    TxScheduler s;
+    CHECK(s.empty());
+    s.push(10, 4);
+    s.push(20, 7);
+    s.push(30, 0);
+    s.push(11, 4);
+    s.push(10, 4); // already queued: keeps its place
+    CHECK(s.queued(10));
+    CHECK_EQ(s.frontLevel(), 0u);
+    CHECK(drain(s) == std::vector<unsigned>({30, 10, 11, 20}));
+    CHECK(!s.queued(10));
+}
+
+void testTurns()
+{
+    // A channel that is served and still has data rejoins behind the others.
+    TxScheduler s;
+    for (unsigned id : {1, 2, 3}) {
+        s.push(uint8_t(id), 2);
+    }
+    std::vector<unsigned> order;
+    for (int i = 0; i < 6; ++i) {
+        uint8_t id = s.front();
+        order.push_back(id);
+        s.pop();
+        s.push(id, 2);
+    }
+    CHECK(order == std::vector<unsigned>({1, 2, 3, 1, 2, 3}));
+
+    // A higher priority arriving meanwhile goes first.
+    s.push(255, 1);
+    CHECK_EQ(s.front(), 255);
+}
+
+void testDrrShares()
+{
+    // Three always-backlogged channels with weights 1, 2 and 5, served the
+    // way the Multiplexer does: whatever the allowance permits, in frames.
+    TxScheduler s;
+    s.setPolicy(TxPolicy::Drr);
+    const unsigned weights[] = {1, 2, 5};
+    size_t sent[3] = {};
+    for (uint8_t id = 0; id < 3; ++id) {
+        s.setWeight(id, weights[id]);
+        s.push(id, id); // levels are ignored
+    }
+    for (int visit = 0; visit < 300; ++visit) {
+        uint8_t id = s.front();
+        s.pop();
+        size_t allowed = s.allowance(id);
+        CHECK(allowed > 0);
+        sent[id] += allowed;
+        s.used(id, allowed, false);
+        s.push(id, 0);
+    }
+    CHECK_EQ(sent[1], 2 * sent[0]);
+    CHECK_EQ(sent[2], 5 * sent[0]);
+}
+
+void testDrrCarryAndForfeit()
+{
+    TxScheduler s;
+    s.setPolicy(TxPolicy::Drr);
+    s.setWeight(7, 2);
+    // Cut short (the batch filled): the rest of the turn carries over.
+    CHECK_EQ(s.allowance(7), 2 * cDrrQuantum);
+    s.used(7, 100, false);
+    CHECK_EQ(s.allowance(7), 2 * cDrrQuantum - 100);
+    s.used(7, 2 * cDrrQuantum - 100, false);
+    // Turn over: a new quantum.
+    CHECK_EQ(s.allowance(7), 2 * cDrrQuantum);
+    // Running dry forfeits what is left.
+    s.used(7, 10, true);
+    CHECK_EQ(s.allowance(7), 2 * cDrrQuantum);
+
+    TxScheduler p;
+    CHECK_EQ(p.allowance(7), SIZE_MAX);
+}
+
+} // namespace
+
+int main()
+{
+    testPriorityOrder();
+    testTurns();
+    testDrrShares();
+    testDrrCarryAndForfeit();
+    return test::summary("test_tx_scheduler");
+}